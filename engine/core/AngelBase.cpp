@@ -4,6 +4,7 @@
 import VulkanRenderer;
 import ServiceLocator;
 import FileLoaderSystem;
+import JobSystem;
 import std;
 
 class Engine
@@ -15,13 +16,18 @@ public:
 
 int main()
 {
+    JobSystem::Initialize();
     Engine e;
     e.renderer = new Rendering::Vulkan::VulkanRenderer();
     ServiceLocator::Instance()->RegisterSystem(e.renderer);
     e.fileLoaderSystem = new AngelBase::Core::FileLoaderSystem();
     ServiceLocator::Instance()->RegisterSystem(e.fileLoaderSystem);
+    // built by the PackAssets target, loose files are still readable through asyncReadFile if it is missing
+    e.fileLoaderSystem->mountArchive("assets.pak");
+    // 16 x 4 MiB pinned buffers for streaming mips/meshes past the page cache
+    e.fileLoaderSystem->initializeDirectIO(16, 4 * 1024 * 1024);
     e.renderer->initialize(2560, 1440);
     e.renderer->Render();
     e.renderer->shutdown();
-    
+    JobSystem::Shutdown();
 }
@@ -0,0 +1,389 @@
+module;
+#include <cstdint>
+#include <cstring>
+#include <lz4.h>
+#include <lz4hc.h>
+#include <zstd.h>
+export module AssetArchive;
+
+import std;
+import Hash;
+
+/**
+ * Packed asset archive (.pak) format. \n
+ * Layout: [header, padded to alignment][entry data, each entry aligned][hashed TOC, aligned] \n
+ * The TOC is an open addressing table (power of two slot count, linear probing) keyed by the asset id,
+ * so a lookup is a mask and usually a single compare. \n
+ * Compressed entries are split into ARCHIVE_CHUNK_SIZE chunks that are compressed independently so they can be
+ * decompressed in parallel. Their stored data starts with a uint32_t size per chunk, followed by the chunks.
+ */
+namespace AngelBase::Core
+{
+    export using AssetId = uint64_t;
+
+    export constexpr uint32_t ARCHIVE_MAGIC = 0x4B504241; // "ABPK"
+    export constexpr uint32_t ARCHIVE_VERSION = 2;
+    export constexpr uint32_t ARCHIVE_ALIGNMENT = 4096;
+    // sanity cap on the TOC of an archive being mounted, a corrupt header must not ask for gigabytes (2M assets)
+    export constexpr uint64_t ARCHIVE_MAX_TOC_SLOTS = 1ull << 22;
+    // uncompressed size of every chunk but the last
+    export constexpr uint32_t ARCHIVE_CHUNK_SIZE = 256 * 1024;
+    // set in a chunk size when that chunk didn't compress and is stored as is
+    export constexpr uint32_t ARCHIVE_CHUNK_STORED_RAW = 0x80000000u;
+
+    export enum class ArchiveCompression : uint32_t
+    {
+        None = 0,
+        LZ4 = 1,
+        Zstd = 2
+    };
+
+    export struct ArchiveHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t alignment;
+        uint32_t entry_count;
+        uint64_t toc_offset;
+        // amount of slots in the TOC, always a power of two
+        uint64_t toc_slot_count;
+    };
+
+    export struct ArchiveTocSlot
+    {
+        // 0 means the slot is empty
+        AssetId id;
+        uint64_t offset;
+        // bytes stored in the archive, including the chunk table
+        uint64_t size;
+        uint64_t uncompressed_size;
+        ArchiveCompression compression;
+        uint32_t chunk_count;
+    };
+
+    /**
+     * Compresses one chunk
+     * @param compression codec to use, not None
+     * @param source uncompressed data
+     * @param source_size at most ARCHIVE_CHUNK_SIZE
+     * @param destination output
+     * @param destination_capacity should be at least compressChunkBound(source_size)
+     * @return compressed size, 0 if it failed or didn't fit
+     */
+    export size_t compressChunk(ArchiveCompression compression, const void* source, size_t source_size,
+                                void* destination, size_t destination_capacity)
+    {
+        switch (compression)
+        {
+        case ArchiveCompression::LZ4:
+            {
+                int result = LZ4_compress_HC(static_cast<const char*>(source), static_cast<char*>(destination),
+                                             static_cast<int>(source_size), static_cast<int>(destination_capacity),
+                                             LZ4HC_CLEVEL_DEFAULT);
+                return result > 0 ? static_cast<size_t>(result) : 0;
+            }
+        case ArchiveCompression::Zstd:
+            {
+                size_t result = ZSTD_compress(destination, destination_capacity, source, source_size, 19);
+                return ZSTD_isError(result) ? 0 : result;
+            }
+        case ArchiveCompression::None:
+            break;
+        }
+        return 0;
+    }
+
+    export size_t compressChunkBound(size_t source_size)
+    {
+        return std::max(static_cast<size_t>(LZ4_compressBound(static_cast<int>(source_size))), ZSTD_compressBound(source_size));
+    }
+
+    /**
+     * Decompresses one chunk. Thread safe, each thread keeps its own zstd context
+     * @param compression codec the chunk was compressed with
+     * @param source compressed data
+     * @param source_size compressed size
+     * @param destination output
+     * @param destination_size exact uncompressed size of the chunk
+     * @return false if the data is corrupt
+     */
+    export bool decompressChunk(ArchiveCompression compression, const void* source, size_t source_size,
+                                void* destination, size_t destination_size)
+    {
+        switch (compression)
+        {
+        case ArchiveCompression::LZ4:
+            {
+                int result = LZ4_decompress_safe(static_cast<const char*>(source), static_cast<char*>(destination),
+                                                 static_cast<int>(source_size), static_cast<int>(destination_size));
+                return result == static_cast<int>(destination_size);
+            }
+        case ArchiveCompression::Zstd:
+            {
+                thread_local std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> context(ZSTD_createDCtx(), &ZSTD_freeDCtx);
+                size_t result = ZSTD_decompressDCtx(context.get(), destination, destination_size, source, source_size);
+                return !ZSTD_isError(result) && result == destination_size;
+            }
+        case ArchiveCompression::None:
+            if (source_size != destination_size) return false;
+            std::memcpy(destination, source, source_size);
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Turns a path relative to the asset root into its archive id. \n
+     * Paths are case insensitive and both separators are accepted, so "Shaders\\Shader.slang" == "shaders/shader.slang"
+     * @param relative_path path relative to the assets folder
+     * @return id of the asset, never 0
+     */
+    export constexpr AssetId makeAssetId(std::string_view relative_path)
+    {
+        while (relative_path.starts_with("./") || relative_path.starts_with(".\\"))
+        {
+            relative_path.remove_prefix(2);
+        }
+
+        uint64_t hash = Hash::FNV_OFFSET_BASIS;
+        for (char c : relative_path)
+        {
+            if (c == '\\') c = '/';
+            if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+            hash = Hash::fnv1a64(std::string_view(&c, 1), hash);
+        }
+        // 0 is reserved for empty TOC slots
+        return hash == 0 ? 1 : hash;
+    }
+
+    export constexpr uint64_t alignArchiveOffset(uint64_t offset, uint64_t alignment = ARCHIVE_ALIGNMENT)
+    {
+        return (offset + alignment - 1) & ~(alignment - 1);
+    }
+
+    /**
+     * In memory copy of an archive's TOC
+     */
+    export class ArchiveToc
+    {
+    public:
+        /**
+         * Validates the header and takes ownership of the slots read from disk
+         * @param header header read from the start of the archive
+         * @param slots toc_slot_count slots read from header.toc_offset
+         * @return false if the archive is not one we can read
+         */
+        bool initialize(const ArchiveHeader& header, std::vector<ArchiveTocSlot>&& slots)
+        {
+            if (header.magic != ARCHIVE_MAGIC || header.version != ARCHIVE_VERSION)
+            {
+                std::cerr << "ArchiveToc: bad magic or unsupported version " << header.version << "\n";
+                return false;
+            }
+            if (header.toc_slot_count == 0 || (header.toc_slot_count & (header.toc_slot_count - 1)) != 0 ||
+                slots.size() != header.toc_slot_count)
+            {
+                std::cerr << "ArchiveToc: TOC slot count is not a power of two\n";
+                return false;
+            }
+            m_slots = std::move(slots);
+            m_mask = header.toc_slot_count - 1;
+            m_entry_count = header.entry_count;
+            return true;
+        }
+
+        /**
+         * O(1) lookup of an entry
+         * @param id id from makeAssetId
+         * @return the slot, or nullptr if the archive doesn't contain the asset
+         */
+        const ArchiveTocSlot* find(AssetId id) const
+        {
+            if (m_slots.empty()) return nullptr;
+            for (uint64_t i = id & m_mask, probes = 0; probes <= m_mask; i = (i + 1) & m_mask, ++probes)
+            {
+                const ArchiveTocSlot& slot = m_slots[i];
+                if (slot.id == id) return &slot;
+                if (slot.id == 0) return nullptr;
+            }
+            return nullptr;
+        }
+
+        uint32_t entryCount() const { return m_entry_count; }
+
+    private:
+        std::vector<ArchiveTocSlot> m_slots;
+        uint64_t m_mask = 0;
+        uint32_t m_entry_count = 0;
+    };
+
+    /**
+     * Builds an archive from a directory tree. Used by the AssetPacker build step
+     */
+    export class ArchiveWriter
+    {
+    public:
+        /**
+         * @param compression codec for every entry. Entries (and chunks) that don't shrink are stored uncompressed
+         */
+        explicit ArchiveWriter(ArchiveCompression compression = ArchiveCompression::None)
+            :m_compression(compression)
+        {}
+
+        /**
+         * Queues a file to be packed
+         * @param relative_path path relative to the asset root, this is what gets hashed
+         * @param source_path where to read the file from
+         * @return false if the id collides with an already added asset
+         */
+        bool addFile(const std::string& relative_path, const std::filesystem::path& source_path)
+        {
+            AssetId id = makeAssetId(relative_path);
+            auto [iter, inserted] = m_paths.insert({id, relative_path});
+            if (!inserted)
+            {
+                std::cerr << "ArchiveWriter: id collision between " << iter->second << " and " << relative_path << "\n";
+                return false;
+            }
+            m_files.push_back({id, source_path});
+            return true;
+        }
+
+        /**
+         * Writes the archive out
+         * @param output_path where the .pak goes
+         * @return false on any I/O error
+         */
+        bool write(const std::filesystem::path& output_path) const
+        {
+            std::ofstream out(output_path, std::ios::binary | std::ios::trunc);
+            if (!out.is_open())
+            {
+                std::cerr << "ArchiveWriter: failed to open " << output_path << "\n";
+                return false;
+            }
+
+            // keep the load factor at or under 50% so probes stay short
+            uint64_t slot_count = std::bit_ceil(std::max<uint64_t>(m_files.size() * 2, 16));
+            std::vector<ArchiveTocSlot> slots(slot_count, ArchiveTocSlot{});
+
+            // header is rewritten once we know where the TOC is
+            ArchiveHeader header = {};
+            writePadding(out, ARCHIVE_ALIGNMENT);
+
+            std::vector<char> file_data;
+            std::vector<char> packed_data;
+            for (const auto& file : m_files)
+            {
+                std::ifstream in(file.source_path, std::ios::binary | std::ios::ate);
+                if (!in.is_open())
+                {
+                    std::cerr << "ArchiveWriter: failed to read " << file.source_path << "\n";
+                    return false;
+                }
+                file_data.resize(static_cast<size_t>(in.tellg()));
+                in.seekg(0, std::ios::beg);
+                in.read(file_data.data(), static_cast<std::streamsize>(file_data.size()));
+
+                ArchiveTocSlot slot = {};
+                slot.id = file.id;
+                slot.offset = static_cast<uint64_t>(out.tellp());
+                slot.uncompressed_size = file_data.size();
+                if (packChunks(file_data, packed_data, slot.chunk_count))
+                {
+                    slot.compression = m_compression;
+                    slot.size = packed_data.size();
+                    out.write(packed_data.data(), static_cast<std::streamsize>(packed_data.size()));
+                }
+                else
+                {
+                    slot.compression = ArchiveCompression::None;
+                    slot.chunk_count = 0;
+                    slot.size = file_data.size();
+                    out.write(file_data.data(), static_cast<std::streamsize>(file_data.size()));
+                }
+                uint64_t end = static_cast<uint64_t>(out.tellp());
+                writePadding(out, alignArchiveOffset(end) - end);
+
+                insertSlot(slots, slot);
+            }
+
+            header.magic = ARCHIVE_MAGIC;
+            header.version = ARCHIVE_VERSION;
+            header.alignment = ARCHIVE_ALIGNMENT;
+            header.entry_count = static_cast<uint32_t>(m_files.size());
+            header.toc_offset = static_cast<uint64_t>(out.tellp());
+            header.toc_slot_count = slot_count;
+            out.write(reinterpret_cast<const char*>(slots.data()),
+                      static_cast<std::streamsize>(slots.size() * sizeof(ArchiveTocSlot)));
+
+            out.seekp(0, std::ios::beg);
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            return out.good();
+        }
+
+    private:
+        struct PendingFile
+        {
+            AssetId id;
+            std::filesystem::path source_path;
+        };
+        std::vector<PendingFile> m_files;
+        std::unordered_map<AssetId, std::string> m_paths;
+        ArchiveCompression m_compression;
+
+        /**
+         * Compresses a file chunk by chunk into [chunk sizes][chunks]
+         * @param file_data uncompressed file
+         * @param packed_data output
+         * @param chunk_count amount of chunks written
+         * @return false if the file should be stored uncompressed instead
+         */
+        bool packChunks(const std::vector<char>& file_data, std::vector<char>& packed_data, uint32_t& chunk_count) const
+        {
+            if (m_compression == ArchiveCompression::None || file_data.empty()) return false;
+
+            chunk_count = static_cast<uint32_t>((file_data.size() + ARCHIVE_CHUNK_SIZE - 1) / ARCHIVE_CHUNK_SIZE);
+            std::vector<uint32_t> chunk_sizes(chunk_count);
+            packed_data.resize(chunk_count * sizeof(uint32_t));
+
+            std::vector<char> chunk(compressChunkBound(ARCHIVE_CHUNK_SIZE));
+            for (uint32_t i = 0; i < chunk_count; ++i)
+            {
+                const char* source = file_data.data() + static_cast<size_t>(i) * ARCHIVE_CHUNK_SIZE;
+                size_t source_size = std::min<size_t>(ARCHIVE_CHUNK_SIZE, file_data.size() - static_cast<size_t>(i) * ARCHIVE_CHUNK_SIZE);
+                size_t compressed = compressChunk(m_compression, source, source_size, chunk.data(), chunk.size());
+                if (compressed == 0 || compressed >= source_size)
+                {
+                    chunk_sizes[i] = static_cast<uint32_t>(source_size) | ARCHIVE_CHUNK_STORED_RAW;
+                    packed_data.insert(packed_data.end(), source, source + source_size);
+                }
+                else
+                {
+                    chunk_sizes[i] = static_cast<uint32_t>(compressed);
+                    packed_data.insert(packed_data.end(), chunk.data(), chunk.data() + compressed);
+                }
+            }
+            std::memcpy(packed_data.data(), chunk_sizes.data(), chunk_sizes.size() * sizeof(uint32_t));
+
+            return packed_data.size() < file_data.size();
+        }
+
+        static void insertSlot(std::vector<ArchiveTocSlot>& slots, const ArchiveTocSlot& slot)
+        {
+            uint64_t mask = slots.size() - 1;
+            uint64_t i = slot.id & mask;
+            while (slots[i].id != 0)
+            {
+                i = (i + 1) & mask;
+            }
+            slots[i] = slot;
+        }
+
+        static void writePadding(std::ofstream& out, uint64_t amount)
+        {
+            static constexpr char zeroes[ARCHIVE_ALIGNMENT] = {};
+            out.write(zeroes, static_cast<std::streamsize>(amount));
+        }
+    };
+}
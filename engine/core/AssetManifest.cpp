@@ -0,0 +1,132 @@
+module;
+#include <cstdint>
+export module AssetManifest;
+
+import std;
+import JsonParser;
+
+/**
+ * JSON manifests listing what a level loads, see JsonParser. Paths are relative to the executable like every other
+ * asset path
+ */
+namespace AngelBase::Core
+{
+    export struct TextureManifestEntry
+    {
+        std::string name;
+        std::string path;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t mip_levels = 1;
+        bool srgb = true;
+    };
+
+    export struct MeshManifestEntry
+    {
+        std::string name;
+        std::string path;
+        std::string material;
+    };
+
+    export struct ShaderManifestEntry
+    {
+        // shader file name, e.g. "shader.slang"
+        std::string name;
+        // feature constants of the variant, see ShaderManager::getShaderVariant
+        std::vector<std::string> features;
+    };
+
+    /**
+     * \b Format: { "textures": [...], "meshes": [...], "shaders": [...] }
+     */
+    export struct AssetManifest
+    {
+        std::vector<TextureManifestEntry> textures;
+        std::vector<MeshManifestEntry> meshes;
+        std::vector<ShaderManifestEntry> shaders;
+    };
+
+    export struct SceneEntity
+    {
+        std::string name;
+        std::string mesh;
+        std::string texture;
+        std::array<float, 3> position = {0.0f, 0.0f, 0.0f};
+        // quaternion, xyzw
+        std::array<float, 4> rotation = {0.0f, 0.0f, 0.0f, 1.0f};
+        std::array<float, 3> scale = {1.0f, 1.0f, 1.0f};
+    };
+
+    /**
+     * \b Format: { "name": "...", "entities": [{ "name", "mesh", "texture", "position", "rotation", "scale" }, ...] }
+     */
+    export struct SceneManifest
+    {
+        std::string name;
+        std::vector<SceneEntity> entities;
+    };
+}
+
+template <>
+struct JsonSchema<AngelBase::Core::TextureManifestEntry>
+{
+    using T = AngelBase::Core::TextureManifestEntry;
+    static constexpr auto fields = std::make_tuple(
+        jsonField("name", &T::name),
+        jsonField("path", &T::path),
+        jsonField("width", &T::width),
+        jsonField("height", &T::height),
+        jsonField("mips", &T::mip_levels),
+        jsonField("srgb", &T::srgb));
+};
+
+template <>
+struct JsonSchema<AngelBase::Core::MeshManifestEntry>
+{
+    using T = AngelBase::Core::MeshManifestEntry;
+    static constexpr auto fields = std::make_tuple(
+        jsonField("name", &T::name),
+        jsonField("path", &T::path),
+        jsonField("material", &T::material));
+};
+
+template <>
+struct JsonSchema<AngelBase::Core::ShaderManifestEntry>
+{
+    using T = AngelBase::Core::ShaderManifestEntry;
+    static constexpr auto fields = std::make_tuple(
+        jsonField("name", &T::name),
+        jsonField("features", &T::features));
+};
+
+template <>
+struct JsonSchema<AngelBase::Core::AssetManifest>
+{
+    using T = AngelBase::Core::AssetManifest;
+    static constexpr auto fields = std::make_tuple(
+        jsonField("textures", &T::textures),
+        jsonField("meshes", &T::meshes),
+        jsonField("shaders", &T::shaders));
+};
+
+template <>
+struct JsonSchema<AngelBase::Core::SceneEntity>
+{
+    using T = AngelBase::Core::SceneEntity;
+    static constexpr auto fields = std::make_tuple(
+        jsonField("name", &T::name),
+        jsonField("mesh", &T::mesh),
+        jsonField("texture", &T::texture),
+        jsonField("position", &T::position),
+        jsonField("rotation", &T::rotation),
+        jsonField("scale", &T::scale));
+};
+
+template <>
+struct JsonSchema<AngelBase::Core::SceneManifest>
+{
+    using T = AngelBase::Core::SceneManifest;
+    static constexpr auto fields = std::make_tuple(
+        jsonField("name", &T::name),
+        jsonField("entities", &T::entities));
+};
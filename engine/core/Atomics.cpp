@@ -86,12 +86,12 @@ namespace Atomics
         }
 
         /**
-         * decrements counter
+         * decrements counter-- release so work done before the decrement is visible to whoever waits for zero
          * @return returns the original counter value before decrementing 
          */
         uint32_t decrement() {
             if (internal) {
-                return internal->counter.fetch_sub(1, std::memory_order_acquire);
+                return internal->counter.fetch_sub(1, std::memory_order_acq_rel);
             }
             return 0;
         }
@@ -101,7 +101,7 @@ namespace Atomics
          * @return 
          */
         uint32_t get() const {
-            return internal ? internal->counter.load(std::memory_order_relaxed) : 0;
+            return internal ? internal->counter.load(std::memory_order_acquire) : 0;
         }
 
 
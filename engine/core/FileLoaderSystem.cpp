@@ -1,12 +1,23 @@
 ﻿module;
-#include "MPMCQueue.h"
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cerrno>
+#endif
 #include "atomic"
+#include <cstring>
+#include <new>
 export module FileLoaderSystem;
 
 import std;
 import ServiceLocator;
 import Atomics;
+import AssetArchive;
+import JobSystem;
 
 class TextureManager;
 
@@ -25,22 +36,409 @@ namespace AngelBase::Core
     {
         Pending = 0,
         Success = 1,
-        Failed = 2
+        Failed = 2,
+        // cancelled with asyncCancel, or dropped for missing its deadline
+        Cancelled = 3
     };
     
     export using AsyncFileHandle = FILE*;
         
     export using AsyncFileBuffer = uint8_t*;
 
+#ifdef _WIN32
+    using NativeFile = HANDLE;
+#else
+    using NativeFile = int;
+#endif
+
+    static bool isValidNativeFile(NativeFile file)
+    {
+#ifdef _WIN32
+        return file != INVALID_HANDLE_VALUE && file != nullptr;
+#else
+        return file >= 0;
+#endif
+    }
+
+    static NativeFile invalidNativeFile()
+    {
+#ifdef _WIN32
+        return INVALID_HANDLE_VALUE;
+#else
+        return -1;
+#endif
+    }
+
+    /**
+     * Opens a file for positional reads. One handle can be shared by every worker
+     * @param path path to the file
+     * @return handle, check with isValidNativeFile
+     */
+    static NativeFile openNativeFile(const char* path)
+    {
+#ifdef _WIN32
+        return CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+#else
+        return ::open(path, O_RDONLY | O_CLOEXEC);
+#endif
+    }
+
+    /**
+     * Opens a file for unbuffered reads that bypass the page cache (O_DIRECT / FILE_FLAG_NO_BUFFERING / F_NOCACHE).
+     * Reads on it must use DIRECT_IO_ALIGNMENT aligned offsets, sizes and buffers
+     * @param path path to the file
+     * @param direct set to false if the filesystem refused direct I/O and a buffered handle was returned instead
+     * @return handle, check with isValidNativeFile
+     */
+    static NativeFile openNativeFileDirect(const char* path, bool& direct)
+    {
+        direct = false;
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (isValidNativeFile(file))
+        {
+            direct = true;
+            return file;
+        }
+#elif defined(O_DIRECT)
+        int file = ::open(path, O_RDONLY | O_CLOEXEC | O_DIRECT);
+        if (file >= 0)
+        {
+            direct = true;
+            return file;
+        }
+#elif defined(__APPLE__)
+        int file = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (file >= 0 && ::fcntl(file, F_NOCACHE, 1) == 0)
+        {
+            direct = true;
+        }
+        return file;
+#endif
+        // e.g. tmpfs and some network filesystems refuse O_DIRECT with EINVAL
+        return openNativeFile(path);
+    }
+
+    /**
+     * Used after buffered fallback reads of streamed data so it doesn't stay in the page cache on top of our own copy
+     */
+    static void dropNativeFileCache(NativeFile file, uint64_t offset, size_t size)
+    {
+#if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+        ::posix_fadvise(file, static_cast<off_t>(offset), static_cast<off_t>(size), POSIX_FADV_DONTNEED);
+#else
+        // no per range equivalent on Windows, the cache manager trims it
+        (void)file; (void)offset; (void)size;
+#endif
+    }
+
+    /**
+     * @param file handle from openNativeFile
+     * @return size of the file in bytes, nullopt if it couldn't be queried
+     */
+    static std::optional<uint64_t> nativeFileSize(NativeFile file)
+    {
+#ifdef _WIN32
+        LARGE_INTEGER size = {};
+        if (!GetFileSizeEx(file, &size)) return std::nullopt;
+        return static_cast<uint64_t>(size.QuadPart);
+#else
+        struct stat info = {};
+        if (::fstat(file, &info) != 0) return std::nullopt;
+        return static_cast<uint64_t>(info.st_size);
+#endif
+    }
+
+    static void closeNativeFile(NativeFile file)
+    {
+        if (!isValidNativeFile(file)) return;
+#ifdef _WIN32
+        CloseHandle(file);
+#else
+        ::close(file);
+#endif
+    }
+
+    /**
+     * Reads at an absolute offset without touching a shared file position (pread / ReadFile with an OVERLAPPED offset),
+     * so multiple threads can read from the same handle at once
+     * @param file handle from openNativeFile
+     * @param offset absolute offset into the file
+     * @param destination where to write
+     * @param size amount of bytes wanted
+     * @param bytes_read amount of bytes actually read, less than size at end of file
+     * @param direct file was opened with openNativeFileDirect-- a short read is the end of file, reading on from the
+     * unaligned offset it leaves would be refused
+     * @return false on an I/O error
+     */
+    static bool readNativeFileAt(NativeFile file, uint64_t offset, void* destination, size_t size, size_t& bytes_read,
+                                 bool direct = false)
+    {
+        bytes_read = 0;
+        uint8_t* out = static_cast<uint8_t*>(destination);
+        while (bytes_read < size)
+        {
+            uint64_t position = offset + bytes_read;
+#ifdef _WIN32
+            OVERLAPPED overlapped = {};
+            overlapped.Offset = static_cast<DWORD>(position & 0xFFFFFFFFull);
+            overlapped.OffsetHigh = static_cast<DWORD>(position >> 32);
+            DWORD chunk = static_cast<DWORD>(std::min<size_t>(size - bytes_read, 1u << 30));
+            DWORD read = 0;
+            if (!ReadFile(file, out + bytes_read, chunk, &read, &overlapped))
+            {
+                if (GetLastError() == ERROR_HANDLE_EOF) return true;
+                return false;
+            }
+#else
+            ssize_t read = ::pread(file, out + bytes_read, size - bytes_read, static_cast<off_t>(position));
+            if (read < 0)
+            {
+                if (errno == EINTR) continue;
+                return false;
+            }
+#endif
+            if (read == 0) return true;
+            bytes_read += static_cast<size_t>(read);
+#ifdef _WIN32
+            if (direct && read < chunk) return true;
+#else
+            if (direct && bytes_read < size) return true;
+#endif
+        }
+        return true;
+    }
+
+    export constexpr size_t DIRECT_IO_ALIGNMENT = 4096;
+
+    /**
+     * Fixed pool of DIRECT_IO_ALIGNMENT aligned, pinned staging buffers for direct I/O streaming. \n
+     * The pool is allocated once so streaming never grows RSS-- when it is empty, streaming reads wait for a buffer
+     * to be released
+     */
+    export class StagingBufferPool
+    {
+    public:
+        StagingBufferPool(uint32_t buffer_count, size_t buffer_size)
+            :m_buffer_size((buffer_size + DIRECT_IO_ALIGNMENT - 1) & ~(DIRECT_IO_ALIGNMENT - 1)),
+            m_buffer_count(buffer_count),
+            m_total_size(m_buffer_size * buffer_count)
+        {
+            m_memory = static_cast<uint8_t*>(::operator new(m_total_size, std::align_val_t{DIRECT_IO_ALIGNMENT}));
+#ifdef _WIN32
+            m_pinned = VirtualLock(m_memory, m_total_size) != 0;
+#else
+            m_pinned = ::mlock(m_memory, m_total_size) == 0;
+#endif
+            if (!m_pinned)
+            {
+                // still usable, just pageable-- usually RLIMIT_MEMLOCK or the working set limit
+                std::cerr << "StagingBufferPool: failed to pin " << m_total_size << " bytes, using pageable memory\n";
+            }
+
+            m_free.reserve(buffer_count);
+            for (uint32_t i = buffer_count; i > 0; --i)
+            {
+                m_free.push_back(i - 1);
+            }
+        }
+
+        ~StagingBufferPool()
+        {
+            if (m_pinned)
+            {
+#ifdef _WIN32
+                VirtualUnlock(m_memory, m_total_size);
+#else
+                ::munlock(m_memory, m_total_size);
+#endif
+            }
+            ::operator delete(m_memory, std::align_val_t{DIRECT_IO_ALIGNMENT});
+        }
+
+        StagingBufferPool(const StagingBufferPool&) = delete;
+        StagingBufferPool& operator=(const StagingBufferPool&) = delete;
+
+        /**
+         * Blocks until a buffer is free
+         * @return index of the buffer
+         */
+        uint32_t acquire()
+        {
+            std::unique_lock lock(m_mutex);
+            m_released.wait(lock, [this] { return !m_free.empty(); });
+            uint32_t index = m_free.back();
+            m_free.pop_back();
+            return index;
+        }
+
+        void release(uint32_t index)
+        {
+            {
+                std::lock_guard lock(m_mutex);
+                m_free.push_back(index);
+            }
+            m_released.notify_one();
+        }
+
+        uint8_t* data(uint32_t index) const { return m_memory + static_cast<size_t>(index) * m_buffer_size; }
+        size_t bufferSize() const { return m_buffer_size; }
+        uint32_t bufferCount() const { return m_buffer_count; }
+        bool isPinned() const { return m_pinned; }
+
+    private:
+        uint8_t* m_memory = nullptr;
+        size_t m_buffer_size;
+        uint32_t m_buffer_count;
+        size_t m_total_size;
+        bool m_pinned = false;
+        std::mutex m_mutex;
+        std::condition_variable m_released;
+        std::vector<uint32_t> m_free;
+    };
+
+    /**
+     * Optional scheduling info for a request
+     */
+    export struct AsyncReadDeadline
+    {
+        // when the data is needed by. Left empty the priority's default budget is used
+        std::chrono::steady_clock::time_point time = {};
+        // drop the request instead of reading it late, e.g. streaming for something that left the view frustum
+        bool drop_if_late = false;
+    };
+
+    /**
+     * Log2 bucketed histogram, safe to record into from any thread. \n
+     * Bucket 0 holds 0, bucket i holds values in [2^(i-1), 2^i)
+     */
+    export class LoadHistogram
+    {
+    public:
+        static constexpr size_t BUCKETS = 40;
+
+        struct Snapshot
+        {
+            std::array<uint64_t, BUCKETS> buckets = {};
+            uint64_t count = 0;
+            uint64_t sum = 0;
+            uint64_t max = 0;
+
+            double mean() const
+            {
+                return count ? static_cast<double>(sum) / static_cast<double>(count) : 0.0;
+            }
+
+            /**
+             * @param p percentile in [0, 1]
+             * @return upper bound of the bucket holding the p-th value
+             */
+            uint64_t percentile(double p) const
+            {
+                if (count == 0) return 0;
+                uint64_t target = static_cast<uint64_t>(std::ceil(p * static_cast<double>(count)));
+                uint64_t seen = 0;
+                for (size_t i = 0; i < BUCKETS; ++i)
+                {
+                    seen += buckets[i];
+                    if (seen >= target && seen > 0) return std::min(max, i == 0 ? 0 : (uint64_t{1} << i) - 1);
+                }
+                return max;
+            }
+        };
+
+        void record(uint64_t value)
+        {
+            size_t bucket = std::min<size_t>(std::bit_width(value), BUCKETS - 1);
+            m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+            m_count.fetch_add(1, std::memory_order_relaxed);
+            m_sum.fetch_add(value, std::memory_order_relaxed);
+            uint64_t previous = m_max.load(std::memory_order_relaxed);
+            while (previous < value && !m_max.compare_exchange_weak(previous, value, std::memory_order_relaxed)) {}
+        }
+
+        Snapshot snapshot() const
+        {
+            Snapshot result;
+            for (size_t i = 0; i < BUCKETS; ++i)
+            {
+                result.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+            }
+            result.count = m_count.load(std::memory_order_relaxed);
+            result.sum = m_sum.load(std::memory_order_relaxed);
+            result.max = m_max.load(std::memory_order_relaxed);
+            return result;
+        }
+
+        void reset()
+        {
+            for (auto& bucket : m_buckets)
+            {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+            m_count.store(0, std::memory_order_relaxed);
+            m_sum.store(0, std::memory_order_relaxed);
+            m_max.store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        std::array<std::atomic<uint64_t>, BUCKETS> m_buckets = {};
+        std::atomic<uint64_t> m_count = 0;
+        std::atomic<uint64_t> m_sum = 0;
+        std::atomic<uint64_t> m_max = 0;
+    };
+
+    /**
+     * Load time telemetry for one priority class, see FileLoaderSystem::getLoadStats
+     */
+    export struct AsyncLoadStats
+    {
+        // microseconds from submit until a worker picked the read up
+        LoadHistogram::Snapshot queue_wait_us;
+        // microseconds from pick up until the data was in the buffer, decompression included
+        LoadHistogram::Snapshot read_time_us;
+        // per read throughput in KiB/s
+        LoadHistogram::Snapshot throughput_kib_per_s;
+        uint64_t bytes_read = 0;
+        uint64_t succeeded = 0;
+        uint64_t failed = 0;
+        uint64_t cancelled = 0;
+    };
+
+    export struct AsyncRequestHandle;
+
+    /**
+     * Run on the thread that completes the request, before its counter is decremented-- keep it short, e.g. submit
+     * the job that consumes the data
+     */
+    export using AsyncContinuation = std::function<void(const AsyncRequestHandle&)>;
+
     export struct AsyncRequestHandle
     {
+        // unique per request, used to cancel
+        uint64_t request_id;
+        // nullptr when reading an entry out of the mounted archive
         const char * path;
+        AssetId asset_id;
+        // TOC entry inside the mounted archive
+        const ArchiveTocSlot* archive_entry;
         AsyncFileHandle handle;
         AsyncFileBuffer buffer;
         size_t buffer_size;
         size_t actual_size;
+        // streaming (direct I/O) requests only: byte offset into the file/entry, and the pool buffer holding the data
+        bool direct;
+        uint64_t read_offset;
+        int32_t staging_buffer;
         AsyncFilePriority priority;
+        std::chrono::steady_clock::time_point deadline;
+        bool drop_if_late;
+        std::chrono::steady_clock::time_point submit_time;
         void (*callback) (AsyncRequestHandle);
+        // shared so copies of the handle (coalesced waiters, deferred callbacks) don't copy the captures
+        std::shared_ptr<AsyncContinuation> continuation;
         Atomics::Counter dependent_on;
         std::shared_ptr<std::atomic<AsyncFileResult>> result;
     };
@@ -51,7 +449,7 @@ namespace AngelBase::Core
     public:
         
         FileLoaderSystem()
-            :workers(8), criticalRequests(100), highRequests(100), normalRequests(100), lowRequests(100)
+            :workers(8)
             
         {
 
@@ -63,7 +461,11 @@ namespace AngelBase::Core
         
         ~FileLoaderSystem()
         {
-            _shutdown.store(true, std::memory_order_release);
+            {
+                std::lock_guard lock(request_mutex);
+                _shutdown.store(true, std::memory_order_release);
+            }
+            request_available.notify_all();
             for (auto& worker :workers)
             {
                 if (worker.joinable())
@@ -71,6 +473,125 @@ namespace AngelBase::Core
                     worker.join();
                 }
             }
+            // reads the workers never got to still have waiters blocked on their counters
+            cancelQueuedReads();
+            // chunk jobs still reference the staging buffers and the request table
+            JobSystem::WaitForCounter(decompression_jobs);
+            closeNativeFile(archive_file);
+            closeNativeFile(archive_direct_file);
+        }
+
+        /**
+         * Creates the staging pool used by the streaming (direct I/O) requests. Call once before streaming
+         * @param buffer_count amount of buffers, the most streaming data that can be in flight or awaiting upload
+         * @param buffer_size size of each buffer, rounded up to DIRECT_IO_ALIGNMENT
+         */
+        void initializeDirectIO(uint32_t buffer_count, size_t buffer_size)
+        {
+            staging_pool = std::make_unique<StagingBufferPool>(buffer_count, buffer_size);
+        }
+
+        /**
+         * Largest size a single streaming request can ask for, worst case alignment included
+         */
+        size_t maxStreamSize() const
+        {
+            return staging_pool ? staging_pool->bufferSize() - DIRECT_IO_ALIGNMENT : 0;
+        }
+
+        /**
+         * Mounts a packed asset archive built by the AssetPacker. The archive is opened once and every entry is read
+         * with offset reads on that handle. Call before issuing asyncReadEntry requests-- not thread safe with them
+         * @param path path to the .pak file
+         * @return false if the archive couldn't be opened or is invalid
+         */
+        bool mountArchive(const char* path)
+        {
+            NativeFile file = openNativeFile(path);
+            if (!isValidNativeFile(file))
+            {
+                std::cerr << "mountArchive failed to open: " << path << "\n";
+                return false;
+            }
+
+            ArchiveHeader header = {};
+            size_t bytes_read = 0;
+            if (!readNativeFileAt(file, 0, &header, sizeof(header), bytes_read) || bytes_read != sizeof(header))
+            {
+                std::cerr << "mountArchive failed to read header: " << path << "\n";
+                closeNativeFile(file);
+                return false;
+            }
+
+            // everything the TOC allocation and read depend on is checked first, a corrupt or truncated archive
+            // must not ask for an arbitrary amount of memory
+            const std::optional<uint64_t> file_size = nativeFileSize(file);
+            const uint64_t slot_count = header.toc_slot_count;
+            const bool valid_header = header.magic == ARCHIVE_MAGIC && header.version == ARCHIVE_VERSION &&
+                                      slot_count != 0 && (slot_count & (slot_count - 1)) == 0 &&
+                                      slot_count <= ARCHIVE_MAX_TOC_SLOTS && file_size &&
+                                      header.toc_offset <= *file_size &&
+                                      slot_count * sizeof(ArchiveTocSlot) <= *file_size - header.toc_offset;
+            if (!valid_header)
+            {
+                std::cerr << "mountArchive: bad header, unsupported version or truncated TOC: " << path << "\n";
+                closeNativeFile(file);
+                return false;
+            }
+
+            std::vector<ArchiveTocSlot> slots(static_cast<size_t>(slot_count));
+            size_t toc_bytes = slots.size() * sizeof(ArchiveTocSlot);
+            if (!readNativeFileAt(file, header.toc_offset, slots.data(), toc_bytes, bytes_read) || bytes_read != toc_bytes)
+            {
+                std::cerr << "mountArchive failed to read TOC: " << path << "\n";
+                closeNativeFile(file);
+                return false;
+            }
+
+            if (!archive_toc.initialize(header, std::move(slots)))
+            {
+                closeNativeFile(file);
+                return false;
+            }
+
+            closeNativeFile(archive_file);
+            archive_file = file;
+
+            // second handle for streaming entries past the page cache-- entries are aligned to ARCHIVE_ALIGNMENT for this
+            closeNativeFile(archive_direct_file);
+            archive_direct_file = openNativeFileDirect(path, archive_is_direct);
+            return true;
+        }
+
+        /**
+         * Asynchronous load of an entry in the mounted archive -- public Facing API
+         * @param id id of the asset, from makeAssetId
+         * @param buffer buffer to store results
+         * @param buffer_size max buffer size you want to allow
+         * @param priority priority of this load request
+         * @param c Counter that async file request is dependent on
+         * @param callback function to call when it's done
+         * @param deadline when the data is needed by, see AsyncReadDeadline
+         * @return 
+         */
+        [[nodiscard]] AsyncRequestHandle asyncReadEntry(AssetId id, AsyncFileBuffer buffer, size_t buffer_size, AsyncFilePriority priority, Atomics::Counter& c, void(*callback)(AsyncRequestHandle), const AsyncReadDeadline& deadline = {})
+        {
+            c.increment();
+
+            AsyncRequestHandle request = makeRequest(buffer, buffer_size, priority, c, callback, deadline);
+            request.path = nullptr;
+            request.asset_id = id;
+            request.archive_entry = archive_toc.find(id);
+            if (!request.archive_entry)
+            {
+                std::cerr << "asyncReadEntry: asset " << id << " is not in the mounted archive\n";
+                AsyncRequestHandle failed = request;
+                finishRequest(failed, AsyncFileResult::Failed);
+                return request;
+            }
+
+            submit(request);
+            return request;
         }
         
         /**
@@ -81,49 +602,244 @@ namespace AngelBase::Core
          * @param priority priority of this load request
          * @param c Counter that async file request is dependent on
          * @param callback function to call when it's done
+         * @param deadline when the data is needed by, see AsyncReadDeadline
          * @return 
          */
-        [[nodiscard]] AsyncRequestHandle asyncReadFile(const char * path, AsyncFileBuffer buffer, size_t buffer_size, AsyncFilePriority priority, Atomics::Counter& c,void(*callback)(AsyncRequestHandle))
+        [[nodiscard]] AsyncRequestHandle asyncReadFile(const char * path, AsyncFileBuffer buffer, size_t buffer_size, AsyncFilePriority priority, Atomics::Counter& c,void(*callback)(AsyncRequestHandle), const AsyncReadDeadline& deadline = {})
         {
             c.increment();
             
-            AsyncRequestHandle request;
+            AsyncRequestHandle request = makeRequest(buffer, buffer_size, priority, c, callback, deadline);
             request.path = path;
-            request.handle = nullptr;
-            request.buffer = buffer;
-            request.buffer_size = buffer_size;
-            request.actual_size = 0;
-            request.priority = priority;
-            request.dependent_on = c;
-            request.result = std::make_shared<std::atomic<AsyncFileResult>>(AsyncFileResult::Pending);
-            request.callback = callback;
+            request.asset_id = makeAssetId(path);
+            request.archive_entry = nullptr;
             
-            switch (priority)
+            submit(request);
+            return request;
+        }
+
+        /**
+         * asyncReadFile with a continuation instead of a callback, for handing the data straight to a job. Named apart
+         * so a null callback still picks asyncReadFile \n
+         * The continuation runs for every result-- check handle.result before touching the buffer
+         * @param path path to file, must stay valid until the request completes
+         * @param buffer buffer to store results
+         * @param buffer_size max buffer size you want to allow
+         * @param priority priority of this load request
+         * @param c Counter that async file request is dependent on
+         * @param continuation run as soon as the request completes, never deferred
+         * @param deadline when the data is needed by, see AsyncReadDeadline
+         * @return 
+         */
+        [[nodiscard]] AsyncRequestHandle asyncReadFileThen(const char * path, AsyncFileBuffer buffer, size_t buffer_size, AsyncFilePriority priority, Atomics::Counter& c, AsyncContinuation continuation, const AsyncReadDeadline& deadline = {})
+        {
+            c.increment();
+
+            AsyncRequestHandle request = makeRequest(buffer, buffer_size, priority, c, nullptr, deadline);
+            request.path = path;
+            request.asset_id = makeAssetId(path);
+            request.archive_entry = nullptr;
+            request.continuation = std::make_shared<AsyncContinuation>(std::move(continuation));
+
+            submit(request);
+            return request;
+        }
+
+        /**
+         * Streams a byte range of a file with direct I/O, bypassing the page cache so it isn't doubled on top of our
+         * own caches. Needs initializeDirectIO. \n
+         * On Success handle.buffer points into a pinned staging buffer that you own until releaseStagingBuffer--
+         * release it as soon as the data is uploaded. Failed and cancelled requests release it themselves. \n
+         * If the filesystem refuses direct I/O it falls back to a buffered read and drops the range from the page cache
+         * @param path path to file
+         * @param offset byte offset to start at, any alignment
+         * @param size amount of bytes, at most maxStreamSize()
+         * @param priority priority of this load request
+         * @param c Counter that async file request is dependent on
+         * @param callback function to call when it's done
+         * @param deadline when the data is needed by, see AsyncReadDeadline
+         * @return 
+         */
+        [[nodiscard]] AsyncRequestHandle asyncStreamFile(const char* path, uint64_t offset, size_t size, AsyncFilePriority priority, Atomics::Counter& c, void(*callback)(AsyncRequestHandle), const AsyncReadDeadline& deadline = {})
+        {
+            c.increment();
+
+            AsyncRequestHandle request = makeRequest(nullptr, size, priority, c, callback, deadline);
+            request.path = path;
+            request.asset_id = makeAssetId(path);
+            request.archive_entry = nullptr;
+            request.direct = true;
+            request.read_offset = offset;
+            return submitStream(request);
+        }
+
+        /**
+         * Same as asyncStreamFile, for a byte range of an uncompressed entry in the mounted archive
+         * @param id id of the asset, from makeAssetId
+         * @param offset byte offset into the entry
+         * @param size amount of bytes, at most maxStreamSize()
+         * @param priority priority of this load request
+         * @param c Counter that async file request is dependent on
+         * @param callback function to call when it's done
+         * @param deadline when the data is needed by, see AsyncReadDeadline
+         * @return 
+         */
+        [[nodiscard]] AsyncRequestHandle asyncStreamEntry(AssetId id, uint64_t offset, size_t size, AsyncFilePriority priority, Atomics::Counter& c, void(*callback)(AsyncRequestHandle), const AsyncReadDeadline& deadline = {})
+        {
+            c.increment();
+
+            AsyncRequestHandle request = makeRequest(nullptr, size, priority, c, callback, deadline);
+            request.path = nullptr;
+            request.asset_id = id;
+            request.archive_entry = archive_toc.find(id);
+            request.direct = true;
+            request.read_offset = offset;
+            if (request.archive_entry && request.archive_entry->compression != ArchiveCompression::None)
             {
-            case AsyncFilePriority::Critical:
-                criticalRequests.push(request);
-                break;
-            case AsyncFilePriority::High:
-                highRequests.push(request);
-                break;
-            case AsyncFilePriority::Normal:
-                normalRequests.push(request);
-                break;
-            case AsyncFilePriority::Low:
-                lowRequests.push(request);
-                break;
+                std::cerr << "asyncStreamEntry: asset " << id << " is compressed, use asyncReadEntry\n";
+                AsyncRequestHandle failed = request;
+                finishRequest(failed, AsyncFileResult::Failed);
+                return request;
             }
-            return request;
+            // past the end of the entry is the next entry's data
+            if (request.archive_entry && (offset > request.archive_entry->size || size > request.archive_entry->size - offset))
+            {
+                std::cerr << "asyncStreamEntry: range runs past the end of asset " << id << "\n";
+                AsyncRequestHandle failed = request;
+                finishRequest(failed, AsyncFileResult::Failed);
+                return request;
+            }
+            return submitStream(request);
+        }
+
+        /**
+         * Gives a streaming request's staging buffer back to the pool
+         * @param handle handle passed to the callback of a successful asyncStreamFile/asyncStreamEntry
+         */
+        void releaseStagingBuffer(const AsyncRequestHandle& handle)
+        {
+            if (staging_pool && handle.staging_buffer >= 0)
+            {
+                staging_pool->release(static_cast<uint32_t>(handle.staging_buffer));
+            }
+        }
+
+        /**
+         * Cancels a request that hasn't started reading yet. The callback is invoked with AsyncFileResult::Cancelled. \n
+         * Requests coalesced with others only detach themselves, the read still happens for the rest
+         * @param handle handle returned by asyncReadFile/asyncReadEntry
+         * @return false if the read already started (or finished)-- the buffer will still be written, wait for it
+         */
+        bool asyncCancel(const AsyncRequestHandle& handle)
+        {
+            AsyncRequestHandle cancelled;
+            {
+                std::lock_guard lock(request_mutex);
+                auto owner = request_owners.find(handle.request_id);
+                if (owner == request_owners.end()) return false;
+
+                std::shared_ptr<PendingRead> read = owner->second;
+                if (read->dispatched) return false;
+
+                auto waiter = std::ranges::find(read->waiters, handle.request_id, &AsyncRequestHandle::request_id);
+                cancelled = std::move(*waiter);
+                read->waiters.erase(waiter);
+                request_owners.erase(owner);
+
+                if (read->waiters.empty())
+                {
+                    // stale heap entries are skipped once dispatched is set
+                    read->dispatched = true;
+                    --queued_reads;
+                    unregisterRead(read);
+                }
+            }
+            finishRequest(cancelled, AsyncFileResult::Cancelled);
+            return true;
         }
         
         /**
-         * fence function to wait for the load request to finish
+         * fence function to wait for the load request to finish. \n
+         * Every request decrements its counter exactly once, whether it succeeded, failed or was cancelled
          * @param handle 
          */
         static void asyncWaitComplete(const AsyncRequestHandle& handle)
         {
             handle.dependent_on.wait_for_zero();
         }
+
+        /**
+         * Callbacks run on the I/O worker that finished the request by default. Once deferred, they are queued and
+         * run by whichever thread calls drainCompletedCallbacks (e.g. the main thread once a frame). \n
+         * Results and counters are still updated as soon as the data is ready, so waiting on the counter doesn't
+         * wait for the callback
+         * @param deferred true to queue callbacks
+         */
+        void setDeferredCallbacks(bool deferred)
+        {
+            deferred_callbacks.store(deferred, std::memory_order_release);
+        }
+
+        /**
+         * Runs queued completion callbacks on the calling thread
+         * @param max_callbacks stop after this many, the rest stay queued
+         * @return amount of callbacks run
+         */
+        size_t drainCompletedCallbacks(size_t max_callbacks = std::numeric_limits<size_t>::max())
+        {
+            std::vector<AsyncRequestHandle> ready;
+            {
+                std::lock_guard lock(completion_mutex);
+                if (completed_callbacks.size() <= max_callbacks)
+                {
+                    ready.swap(completed_callbacks);
+                }
+                else
+                {
+                    auto split = completed_callbacks.begin() + static_cast<std::ptrdiff_t>(max_callbacks);
+                    ready.assign(std::make_move_iterator(completed_callbacks.begin()), std::make_move_iterator(split));
+                    completed_callbacks.erase(completed_callbacks.begin(), split);
+                }
+            }
+            for (auto& handle : ready)
+            {
+                handle.callback(handle);
+            }
+            return ready.size();
+        }
+
+        /**
+         * Snapshot of the load time telemetry for a priority class, for the load time dashboards
+         * @param priority class to query
+         * @return histograms and totals since startup or the last resetLoadStats
+         */
+        AsyncLoadStats getLoadStats(AsyncFilePriority priority) const
+        {
+            const PriorityTelemetry& telemetry = load_telemetry[static_cast<size_t>(priority)];
+            AsyncLoadStats stats;
+            stats.queue_wait_us = telemetry.queue_wait_us.snapshot();
+            stats.read_time_us = telemetry.read_time_us.snapshot();
+            stats.throughput_kib_per_s = telemetry.throughput_kib_per_s.snapshot();
+            stats.bytes_read = telemetry.bytes_read.load(std::memory_order_relaxed);
+            stats.succeeded = telemetry.succeeded.load(std::memory_order_relaxed);
+            stats.failed = telemetry.failed.load(std::memory_order_relaxed);
+            stats.cancelled = telemetry.cancelled.load(std::memory_order_relaxed);
+            return stats;
+        }
+
+        void resetLoadStats()
+        {
+            for (auto& telemetry : load_telemetry)
+            {
+                telemetry.queue_wait_us.reset();
+                telemetry.read_time_us.reset();
+                telemetry.throughput_kib_per_s.reset();
+                telemetry.bytes_read.store(0, std::memory_order_relaxed);
+                telemetry.succeeded.store(0, std::memory_order_relaxed);
+                telemetry.failed.store(0, std::memory_order_relaxed);
+                telemetry.cancelled.store(0, std::memory_order_relaxed);
+            }
+        }
         
     protected:
         
@@ -132,73 +848,660 @@ namespace AngelBase::Core
         /**
          * Used to attempt to open the file for reading
          * @param path_name name of the path to open
-         * @return Returns a FILE* as a AsyncFileHandle, or nullptr if it fails. Check!
+         * @return handle for positional reads, check with isValidNativeFile!
          */
-        static [[nodiscard]] AsyncFileHandle asyncOpen(const char * path_name)
+        [[nodiscard]] static NativeFile asyncOpen(const char * path_name)
         {
-            AsyncFileHandle handle = nullptr;
-            errno_t error = fopen_s(&handle, path_name, "rb"); 
-            if (error != 0)
+            NativeFile file = openNativeFile(path_name);
+            if (!isValidNativeFile(file))
             {
-                char buffer[512];
-                strerror_s(buffer, error);
-                std::cerr << "asyncOpen failed: " << buffer << "\n";
+#ifdef _WIN32
+                std::cerr << "asyncOpen failed: " << path_name << " (error " << GetLastError() << ")\n";
+#else
+                std::cerr << "asyncOpen failed: " << path_name << ": " << std::strerror(errno) << "\n";
+#endif
             }
-            return handle;
+            return file;
         }
         
     private:
+
+        /**
+         * One read from disk. Every request for the same file while it is queued or being read is coalesced into
+         * waiters, the data is read once into the largest buffer and copied to the rest
+         */
+        struct PendingRead
+        {
+            // what to read, fixed at creation
+            AssetId key;
+            const char* path;
+            const ArchiveTocSlot* archive_entry;
+
+            std::vector<AsyncRequestHandle> waiters;
+            // highest priority and earliest deadline of all waiters
+            AsyncFilePriority priority;
+            std::chrono::steady_clock::time_point deadline;
+            // only dropped when late if every waiter allows it
+            bool drop_if_late;
+            // streaming read into the staging pool, never coalesced
+            bool direct = false;
+            // popped by a worker (or cancelled)-- no more cancelling, its heap entries are stale
+            bool dispatched = false;
+            // set by the worker, the buffer the data is read into
+            AsyncFileBuffer destination = nullptr;
+            size_t destination_size = 0;
+            std::chrono::steady_clock::time_point dispatch_time;
+        };
+
+        struct PriorityTelemetry
+        {
+            LoadHistogram queue_wait_us;
+            LoadHistogram read_time_us;
+            LoadHistogram throughput_kib_per_s;
+            std::atomic<uint64_t> bytes_read = 0;
+            std::atomic<uint64_t> succeeded = 0;
+            std::atomic<uint64_t> failed = 0;
+            std::atomic<uint64_t> cancelled = 0;
+        };
+
+        // heap entry, the same read can be pushed again when a waiter raises its priority or pulls in its deadline
+        struct ScheduledRead
+        {
+            std::chrono::steady_clock::time_point deadline;
+            uint64_t sequence;
+            std::shared_ptr<PendingRead> read;
+
+            // std heaps are max heaps, so "less" means later deadline
+            bool operator<(const ScheduledRead& rhs) const
+            {
+                if (deadline != rhs.deadline) return deadline > rhs.deadline;
+                return sequence > rhs.sequence;
+            }
+        };
+
+        static constexpr size_t PRIORITY_CLASSES = 4;
+
+        // how long each class may wait by default before it is considered overdue and starts overtaking higher classes
+        static constexpr std::array<std::chrono::milliseconds, PRIORITY_CLASSES> DEFAULT_DEADLINE_BUDGET = {
+            std::chrono::milliseconds(0),
+            std::chrono::milliseconds(16),
+            std::chrono::milliseconds(100),
+            std::chrono::milliseconds(1000)
+        };
+
+        AsyncRequestHandle makeRequest(AsyncFileBuffer buffer, size_t buffer_size, AsyncFilePriority priority, Atomics::Counter& c,
+                                       void(*callback)(AsyncRequestHandle), const AsyncReadDeadline& deadline)
+        {
+            AsyncRequestHandle request;
+            request.request_id = next_request_id.fetch_add(1, std::memory_order_relaxed);
+            request.handle = nullptr;
+            request.buffer = buffer;
+            request.buffer_size = buffer_size;
+            request.actual_size = 0;
+            request.direct = false;
+            request.read_offset = 0;
+            request.staging_buffer = -1;
+            request.priority = priority;
+            request.deadline = deadline.time != std::chrono::steady_clock::time_point{}
+                ? deadline.time
+                : std::chrono::steady_clock::now() + DEFAULT_DEADLINE_BUDGET[static_cast<size_t>(priority)];
+            request.drop_if_late = deadline.drop_if_late;
+            request.submit_time = std::chrono::steady_clock::now();
+            request.dependent_on = c;
+            request.result = std::make_shared<std::atomic<AsyncFileResult>>(AsyncFileResult::Pending);
+            request.callback = callback;
+            return request;
+        }
+
+        static bool isSameSource(const PendingRead& read, const AsyncRequestHandle& request)
+        {
+            if ((read.path == nullptr) != (request.path == nullptr)) return false;
+            return read.path == nullptr || std::strcmp(read.path, request.path) == 0;
+        }
+
+        /**
+         * Adds a request to the request table, coalescing it with an in flight read of the same file
+         * @param request request to schedule
+         */
+        void submit(const AsyncRequestHandle& request)
+        {
+            {
+                std::unique_lock lock(request_mutex);
+                if (_shutdown.load(std::memory_order_acquire))
+                {
+                    lock.unlock();
+                    AsyncRequestHandle cancelled = request;
+                    finishRequest(cancelled, AsyncFileResult::Cancelled);
+                    return;
+                }
+                // streaming reads are ranges into their own buffers, they are scheduled but never coalesced
+                auto existing = request.direct ? in_flight_reads.end() : in_flight_reads.find(request.asset_id);
+                // a read already under way can't grow its destination, a bigger buffer gets a read of its own
+                if (existing != in_flight_reads.end() && isSameSource(*existing->second, request) &&
+                    !(existing->second->dispatched && request.buffer_size > existing->second->destination_size))
+                {
+                    std::shared_ptr<PendingRead> read = existing->second;
+                    read->waiters.push_back(request);
+                    request_owners.emplace(request.request_id, read);
+                    if (read->dispatched)
+                    {
+                        load_telemetry[static_cast<size_t>(request.priority)].queue_wait_us.record(0);
+                        return;
+                    }
+
+                    read->drop_if_late = read->drop_if_late && request.drop_if_late;
+                    if (request.priority < read->priority || request.deadline < read->deadline)
+                    {
+                        read->priority = std::min(read->priority, request.priority);
+                        read->deadline = std::min(read->deadline, request.deadline);
+                        schedule(read);
+                    }
+                    return;
+                }
+
+                auto read = std::make_shared<PendingRead>();
+                read->key = request.asset_id;
+                read->path = request.path;
+                read->archive_entry = request.archive_entry;
+                read->direct = request.direct;
+                read->waiters.push_back(request);
+                read->priority = request.priority;
+                read->deadline = request.deadline;
+                read->drop_if_late = request.drop_if_late;
+                request_owners.emplace(request.request_id, read);
+                // a different file hashing to the same key just doesn't get coalesced
+                if (!request.direct && existing == in_flight_reads.end())
+                {
+                    in_flight_reads.emplace(request.asset_id, read);
+                }
+                ++queued_reads;
+                schedule(read);
+            }
+            request_available.notify_one();
+        }
+
+        AsyncRequestHandle submitStream(const AsyncRequestHandle& request)
+        {
+            const bool has_source = request.path || request.archive_entry;
+            if (!staging_pool || !has_source || request.buffer_size > maxStreamSize())
+            {
+                std::cerr << "asyncStream: no staging pool, unknown asset or size over maxStreamSize\n";
+                AsyncRequestHandle failed = request;
+                finishRequest(failed, AsyncFileResult::Failed);
+                return request;
+            }
+            submit(request);
+            return request;
+        }
+
+        // request_mutex must be held
+        void schedule(const std::shared_ptr<PendingRead>& read)
+        {
+            auto& heap = scheduled_reads[static_cast<size_t>(read->priority)];
+            heap.push_back({read->deadline, next_sequence++, read});
+            std::push_heap(heap.begin(), heap.end());
+        }
+
+        // request_mutex must be held
+        void unregisterRead(const std::shared_ptr<PendingRead>& read)
+        {
+            auto it = in_flight_reads.find(read->key);
+            if (it != in_flight_reads.end() && it->second == read)
+            {
+                in_flight_reads.erase(it);
+            }
+        }
+
+        /**
+         * Earliest deadline first within a priority class. Classes are served strictly in order, except that a
+         * read past its deadline overtakes everything that isn't more overdue, so Low can't starve. \n
+         * Late reads that allow it are dropped instead. request_mutex must be held
+         * @param dropped reads that were dropped, to be completed once the lock is released
+         * @return next read to perform, or nullptr if only stale entries were left
+         */
+        std::shared_ptr<PendingRead> popNextRead(std::vector<std::shared_ptr<PendingRead>>& dropped)
+        {
+            const auto now = std::chrono::steady_clock::now();
+            while (queued_reads > 0)
+            {
+                std::vector<ScheduledRead>* chosen = nullptr;
+                std::vector<ScheduledRead>* most_overdue = nullptr;
+                for (auto& heap : scheduled_reads)
+                {
+                    // throw away entries for reads that were cancelled or pushed again with a better slot
+                    while (!heap.empty() && heap.front().read->dispatched)
+                    {
+                        std::pop_heap(heap.begin(), heap.end());
+                        heap.pop_back();
+                    }
+                    if (heap.empty()) continue;
+                    if (!chosen) chosen = &heap;
+                    if (heap.front().deadline < now &&
+                        (!most_overdue || heap.front().deadline < most_overdue->front().deadline))
+                    {
+                        most_overdue = &heap;
+                    }
+                }
+                if (most_overdue) chosen = most_overdue;
+                if (!chosen) return nullptr;
+
+                std::pop_heap(chosen->begin(), chosen->end());
+                std::shared_ptr<PendingRead> read = std::move(chosen->back().read);
+                chosen->pop_back();
+
+                read->dispatched = true;
+                --queued_reads;
+                if (read->drop_if_late && read->deadline < now)
+                {
+                    unregisterRead(read);
+                    dropped.push_back(std::move(read));
+                    continue;
+                }
+
+                read->dispatch_time = now;
+                for (const auto& waiter : read->waiters)
+                {
+                    auto waited = std::chrono::duration_cast<std::chrono::microseconds>(now - waiter.submit_time);
+                    load_telemetry[static_cast<size_t>(waiter.priority)].queue_wait_us.record(
+                        static_cast<uint64_t>(std::max<int64_t>(waited.count(), 0)));
+                }
+                // read into the largest buffer, everyone else gets a copy
+                auto largest = std::ranges::max_element(read->waiters, {}, &AsyncRequestHandle::buffer_size);
+                read->destination = largest->buffer;
+                read->destination_size = largest->buffer_size;
+                return read;
+            }
+            return nullptr;
+        }
+
+        /**
+         * Completes every read that was never dispatched with AsyncFileResult::Cancelled, coalesced waiters included. \n
+         * Only called once the I/O workers have exited
+         */
+        void cancelQueuedReads()
+        {
+            std::vector<std::shared_ptr<PendingRead>> cancelled;
+            {
+                std::lock_guard lock(request_mutex);
+                for (auto& heap : scheduled_reads)
+                {
+                    for (auto& entry : heap)
+                    {
+                        // a read can sit in a heap more than once, and stale entries were already dispatched
+                        if (entry.read->dispatched) continue;
+                        entry.read->dispatched = true;
+                        --queued_reads;
+                        cancelled.push_back(std::move(entry.read));
+                    }
+                    heap.clear();
+                }
+            }
+            for (auto& read : cancelled)
+            {
+                completeRead(read, AsyncFileResult::Cancelled, 0);
+            }
+        }
+
+        /**
+         * Finishes a read: removes it from the request table and completes every waiter
+         * @param read the read that finished
+         * @param result Success, Failed or Cancelled
+         * @param actual_size bytes in read->destination
+         */
+        void completeRead(const std::shared_ptr<PendingRead>& read, AsyncFileResult result, size_t actual_size)
+        {
+            if (result != AsyncFileResult::Cancelled)
+            {
+                recordRead(*read, result, actual_size);
+            }
+
+            std::vector<AsyncRequestHandle> waiters;
+            {
+                std::lock_guard lock(request_mutex);
+                unregisterRead(read);
+                waiters = std::move(read->waiters);
+                read->waiters.clear();
+                for (const auto& waiter : waiters)
+                {
+                    request_owners.erase(waiter.request_id);
+                }
+            }
+
+            // every copy is made before anyone completes-- the destination belongs to one of the waiters, and it may
+            // be freed or reused as soon as that waiter's counter drops
+            if (result == AsyncFileResult::Success)
+            {
+                for (auto& waiter : waiters)
+                {
+                    waiter.actual_size = std::min(waiter.buffer_size, actual_size);
+                    if (waiter.buffer != read->destination)
+                    {
+                        std::memcpy(waiter.buffer, read->destination, waiter.actual_size);
+                    }
+                }
+            }
+            for (auto& waiter : waiters)
+            {
+                finishRequest(waiter, result);
+            }
+        }
+
+        void recordRead(const PendingRead& read, AsyncFileResult result, size_t actual_size)
+        {
+            PriorityTelemetry& telemetry = load_telemetry[static_cast<size_t>(read.priority)];
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - read.dispatch_time);
+            uint64_t elapsed_us = static_cast<uint64_t>(std::max<int64_t>(elapsed.count(), 0));
+            telemetry.read_time_us.record(elapsed_us);
+            if (result == AsyncFileResult::Success)
+            {
+                telemetry.bytes_read.fetch_add(actual_size, std::memory_order_relaxed);
+                // KiB/us * 1e6 = KiB/s
+                telemetry.throughput_kib_per_s.record(actual_size * 1000000ull / 1024ull / std::max<uint64_t>(elapsed_us, 1));
+            }
+        }
+
+        /**
+         * The one place a request completes: the result is stored, the callback is run (or queued), the continuation
+         * is run and the counter is decremented-- exactly once per request, whatever the result
+         * @param handle request to complete
+         * @param result Success, Failed or Cancelled
+         */
+        void finishRequest(AsyncRequestHandle& handle, AsyncFileResult result)
+        {
+            PriorityTelemetry& telemetry = load_telemetry[static_cast<size_t>(handle.priority)];
+            switch (result)
+            {
+            case AsyncFileResult::Success:
+                telemetry.succeeded.fetch_add(1, std::memory_order_relaxed);
+                break;
+            case AsyncFileResult::Cancelled:
+                telemetry.cancelled.fetch_add(1, std::memory_order_relaxed);
+                break;
+            default:
+                telemetry.failed.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+
+            handle.result.get()->store(result, std::memory_order_release);
+            if (handle.callback)
+            {
+                if (deferred_callbacks.load(std::memory_order_acquire))
+                {
+                    std::lock_guard lock(completion_mutex);
+                    completed_callbacks.push_back(handle);
+                }
+                else
+                {
+                    handle.callback(handle);
+                }
+            }
+            if (handle.continuation)
+            {
+                (*handle.continuation)(handle);
+            }
+            handle.dependent_on.decrement();
+        }
         
-        static void Load(AsyncRequestHandle&& handle)
+        void Load(const std::shared_ptr<PendingRead>& read)
         {
-            handle.dependent_on.increment();
-            handle.handle = asyncOpen(handle.path);
-            if (!handle.handle)
+            if (read->direct)
             {
-                handle.result.get()->store(AsyncFileResult::Failed);
-                handle.callback(handle);
+                LoadDirect(read);
                 return;
             }
-            handle.actual_size = fread_s(handle.buffer, handle.buffer_size, 1, handle.buffer_size, handle.handle);
-            if (ferror(handle.handle))
+            if (!read->path)
             {
-                handle.result.get()->store(AsyncFileResult::Failed);
-                handle.callback(handle);
-                fclose(handle.handle);
+                LoadArchiveEntry(read, *read->archive_entry);
                 return;
             }
-            handle.callback(handle);
-            fclose(handle.handle);
-            handle.result.get()->store(AsyncFileResult::Success);
-            handle.dependent_on.decrement();
+            NativeFile file = asyncOpen(read->path);
+            if (!isValidNativeFile(file))
+            {
+                completeRead(read, AsyncFileResult::Failed, 0);
+                return;
+            }
+            // short at end of file, the whole buffer otherwise
+            size_t actual_size = 0;
+            const bool ok = readNativeFileAt(file, 0, read->destination, read->destination_size, actual_size);
+            closeNativeFile(file);
+            completeRead(read, ok ? AsyncFileResult::Success : AsyncFileResult::Failed, ok ? actual_size : 0);
+        }
+
+        /**
+         * Reads an archive entry with a single offset read on the shared archive handle-- no open/close per asset. \n
+         * Compressed entries are read into a staging buffer and their chunks are decompressed on job system workers,
+         * so this I/O thread moves straight on to the next read
+         * @param read read to perform
+         * @param entry TOC entry of the asset
+         */
+        void LoadArchiveEntry(const std::shared_ptr<PendingRead>& read, const ArchiveTocSlot& entry)
+        {
+            if (entry.compression != ArchiveCompression::None)
+            {
+                LoadCompressedArchiveEntry(read, entry);
+                return;
+            }
+
+            size_t wanted = static_cast<size_t>(std::min<uint64_t>(read->destination_size, entry.size));
+            size_t actual_size = 0;
+            if (!readNativeFileAt(archive_file, entry.offset, read->destination, wanted, actual_size))
+            {
+                completeRead(read, AsyncFileResult::Failed, 0);
+                return;
+            }
+            completeRead(read, AsyncFileResult::Success, actual_size);
+        }
+
+        /**
+         * Streaming read into a staging buffer. The range is widened to DIRECT_IO_ALIGNMENT on both ends and the
+         * request's buffer points past the leading slack. Streaming reads have exactly one waiter and nothing else
+         * touches it once dispatched
+         * @param read read to perform
+         */
+        void LoadDirect(const std::shared_ptr<PendingRead>& read)
+        {
+            AsyncRequestHandle& request = read->waiters.front();
+            const uint64_t base = read->archive_entry ? read->archive_entry->offset : 0;
+            const uint64_t file_offset = base + request.read_offset;
+            const uint64_t aligned_offset = file_offset & ~static_cast<uint64_t>(DIRECT_IO_ALIGNMENT - 1);
+            const size_t slack = static_cast<size_t>(file_offset - aligned_offset);
+            const size_t aligned_size = (slack + request.buffer_size + DIRECT_IO_ALIGNMENT - 1) & ~(DIRECT_IO_ALIGNMENT - 1);
+
+            const uint32_t staging_index = staging_pool->acquire();
+            uint8_t* staging = staging_pool->data(staging_index);
+
+            bool direct = archive_is_direct;
+            NativeFile file = read->path ? openNativeFileDirect(read->path, direct) : archive_direct_file;
+            size_t bytes_read = 0;
+            bool ok = isValidNativeFile(file) && readNativeFileAt(file, aligned_offset, staging, aligned_size, bytes_read, direct);
+            if (!ok && direct && isValidNativeFile(file))
+            {
+                // some filesystems accept O_DIRECT at open and refuse it at read time, retry buffered
+                NativeFile buffered = read->path ? openNativeFile(read->path) : archive_file;
+                ok = isValidNativeFile(buffered) && readNativeFileAt(buffered, aligned_offset, staging, aligned_size, bytes_read);
+                if (ok) dropNativeFileCache(buffered, aligned_offset, aligned_size);
+                if (read->path) closeNativeFile(buffered);
+                direct = false;
+            }
+            else if (ok && !direct)
+            {
+                dropNativeFileCache(file, aligned_offset, aligned_size);
+            }
+            if (read->path) closeNativeFile(file);
+
+            if (!direct && !warned_direct_fallback.exchange(true))
+            {
+                std::cerr << "FileLoaderSystem: direct I/O refused by the filesystem, streaming falls back to buffered reads\n";
+            }
+
+            if (!ok)
+            {
+                staging_pool->release(staging_index);
+                completeRead(read, AsyncFileResult::Failed, 0);
+                return;
+            }
+
+            size_t available = bytes_read > slack ? bytes_read - slack : 0;
+            if (read->archive_entry)
+            {
+                // the aligned read runs on into whatever follows the entry in the archive
+                const uint64_t left_in_entry = read->archive_entry->size > request.read_offset
+                    ? read->archive_entry->size - request.read_offset : 0;
+                available = static_cast<size_t>(std::min<uint64_t>(available, left_in_entry));
+            }
+            request.buffer = staging + slack;
+            request.staging_buffer = static_cast<int32_t>(staging_index);
+            read->destination = request.buffer;
+            read->destination_size = request.buffer_size;
+            completeRead(read, AsyncFileResult::Success, std::min(available, request.buffer_size));
+        }
+
+        // shared by every chunk job of one compressed entry, the last chunk to finish completes the request
+        struct DecompressionState
+        {
+            std::shared_ptr<PendingRead> read;
+            const ArchiveTocSlot* entry;
+            std::vector<uint8_t> staging;
+            std::vector<uint64_t> chunk_offsets;
+            std::atomic<uint32_t> remaining_chunks;
+            std::atomic<bool> failed = false;
+        };
+
+        void LoadCompressedArchiveEntry(const std::shared_ptr<PendingRead>& read, const ArchiveTocSlot& entry)
+        {
+            if (read->destination_size < entry.uncompressed_size || entry.chunk_count == 0)
+            {
+                std::cerr << "LoadCompressedArchiveEntry: buffer too small for asset " << entry.id << "\n";
+                completeRead(read, AsyncFileResult::Failed, 0);
+                return;
+            }
+
+            auto state = std::make_shared<DecompressionState>();
+            state->read = read;
+            state->entry = &entry;
+            state->staging.resize(static_cast<size_t>(entry.size));
+            size_t bytes_read = 0;
+            if (!readNativeFileAt(archive_file, entry.offset, state->staging.data(), state->staging.size(), bytes_read) ||
+                bytes_read != state->staging.size())
+            {
+                completeRead(read, AsyncFileResult::Failed, 0);
+                return;
+            }
+
+            // prefix sum of the chunk table so every job knows where its chunk starts
+            const uint32_t* chunk_sizes = reinterpret_cast<const uint32_t*>(state->staging.data());
+            state->chunk_offsets.resize(entry.chunk_count + 1);
+            state->chunk_offsets[0] = entry.chunk_count * sizeof(uint32_t);
+            for (uint32_t i = 0; i < entry.chunk_count; ++i)
+            {
+                state->chunk_offsets[i + 1] = state->chunk_offsets[i] + (chunk_sizes[i] & ~ARCHIVE_CHUNK_STORED_RAW);
+            }
+            if (state->chunk_offsets.back() > state->staging.size())
+            {
+                std::cerr << "LoadCompressedArchiveEntry: corrupt chunk table for asset " << entry.id << "\n";
+                completeRead(read, AsyncFileResult::Failed, 0);
+                return;
+            }
+
+            state->remaining_chunks.store(entry.chunk_count, std::memory_order_relaxed);
+            for (uint32_t i = 0; i < entry.chunk_count; ++i)
+            {
+                JobSystem::SubmitJob(JobSystem::Job{"DecompressArchiveChunk", [this, state, i]()
+                {
+                    DecompressChunk(*state, i);
+                }}, decompression_jobs, JobSystem::Priority::High);
+            }
+        }
+
+        void DecompressChunk(DecompressionState& state, uint32_t chunk_index)
+        {
+            const ArchiveTocSlot& entry = *state.entry;
+            const uint32_t stored_size = reinterpret_cast<const uint32_t*>(state.staging.data())[chunk_index];
+            const uint64_t destination_offset = static_cast<uint64_t>(chunk_index) * ARCHIVE_CHUNK_SIZE;
+            const size_t destination_size = static_cast<size_t>(
+                std::min<uint64_t>(ARCHIVE_CHUNK_SIZE, entry.uncompressed_size - destination_offset));
+
+            const ArchiveCompression codec = (stored_size & ARCHIVE_CHUNK_STORED_RAW) ? ArchiveCompression::None : entry.compression;
+            const uint64_t source_offset = state.chunk_offsets[chunk_index];
+            const size_t source_size = static_cast<size_t>(state.chunk_offsets[chunk_index + 1] - source_offset);
+            if (!decompressChunk(codec, state.staging.data() + source_offset, source_size,
+                                 state.read->destination + destination_offset, destination_size))
+            {
+                state.failed.store(true, std::memory_order_relaxed);
+            }
+
+            if (state.remaining_chunks.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+            if (state.failed.load(std::memory_order_relaxed))
+            {
+                std::cerr << "DecompressChunk: corrupt data in asset " << entry.id << "\n";
+                completeRead(state.read, AsyncFileResult::Failed, 0);
+                return;
+            }
+            completeRead(state.read, AsyncFileResult::Success, static_cast<size_t>(entry.uncompressed_size));
         }
         
         
         void ProcessLoadRequests()
         {
-            while (!_shutdown)
+            std::vector<std::shared_ptr<PendingRead>> dropped;
+            while (true)
             {
-                AsyncRequestHandle req;
-                if (criticalRequests.try_pop(req) ||
-                    highRequests.try_pop(req)     ||
-                    normalRequests.try_pop(req)   ||
-                    lowRequests.try_pop(req))
+                std::shared_ptr<PendingRead> read;
                 {
-                    Load(std::move(req));
+                    std::unique_lock lock(request_mutex);
+                    request_available.wait(lock, [this]
+                    {
+                        return _shutdown.load(std::memory_order_acquire) || queued_reads > 0;
+                    });
+                    if (_shutdown.load(std::memory_order_acquire)) return;
+                    read = popNextRead(dropped);
                 }
-                else
+
+                for (auto& late : dropped)
                 {
-                    std::this_thread::yield();
+                    completeRead(late, AsyncFileResult::Cancelled, 0);
+                }
+                dropped.clear();
+
+                if (read)
+                {
+                    Load(read);
                 }
             }
         }
         
         std::vector<std::thread> workers;
         std::atomic<bool> _shutdown = false;
-        rigtorp::mpmc::Queue<AsyncRequestHandle> criticalRequests;
-        rigtorp::mpmc::Queue<AsyncRequestHandle> highRequests;
-        rigtorp::mpmc::Queue<AsyncRequestHandle> normalRequests;
-        rigtorp::mpmc::Queue<AsyncRequestHandle> lowRequests;
+
+        // request table-- everything below is guarded by request_mutex
+        std::mutex request_mutex;
+        std::condition_variable request_available;
+        // reads that are queued or being read, keyed by asset id (loose files hash their path), for coalescing
+        std::unordered_map<AssetId, std::shared_ptr<PendingRead>> in_flight_reads;
+        // request id -> read it is waiting on, for cancelling
+        std::unordered_map<uint64_t, std::shared_ptr<PendingRead>> request_owners;
+        std::array<std::vector<ScheduledRead>, PRIORITY_CLASSES> scheduled_reads;
+        size_t queued_reads = 0;
+        uint64_t next_sequence = 0;
+
+        std::atomic<uint64_t> next_request_id = 1;
+
+        std::atomic<bool> deferred_callbacks = false;
+        std::mutex completion_mutex;
+        std::vector<AsyncRequestHandle> completed_callbacks;
+        std::array<PriorityTelemetry, PRIORITY_CLASSES> load_telemetry;
+
+        Atomics::Counter decompression_jobs;
+        // mounted archive-- one handle shared by all workers
+        NativeFile archive_file = invalidNativeFile();
+        // same archive opened for direct I/O streaming
+        NativeFile archive_direct_file = invalidNativeFile();
+        bool archive_is_direct = false;
+        std::unique_ptr<StagingBufferPool> staging_pool;
+        std::atomic<bool> warned_direct_fallback = false;
+        ArchiveToc archive_toc;
         unsigned int coreId = 7;
     };
-}
\ No newline at end of file
+}
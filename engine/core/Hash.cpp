@@ -0,0 +1,64 @@
+module;
+#include <cstdint>
+#include <cstddef>
+export module Hash;
+
+import std;
+
+/**
+ * Small, stable hashing helpers. Everything here must produce the same value across runs and machines,
+ * since the results are written to disk (asset archive TOCs, shader caches).
+ */
+namespace AngelBase::Core::Hash
+{
+    constexpr uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+    constexpr uint64_t FNV_PRIME = 1099511628211ull;
+
+    /**
+     * 64 bit FNV-1a over a string. constexpr so asset ids can be baked at compile time
+     * @param data characters to hash
+     * @param seed previous hash value to continue from
+     * @return 64 bit hash
+     */
+    export constexpr uint64_t fnv1a64(std::string_view data, uint64_t seed = FNV_OFFSET_BASIS)
+    {
+        uint64_t hash = seed;
+        for (char c : data)
+        {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= FNV_PRIME;
+        }
+        return hash;
+    }
+
+    /**
+     * 64 bit FNV-1a over raw bytes
+     * @param data pointer to the bytes
+     * @param size amount of bytes
+     * @param seed previous hash value to continue from
+     * @return 64 bit hash
+     */
+    export uint64_t fnv1a64(const void* data, size_t size, uint64_t seed = FNV_OFFSET_BASIS)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        uint64_t hash = seed;
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= FNV_PRIME;
+        }
+        return hash;
+    }
+
+    /**
+     * Mixes value into seed, order dependent
+     * @param seed running hash
+     * @param value value to mix in
+     * @return new running hash
+     */
+    export constexpr uint64_t combine(uint64_t seed, uint64_t value)
+    {
+        seed ^= value + 0x9e3779b97f4a7c15ull + (seed << 12) + (seed >> 4);
+        return seed;
+    }
+}
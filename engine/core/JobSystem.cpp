@@ -1,8 +1,10 @@
 module;
-
+#include <cstdint>
+#include "MPMCQueue.h"
 export module JobSystem;
 
 import std;
+import Atomics;
 /**
  * Job system for submitting multithreaded tasks to be done
  */
@@ -11,7 +13,7 @@ namespace JobSystem
     /**
      * Priority of the jobs
      */
-    enum class Priority
+    export enum class Priority
     {
         Low,
         Normal,
@@ -22,7 +24,7 @@ namespace JobSystem
     // not able to be stored in stuff
     /**
      * Type used for submitting functions for the Job System to do \n
-     *  \b Usage: Job{"name", name, i, "sample_argument", &referenced_argument } 
+     *  \b Usage: Job{"name", name, i, "sample_argument", &referenced_argument }
      * @tparam Func type of the function submitted
      * @tparam Args variadic arguments-- use to submit as any arguments as the function takes
      */
@@ -37,7 +39,7 @@ namespace JobSystem
          * @param func function pointer to be enqueued
          * @param args variadic arguments-- submit as many arguments as the function takes-- will be MOVED
          */
-        Job(const char* name, Func&& func, Args&&... args) 
+        Job(const char* name, Func&& func, Args&&... args)
             :function_name(name),
             func_(std::forward<Func>(func))
             , v_args(std::forward<Args>(args)...) {}
@@ -64,13 +66,202 @@ namespace JobSystem
     /**
      * For the sake of easy compiler type deduction with Job submission
      * @tparam Func function pointer
-     * @tparam Args variadic arguments 
+     * @tparam Args variadic arguments
      * @param name name of the function
-     * @return 
+     * @return
      */
     template <typename Func, typename... Args>
     Job(const char* name, Func, Args...) -> Job<Func, Args...>;
 
+    // returned by WorkerIndex() on threads that aren't job workers
+    export constexpr uint32_t NOT_A_WORKER = ~0u;
+
+    /**
+     * Type erased job as it sits in the queues
+     */
+    struct QueuedJob
+    {
+        std::move_only_function<void()> work;
+        // decremented once work has run, if set
+        std::optional<Atomics::Counter> counter;
+    };
+
+    struct JobSystemState
+    {
+        JobSystemState()
+            :criticalJobs(1024), highJobs(1024), normalJobs(4096), lowJobs(1024)
+        {}
+        std::vector<std::thread> workers;
+        std::atomic<bool> shutdown = false;
+        std::atomic<bool> running = false;
+        rigtorp::mpmc::Queue<QueuedJob> criticalJobs;
+        rigtorp::mpmc::Queue<QueuedJob> highJobs;
+        rigtorp::mpmc::Queue<QueuedJob> normalJobs;
+        rigtorp::mpmc::Queue<QueuedJob> lowJobs;
+        // jobs pushed and not yet popped, idle workers park on wake until it is non zero
+        std::atomic<int64_t> pending = 0;
+        std::mutex wake_mutex;
+        std::condition_variable wake;
+    };
+
+    JobSystemState& State()
+    {
+        static JobSystemState state;
+        return state;
+    }
+
+    thread_local uint32_t worker_index = NOT_A_WORKER;
+
+    /**
+     * Pops the highest priority job available
+     * @param job output
+     * @return false if all queues are empty
+     */
+    bool TryPopJob(QueuedJob& job)
+    {
+        JobSystemState& state = State();
+        if (state.criticalJobs.try_pop(job) ||
+            state.highJobs.try_pop(job)     ||
+            state.normalJobs.try_pop(job)   ||
+            state.lowJobs.try_pop(job))
+        {
+            state.pending.fetch_sub(1, std::memory_order_acq_rel);
+            return true;
+        }
+        return false;
+    }
+
+    void RunJob(QueuedJob& job)
+    {
+        job.work();
+        if (job.counter)
+        {
+            job.counter->decrement();
+        }
+    }
+
+    void WorkerLoop(uint32_t index)
+    {
+        worker_index = index;
+        JobSystemState& state = State();
+        while (!state.shutdown.load(std::memory_order_acquire))
+        {
+            QueuedJob job;
+            if (TryPopJob(job))
+            {
+                RunJob(job);
+                continue;
+            }
+            // nothing queued-- sleep instead of spinning a core
+            std::unique_lock lock(state.wake_mutex);
+            state.wake.wait(lock, [&state]()
+            {
+                return state.shutdown.load(std::memory_order_acquire) ||
+                       state.pending.load(std::memory_order_acquire) > 0;
+            });
+        }
+    }
+
+    void EnqueueJob(QueuedJob&& job, Priority priority)
+    {
+        JobSystemState& state = State();
+        // no workers yet (tools, early startup)-- run it inline so nothing is lost
+        if (!state.running.load(std::memory_order_acquire))
+        {
+            RunJob(job);
+            return;
+        }
+        // counted before the push so a worker never sees the job without the count
+        state.pending.fetch_add(1, std::memory_order_acq_rel);
+        bool pushed = false;
+        switch (priority)
+        {
+        case Priority::Critical:
+            pushed = state.criticalJobs.try_push(std::move(job));
+            break;
+        case Priority::High:
+            pushed = state.highJobs.try_push(std::move(job));
+            break;
+        case Priority::Normal:
+            pushed = state.normalJobs.try_push(std::move(job));
+            break;
+        case Priority::Low:
+            pushed = state.lowJobs.try_push(std::move(job));
+            break;
+        }
+        if (!pushed)
+        {
+            // queue is full-- a blocking push from a worker could wait on itself, so run it here instead
+            state.pending.fetch_sub(1, std::memory_order_acq_rel);
+            RunJob(job);
+            return;
+        }
+        {
+            // taking the lock orders the count against a worker that is about to wait
+            std::lock_guard lock(state.wake_mutex);
+        }
+        state.wake.notify_one();
+    }
+
+    /**
+     * Starts the worker threads. Call once at startup before submitting work you want to run in parallel
+     * @param worker_count amount of worker threads, defaults to one per hardware thread minus the main thread
+     */
+    export void Initialize(uint32_t worker_count = std::max(1u, std::thread::hardware_concurrency() - 1))
+    {
+        JobSystemState& state = State();
+        if (state.running.exchange(true)) return;
+        state.shutdown.store(false, std::memory_order_release);
+        state.workers.reserve(worker_count);
+        for (uint32_t i = 0; i < worker_count; ++i)
+        {
+            state.workers.emplace_back(WorkerLoop, i);
+        }
+    }
+
+    /**
+     * Joins the worker threads. Jobs still queued are run on the calling thread so their counters reach zero
+     */
+    export void Shutdown()
+    {
+        JobSystemState& state = State();
+        if (!state.running.exchange(false)) return;
+        {
+            std::lock_guard lock(state.wake_mutex);
+            state.shutdown.store(true, std::memory_order_release);
+        }
+        state.wake.notify_all();
+        for (auto& worker : state.workers)
+        {
+            if (worker.joinable())
+            {
+                worker.join();
+            }
+        }
+        state.workers.clear();
+        QueuedJob job;
+        while (TryPopJob(job))
+        {
+            RunJob(job);
+        }
+    }
+
+    /**
+     * @return amount of worker threads, use to size per worker resources
+     */
+    export uint32_t WorkerCount()
+    {
+        return static_cast<uint32_t>(State().workers.size());
+    }
+
+    /**
+     * @return index of the calling worker in [0, WorkerCount()), or NOT_A_WORKER
+     */
+    export uint32_t WorkerIndex()
+    {
+        return worker_index;
+    }
+
     /**
      * \b Usage: Used to submit tasks to the job system
      * @tparam Func compiler will automatically attempt to deduce the function type
@@ -78,8 +269,8 @@ namespace JobSystem
      * @param task_info Wrapper around function and function arguments-- as well as debug information
      * @param source_location automatically captures where the task is submitted for debugging
      */
-    template <typename Func, typename... Args>
-    void SubmitJob(Job<Func, Args...>&& task_info, 
+    export template <typename Func, typename... Args>
+    void SubmitJob(Job<Func, Args...>&& task_info,
                      const std::source_location& source_location = std::source_location::current())
     {
         task_info.file_name = source_location.file_name();
@@ -87,8 +278,55 @@ namespace JobSystem
         task_info.function_type = typeid(Func).name();
         task_info.line_number = source_location.line();
         task_info.column = source_location.column();
-        //enqueue into task
-        //task.push_back(std::make_unique<TaskDecl<Func, Args...>>(std::move(task_info)));
+
+        QueuedJob job;
+        job.work = [task = std::move(task_info)]() mutable { task.execute(); };
+        EnqueueJob(std::move(job), Priority::Normal);
+    }
+
+    /**
+     * \b Usage: Used to submit tasks that something will wait on with WaitForCounter
+     * @param task_info Wrapper around function and function arguments-- as well as debug information
+     * @param counter incremented now, decremented once the job has run
+     * @param priority queue to submit to
+     * @param source_location automatically captures where the task is submitted for debugging
+     */
+    export template <typename Func, typename... Args>
+    void SubmitJob(Job<Func, Args...>&& task_info, Atomics::Counter& counter, Priority priority = Priority::Normal,
+                     const std::source_location& source_location = std::source_location::current())
+    {
+        task_info.file_name = source_location.file_name();
+        task_info.called_from = source_location.function_name();
+        task_info.function_type = typeid(Func).name();
+        task_info.line_number = source_location.line();
+        task_info.column = source_location.column();
+
+        counter.increment();
+        QueuedJob job;
+        job.work = [task = std::move(task_info)]() mutable { task.execute(); };
+        job.counter = counter;
+        EnqueueJob(std::move(job), priority);
+    }
+
+    /**
+     * Waits for a counter to hit zero, running queued jobs on this thread in the meantime so a worker waiting on
+     * other jobs can't deadlock the pool
+     * @param counter counter passed to SubmitJob
+     */
+    export void WaitForCounter(const Atomics::Counter& counter)
+    {
+        while (counter.get() > 0)
+        {
+            QueuedJob job;
+            if (TryPopJob(job))
+            {
+                RunJob(job);
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
     }
 
     /**
@@ -98,6 +336,6 @@ namespace JobSystem
     template <typename Func, typename... Args>
     void ExecuteJob(Job<Func, Args...>&& job)
     {
-        job.Execute();
+        job.execute();
     }
-}
\ No newline at end of file
+}
@@ -2,36 +2,318 @@
 #include <simdjson.h>
 #include <simdjson/ondemand.h>
 #include <simdjson/padded_string.h>
+#include <cstdint>
 export module JsonParser;
 
+import std;
+
 //got too annoying to write simdjson each time, but many of the types here are from this namespace
 using namespace simdjson;
 
 export using JsonObject = ondemand::object;
+
+/**
+ * How a struct maps to a JSON object. Specialize next to the struct with a static constexpr tuple of jsonField: \n
+ * \b Usage: template <> struct JsonSchema<Foo> { static constexpr auto fields = std::make_tuple(jsonField("name", &Foo::name)); };
+ * @tparam T struct to load into
+ */
+export template <typename T>
+struct JsonSchema;
+
+/**
+ * One key of a JsonSchema
+ */
+export template <typename T, typename Member>
+struct JsonField
+{
+    std::string_view key;
+    Member T::* member;
+};
+
+/**
+ * @param key key in the JSON object
+ * @param member member it's read into-- bool, numbers, std::string, std::array, std::vector or another mapped struct
+ */
+export template <typename T, typename Member>
+constexpr JsonField<T, Member> jsonField(std::string_view key, Member T::* member)
+{
+    return {key, member};
+}
+
+export template <typename T>
+concept JsonMapped = requires { JsonSchema<T>::fields; };
+
+template <typename T>
+struct IsStdArray : std::false_type {};
+template <typename E, size_t N>
+struct IsStdArray<std::array<E, N>> : std::true_type {};
+
+template <typename T>
+struct IsStdVector : std::false_type {};
+template <typename E, typename A>
+struct IsStdVector<std::vector<E, A>> : std::true_type {};
+
+template <typename T>
+error_code readJsonValue(ondemand::value value, T& out);
+
+/**
+ * Reads the keys of the schema straight off the on-demand stream, in document order-- unknown keys are skipped.
+ * Keys that are missing are set back to the struct's defaults (copy assigned, so strings and vectors keep their memory)
+ */
+template <typename T, size_t... I>
+error_code readJsonFields(ondemand::object object, T& out, std::index_sequence<I...>)
+{
+    static_assert(sizeof...(I) <= 64, "JsonSchema supports up to 64 keys");
+    constexpr auto& fields = JsonSchema<T>::fields;
+    uint64_t seen = 0;
+    for (auto result : object)
+    {
+        ondemand::field field;
+        if (auto error = result.get(field)) return error;
+        std::string_view key;
+        if (auto error = field.unescaped_key().get(key)) return error;
+
+        error_code error = SUCCESS;
+        ((std::get<I>(fields).key == key
+            ? (seen |= 1ull << I, error = readJsonValue(field.value(), out.*(std::get<I>(fields).member)), true)
+            : false) || ...);
+        if (error) return error;
+    }
+
+    constexpr uint64_t all = sizeof...(I) == 64 ? ~0ull : (1ull << sizeof...(I)) - 1;
+    if (seen != all)
+    {
+        static const T defaults = T{};
+        ((seen & (1ull << I) ? void() : void(out.*(std::get<I>(fields).member) = defaults.*(std::get<I>(fields).member))), ...);
+    }
+    return SUCCESS;
+}
+
+template <typename T>
+error_code readJsonValue(ondemand::value value, T& out)
+{
+    if constexpr (std::is_same_v<T, bool>)
+    {
+        return value.get_bool().get(out);
+    }
+    else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+    {
+        int64_t number = 0;
+        if (auto error = value.get_int64().get(number)) return error;
+        if (number < std::numeric_limits<T>::min() || number > std::numeric_limits<T>::max()) return NUMBER_OUT_OF_RANGE;
+        out = static_cast<T>(number);
+        return SUCCESS;
+    }
+    else if constexpr (std::is_integral_v<T>)
+    {
+        uint64_t number = 0;
+        if (auto error = value.get_uint64().get(number)) return error;
+        if (number > std::numeric_limits<T>::max()) return NUMBER_OUT_OF_RANGE;
+        out = static_cast<T>(number);
+        return SUCCESS;
+    }
+    else if constexpr (std::is_floating_point_v<T>)
+    {
+        double number = 0.0;
+        if (auto error = value.get_double().get(number)) return error;
+        out = static_cast<T>(number);
+        return SUCCESS;
+    }
+    else if constexpr (std::is_same_v<T, std::string>)
+    {
+        std::string_view string;
+        if (auto error = value.get_string().get(string)) return error;
+        // assign keeps the capacity of the string being reused
+        out.assign(string);
+        return SUCCESS;
+    }
+    else if constexpr (IsStdArray<T>::value)
+    {
+        ondemand::array array;
+        if (auto error = value.get_array().get(array)) return error;
+        size_t count = 0;
+        for (auto element : array)
+        {
+            ondemand::value item;
+            if (auto error = element.get(item)) return error;
+            if (count == out.size()) return INDEX_OUT_OF_BOUNDS;
+            if (auto error = readJsonValue(item, out[count])) return error;
+            ++count;
+        }
+        return count == out.size() ? SUCCESS : INDEX_OUT_OF_BOUNDS;
+    }
+    else if constexpr (IsStdVector<T>::value)
+    {
+        ondemand::array array;
+        if (auto error = value.get_array().get(array)) return error;
+        // elements already there are read into in place, so a reused vector doesn't reallocate its strings
+        size_t count = 0;
+        for (auto element : array)
+        {
+            ondemand::value item;
+            if (auto error = element.get(item)) return error;
+            if (count == out.size()) out.emplace_back();
+            if (auto error = readJsonValue(item, out[count])) return error;
+            ++count;
+        }
+        out.resize(count);
+        return SUCCESS;
+    }
+    else
+    {
+        static_assert(JsonMapped<T>, "No JsonSchema specialization for this type");
+        ondemand::object object;
+        if (auto error = value.get_object().get(object)) return error;
+        return readJsonFields(object, out, std::make_index_sequence<std::tuple_size_v<std::decay_t<decltype(JsonSchema<T>::fields)>>>{});
+    }
+}
+
+/**
+ * Loads JSON manifests straight into C++ structs described by a JsonSchema, with simdjson on demand-- no DOM is
+ * built. The parser and the padded file buffer are kept between loads, so loading many files (or the same one
+ * again) allocates nothing once they've grown to the largest file. \n
+ * Not thread safe, use one per thread
+ */
 export class JsonParser
 {
 private:
     ondemand::parser parser;
+    // file contents plus SIMDJSON_PADDING, reused across files
+    std::vector<char> buffer;
+
 public:
     JsonParser()
     {
-        
+
     }
 
     ~JsonParser()
     {
-        
+
+    }
+
+    /**
+     * Parses a file into out. out may be reused from an earlier load, its strings and vectors are overwritten in place
+     * @param file path to the JSON file
+     * @param out root object
+     * @return false if the file couldn't be read or doesn't match the schema-- out is partially written
+     */
+    template <JsonMapped T>
+    bool LoadJsonFile(const std::string& file, T& out)
+    {
+        std::ifstream stream(file, std::ios::binary | std::ios::ate);
+        if (!stream.is_open())
+        {
+            std::cerr << "JsonParser: failed to open " << file << std::endl;
+            return false;
+        }
+        const size_t size = static_cast<size_t>(stream.tellg());
+        reserveBuffer(size);
+        stream.seekg(0, std::ios::beg);
+        stream.read(buffer.data(), static_cast<std::streamsize>(size));
+        if (!stream)
+        {
+            std::cerr << "JsonParser: failed to read " << file << std::endl;
+            return false;
+        }
+        return ParsePadded(buffer.data(), size, buffer.size(), out, file);
     }
 
-    
+    /**
+     * Parses JSON that is already in memory, copying it into the padded buffer first
+     * @param json JSON text
+     * @param out root object
+     * @return false if it doesn't match the schema
+     */
+    template <JsonMapped T>
+    bool ParseJson(std::string_view json, T& out)
+    {
+        reserveBuffer(json.size());
+        std::memcpy(buffer.data(), json.data(), json.size());
+        return ParsePadded(buffer.data(), json.size(), buffer.size(), out, "<memory>");
+    }
 
-    void LoadJsonFile(const std::string& file)
+    /**
+     * Parses JSON in a caller owned buffer without copying it
+     * @param json JSON text
+     * @param size length of the JSON
+     * @param capacity size of the buffer, at least size + SIMDJSON_PADDING
+     * @param out root object
+     * @param name used in error messages
+     * @return false if it doesn't match the schema
+     */
+    template <JsonMapped T>
+    bool ParsePadded(const char* json, size_t size, size_t capacity, T& out, std::string_view name = "<memory>")
     {
-        auto json = padded_string::load(file.c_str());
-        ondemand::document doc = parser.iterate(json);
-        JsonObject root = doc.get_object();
-        uint32_t total_params = root.count_fields();
-        
+        ondemand::document doc;
+        error_code error = parser.iterate(json, size, capacity).get(doc);
+        ondemand::object root;
+        if (!error) error = doc.get_object().get(root);
+        if (!error) error = readJsonFields(root, out, std::make_index_sequence<std::tuple_size_v<std::decay_t<decltype(JsonSchema<T>::fields)>>>{});
+        if (!error && !doc.at_end()) error = TRAILING_CONTENT;
+        if (error)
+        {
+            std::cerr << "JsonParser: " << name << ": " << error_message(error) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Parses a stream of documents (NDJSON, one object per line) with iterate_many, one T per document. \n
+     * Elements already in out are reused like vector members are, out ends up with exactly one element per document
+     * @param json documents, followed by at least SIMDJSON_PADDING readable bytes (their content doesn't matter)
+     * @param size length of the documents
+     * @param out one element per document
+     * @param name used in error messages
+     * @param batch_size bytes parsed per batch, must be larger than the largest document
+     * @return false if a document doesn't match the schema-- out holds the documents before it
+     */
+    template <JsonMapped T>
+    bool ParseMany(const char* json, size_t size, std::vector<T>& out, std::string_view name = "<memory>",
+                   size_t batch_size = ondemand::DEFAULT_BATCH_SIZE)
+    {
+        ondemand::document_stream stream;
+        error_code error = parser.iterate_many(json, size, batch_size).get(stream);
+        size_t count = 0;
+        if (!error)
+        {
+            for (auto result : stream)
+            {
+                ondemand::document_reference document;
+                ondemand::object root;
+                if ((error = result.get(document))) break;
+                if ((error = document.get_object().get(root))) break;
+                if (count == out.size()) out.emplace_back();
+                if ((error = readJsonFields(root, out[count], std::make_index_sequence<std::tuple_size_v<std::decay_t<decltype(JsonSchema<T>::fields)>>>{}))) break;
+                ++count;
+            }
+        }
+        out.resize(count);
+        if (error)
+        {
+            std::cerr << "JsonParser: " << name << ": document " << count << ": " << error_message(error) << std::endl;
+            return false;
+        }
+        return true;
     }
-};
 
+    /**
+     * Bytes a buffer holding size bytes of JSON must have
+     */
+    static constexpr size_t PaddedSize(size_t size)
+    {
+        return size + SIMDJSON_PADDING;
+    }
+
+private:
+    void reserveBuffer(size_t size)
+    {
+        if (buffer.size() < PaddedSize(size))
+        {
+            buffer.resize(PaddedSize(size));
+        }
+        // the padding must not look like more JSON
+        std::memset(buffer.data() + size, 0, SIMDJSON_PADDING);
+    }
+};
@@ -0,0 +1,280 @@
+module;
+#include <cstdint>
+#include <cstring>
+export module JsonParserPool;
+
+import std;
+import JsonParser;
+import JobSystem;
+import Atomics;
+import FileLoaderSystem;
+
+namespace AngelBase::Core
+{
+    /**
+     * Result of one file of a batch
+     */
+    export enum class JsonLoadResult : uint8_t
+    {
+        eSuccess,
+        eFailedToRead,
+        eFailedToParse
+    };
+
+    /**
+     * One JsonParser per job worker, for ingesting many manifests at once (the scene and prefab manifests of a level).
+     * Files are read through the FileLoaderSystem and each one is parsed by a job fired from its read's continuation,
+     * so parsing overlaps the reads still in flight. \n
+     * Parsers and file buffers are kept between batches. Use from one thread at a time
+     */
+    export class JsonParserPool
+    {
+    public:
+        /**
+         * @param loader file loader to read through, null to read with blocking reads on the workers (tools)
+         */
+        explicit JsonParserPool(FileLoaderSystem* loader = nullptr)
+            :file_loader(loader)
+        {
+        }
+
+        /**
+         * Loads a batch of JSON files in parallel, one T per file
+         * @param files paths to the files, must stay valid until this returns
+         * @param out resized to files.size(), element i receives file i-- elements already there are reused
+         * @param priority priority of the reads
+         * @return result per file, same order as files
+         */
+        template <JsonMapped T>
+        std::vector<JsonLoadResult> LoadJsonFiles(const std::vector<std::string>& files, std::vector<T>& out,
+                                                  AsyncFilePriority priority = AsyncFilePriority::Normal)
+        {
+            preparePool();
+            out.resize(files.size());
+            std::vector<JsonLoadResult> results(files.size(), JsonLoadResult::eFailedToRead);
+            if (file_buffers.size() < files.size())
+            {
+                file_buffers.resize(files.size());
+            }
+
+            Atomics::Counter parse_jobs;
+            if (!file_loader)
+            {
+                for (size_t i = 0; i < files.size(); ++i)
+                {
+                    JobSystem::SubmitJob(JobSystem::Job{"ParseJson", [this, &files, &out, &results, i]()
+                    {
+                        std::error_code ec;
+                        if (!std::filesystem::is_regular_file(files[i], ec)) return;
+                        results[i] = parserForThisThread().LoadJsonFile(files[i], out[i])
+                            ? JsonLoadResult::eSuccess : JsonLoadResult::eFailedToParse;
+                    }}, parse_jobs, JobSystem::Priority::Normal);
+                }
+                JobSystem::WaitForCounter(parse_jobs);
+                return results;
+            }
+
+            Atomics::Counter reads;
+            for (size_t i = 0; i < files.size(); ++i)
+            {
+                std::error_code ec;
+                const auto size = std::filesystem::file_size(files[i], ec);
+                if (ec)
+                {
+                    std::cerr << "JsonParserPool: failed to open " << files[i] << std::endl;
+                    continue;
+                }
+                std::vector<char>& buffer = file_buffers[i];
+                if (buffer.size() < JsonParser::PaddedSize(static_cast<size_t>(size)))
+                {
+                    buffer.resize(JsonParser::PaddedSize(static_cast<size_t>(size)));
+                }
+
+                (void)file_loader->asyncReadFileThen(files[i].c_str(), reinterpret_cast<AsyncFileBuffer>(buffer.data()),
+                    static_cast<size_t>(size), priority, reads,
+                    [this, &files, &out, &results, &parse_jobs, i](const AsyncRequestHandle& handle)
+                {
+                    if (handle.result->load(std::memory_order_acquire) != AsyncFileResult::Success) return;
+                    const size_t read_size = handle.actual_size;
+                    JobSystem::SubmitJob(JobSystem::Job{"ParseJson", [this, &files, &out, &results, i, read_size]()
+                    {
+                        std::vector<char>& buffer = file_buffers[i];
+                        // a reused buffer still holds the end of a longer file
+                        std::memset(buffer.data() + read_size, 0, buffer.size() - read_size);
+                        results[i] = parserForThisThread().ParsePadded(buffer.data(), read_size, buffer.size(), out[i], files[i])
+                            ? JsonLoadResult::eSuccess : JsonLoadResult::eFailedToParse;
+                    }}, parse_jobs, JobSystem::Priority::Normal);
+                });
+            }
+            // every parse job is submitted once the reads are done (continuations run before the counter drops)
+            JobSystem::WaitForCounter(reads);
+            JobSystem::WaitForCounter(parse_jobs);
+            return results;
+        }
+
+        /**
+         * Loads an NDJSON file (one document per line). The file is split at line breaks into a chunk per worker,
+         * and every chunk is parsed with iterate_many in parallel
+         * @param file path to the file
+         * @param out one element per document, in file order-- elements already there are reused
+         * @param priority priority of the read
+         * @return result of the whole file
+         */
+        template <JsonMapped T>
+        JsonLoadResult LoadJsonLines(const std::string& file, std::vector<T>& out, AsyncFilePriority priority = AsyncFilePriority::Normal)
+        {
+            preparePool();
+            std::error_code ec;
+            const auto file_size = std::filesystem::file_size(file, ec);
+            if (ec)
+            {
+                std::cerr << "JsonParserPool: failed to open " << file << std::endl;
+                return JsonLoadResult::eFailedToRead;
+            }
+            const size_t size = static_cast<size_t>(file_size);
+            if (lines_buffer.size() < JsonParser::PaddedSize(size))
+            {
+                lines_buffer.resize(JsonParser::PaddedSize(size));
+            }
+            if (!readWhole(file, size, priority))
+            {
+                std::cerr << "JsonParserPool: failed to read " << file << std::endl;
+                return JsonLoadResult::eFailedToRead;
+            }
+            std::memset(lines_buffer.data() + size, 0, lines_buffer.size() - size);
+
+            // chunk boundaries right after a line break, so no document straddles two chunks
+            const size_t chunk_count = std::max<size_t>(1, std::min<size_t>(parsers.size(), size / MIN_CHUNK_SIZE));
+            std::vector<size_t> boundaries = {0};
+            for (size_t k = 1; k < chunk_count; ++k)
+            {
+                size_t split = std::max(boundaries.back(), size * k / chunk_count);
+                const char* newline = static_cast<const char*>(std::memchr(lines_buffer.data() + split, '\n', size - split));
+                split = newline ? static_cast<size_t>(newline - lines_buffer.data()) + 1 : size;
+                if (split > boundaries.back() && split < size) boundaries.push_back(split);
+            }
+            boundaries.push_back(size);
+
+            const size_t chunks = boundaries.size() - 1;
+            ChunkResults<T>& chunk_results = chunkResults<T>();
+            chunk_results.documents.resize(chunks);
+            std::vector<uint8_t> chunk_ok(chunks, 0);
+
+            Atomics::Counter parse_jobs;
+            for (size_t k = 0; k < chunks; ++k)
+            {
+                JobSystem::SubmitJob(JobSystem::Job{"ParseJsonLines", [this, &file, &boundaries, &chunk_results, &chunk_ok, k]()
+                {
+                    // later chunks are followed by the next chunk instead of zeroes, iterate_many only needs the
+                    // padding to be readable
+                    chunk_ok[k] = parserForThisThread().ParseMany(lines_buffer.data() + boundaries[k], boundaries[k + 1] - boundaries[k],
+                                                                  chunk_results.documents[k], file);
+                }}, parse_jobs, JobSystem::Priority::Normal);
+            }
+            JobSystem::WaitForCounter(parse_jobs);
+            if (std::ranges::contains(chunk_ok, uint8_t(0)))
+            {
+                return JsonLoadResult::eFailedToParse;
+            }
+
+            size_t total = 0;
+            for (const auto& documents : chunk_results.documents)
+            {
+                total += documents.size();
+            }
+            out.resize(total);
+            size_t index = 0;
+            for (auto& documents : chunk_results.documents)
+            {
+                // swapped, not moved, so the chunk vectors keep memory to parse into next time
+                for (auto& document : documents)
+                {
+                    std::swap(out[index++], document);
+                }
+            }
+            return JsonLoadResult::eSuccess;
+        }
+
+    private:
+        // below this a chunk isn't worth a job
+        static constexpr size_t MIN_CHUNK_SIZE = 1024 * 1024;
+
+        template <typename T>
+        struct ChunkResults
+        {
+            std::vector<std::vector<T>> documents;
+        };
+
+        /**
+         * Per type chunk storage for LoadJsonLines, kept so chunks parse into memory of the last batch
+         */
+        template <typename T>
+        ChunkResults<T>& chunkResults()
+        {
+            auto& slot = chunk_storage[std::type_index(typeid(T))];
+            if (!slot)
+            {
+                slot = std::shared_ptr<void>(new ChunkResults<T>(), [](void* p) { delete static_cast<ChunkResults<T>*>(p); });
+            }
+            return *static_cast<ChunkResults<T>*>(slot.get());
+        }
+
+        /**
+         * One parser per worker plus one for the calling thread, which helps out while it waits
+         */
+        void preparePool()
+        {
+            calling_thread = std::this_thread::get_id();
+            const size_t count = JobSystem::WorkerCount() + 1;
+            while (parsers.size() < count)
+            {
+                parsers.push_back(std::make_unique<JsonParser>());
+            }
+        }
+
+        JsonParser& parserForThisThread()
+        {
+            const uint32_t worker = JobSystem::WorkerIndex();
+            if (worker == JobSystem::NOT_A_WORKER || worker + 1 >= parsers.size())
+            {
+                if (std::this_thread::get_id() == calling_thread)
+                {
+                    return *parsers.back();
+                }
+                // a parse submitted from a read continuation runs inline on the I/O thread when the queue is full,
+                // several of those can be in flight next to the calling thread
+                thread_local JsonParser foreign_thread_parser;
+                return foreign_thread_parser;
+            }
+            return *parsers[worker];
+        }
+
+        bool readWhole(const std::string& file, size_t size, AsyncFilePriority priority)
+        {
+            if (!file_loader)
+            {
+                std::ifstream stream(file, std::ios::binary);
+                stream.read(lines_buffer.data(), static_cast<std::streamsize>(size));
+                return static_cast<bool>(stream);
+            }
+            Atomics::Counter read;
+            // the returned handle is a copy taken at submit, only the completing handle carries actual_size
+            bool ok = false;
+            (void)file_loader->asyncReadFileThen(file.c_str(), reinterpret_cast<AsyncFileBuffer>(lines_buffer.data()),
+                size, priority, read, [&ok, size](const AsyncRequestHandle& handle)
+            {
+                ok = handle.result->load(std::memory_order_acquire) == AsyncFileResult::Success && handle.actual_size == size;
+            });
+            JobSystem::WaitForCounter(read);
+            return ok;
+        }
+
+        FileLoaderSystem* file_loader = nullptr;
+        // indexed by JobSystem::WorkerIndex(), the last one is the calling thread's
+        std::vector<std::unique_ptr<JsonParser>> parsers;
+        std::thread::id calling_thread;
+        std::vector<std::vector<char>> file_buffers;
+        std::vector<char> lines_buffer;
+        std::unordered_map<std::type_index, std::shared_ptr<void>> chunk_storage;
+    };
+}
@@ -5,7 +5,9 @@ module;
 
 export module ResourceManager;
 
+import std;
 import VulkanContext;
+import VulkanTransfer;
 import ServiceLocator;
 export using glTFVertex = Assimp::Vertex;
 
@@ -20,6 +22,11 @@ namespace Rendering::Vulkan
         std::weak_ptr<std::vector<glTFVertex>> model_vertices_data;
         std::weak_ptr<std::vector<uint16_t>> model_indices_data;
         
+        vk::Buffer model_buffer{};
+        VmaAllocation model_allocation{};
+        // timeline value the model's copy is done at, see UploadScheduler::GetWaitInfo
+        uint64_t model_upload_value = 0;
+        
         void UploadModelToGPU()
         {
             //for interfacing with the model
@@ -27,29 +34,71 @@ namespace Rendering::Vulkan
             VkDeviceSize iBufSize{sizeof(uint16_t) * model_indices_data.lock().get()->size()};
             //aiVector3D min, max;
 
+            auto scheduler = ServiceLocator::Instance()->Get<UploadScheduler>();
+            // a model uploaded before is replaced, its copy may still be recorded or in flight
+            destroyModelBuffer(*scheduler);
+
+            //device local, filled by a copy on the transfer queue
             vk::BufferCreateInfo buffer_create_info{};
             buffer_create_info.size = vBufSize + iBufSize;
-            buffer_create_info.usage = vk::BufferUsageFlags::BitsType::eVertexBuffer | vk::BufferUsageFlags::BitsType::eIndexBuffer;
+            buffer_create_info.usage = vk::BufferUsageFlags::BitsType::eVertexBuffer | vk::BufferUsageFlags::BitsType::eIndexBuffer |
+                                       vk::BufferUsageFlags::BitsType::eTransferDst;
 
             VmaAllocationCreateInfo bufferAllocInfo {};
-            bufferAllocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_ALLOW_TRANSFER_INSTEAD_BIT;
-            bufferAllocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+            bufferAllocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
 
-            vk::Buffer vBuffer{};
-            VmaAllocation vBufferAllocation {};
-            //buffer for uploading model textures to VRAM
-            vmaCreateBuffer(m_context.vram_allocator, 
+            if (vmaCreateBuffer(m_context.vram_allocator, 
                 reinterpret_cast<VkBufferCreateInfo*>(&buffer_create_info), 
                 &bufferAllocInfo, 
-                reinterpret_cast<VkBuffer*>(&vBuffer), 
-                &vBufferAllocation, nullptr);
+                reinterpret_cast<VkBuffer*>(&model_buffer), 
+                &model_allocation, nullptr) != VK_SUCCESS)
+            {
+                std::cerr << "Failed to create model buffer!" << std::endl;
+                return;
+            }
+
+            //staged through the ring, a memcpy instead of a buffer and a map per model
+            auto staging_ring = ServiceLocator::Instance()->Get<StagingRing>();
+            StagingRing::Allocation staging = staging_ring->Allocate(buffer_create_info.size);
+            if (!staging)
+            {
+                // the ring is held by copies recorded since the last submit
+                scheduler->Submit();
+                staging = staging_ring->Allocate(buffer_create_info.size);
+            }
+            if (!staging)
+            {
+                std::cerr << "Model is larger than the staging ring!" << std::endl;
+                destroyModelBuffer(*scheduler);
+                return;
+            }
 
-            void * bufferPtr {nullptr};
+            std::memcpy(staging.data, model_vertices_data.lock().get()->data(), vBufSize);
+            std::memcpy(static_cast<char*>(staging.data) + vBufSize, model_indices_data.lock().get()->data(), iBufSize);
+            staging_ring->Flush(staging);
 
-            vmaMapMemory(m_context.vram_allocator, vBufferAllocation, &bufferPtr);
-            memcpy(bufferPtr, model_vertices_data.lock().get()->data(), vBufSize);
-            memcpy(static_cast<char*>(bufferPtr) + vBufSize, model_indices_data.lock().get()->data(), iBufSize );
-            vmaUnmapMemory(m_context.vram_allocator, vBufferAllocation);
+            vk::BufferCopy region{staging.offset, 0, buffer_create_info.size};
+            model_upload_value = scheduler->CopyBuffer(staging.buffer, model_buffer, {&region, 1},
+                                                       vk::PipelineStageFlagBits2::eVertexAttributeInput | vk::PipelineStageFlagBits2::eIndexInput,
+                                                       vk::AccessFlagBits2::eVertexAttributeRead | vk::AccessFlagBits2::eIndexRead);
+            staging_ring->Release(staging, model_upload_value);
+        }
+
+        void destroyModelBuffer(UploadScheduler& scheduler)
+        {
+            if (!model_buffer)
+            {
+                return;
+            }
+            if (model_upload_value > scheduler.GetSubmittedValue())
+            {
+                scheduler.Submit();
+            }
+            scheduler.WaitForUpload(model_upload_value);
+            vmaDestroyBuffer(m_context.vram_allocator, static_cast<VkBuffer>(model_buffer), model_allocation);
+            model_buffer = nullptr;
+            model_allocation = nullptr;
+            model_upload_value = 0;
         }
     };
 }
\ No newline at end of file
@@ -5,6 +5,9 @@
 #include <slang/slang-com-ptr.h>
 #include <simdjson/ondemand.h>
 #include <vulkan/vulkan.hpp>
+#if ANGELBASE_SPIRV_OPT
+#include <spirv-tools/optimizer.hpp>
+#endif
 
 
 export module ShaderManager;
@@ -12,12 +15,84 @@ export module ShaderManager;
 import std;
 import JsonParser;
 import ServiceLocator;
+import Hash;
+import JobSystem;
+import Atomics;
+import ShaderWatcher;
+import FileLoaderSystem;
 
 namespace Rendering
 {
 
+    /**
+     * Minimal little helpers for the binary reflection format-- plain values and length prefixed strings
+     */
+    struct BinaryWriter
+    {
+        std::vector<uint8_t>& out;
+
+        template <typename T>
+        void value(T v)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            const auto* bytes = reinterpret_cast<const uint8_t*>(&v);
+            out.insert(out.end(), bytes, bytes + sizeof(T));
+        }
+
+        void string(const std::string& s)
+        {
+            value(static_cast<uint32_t>(s.size()));
+            out.insert(out.end(), s.begin(), s.end());
+        }
+    };
+
+    struct BinaryReader
+    {
+        std::span<const uint8_t> data;
+        size_t offset = 0;
+        bool ok = true;
+
+        template <typename T>
+        T value()
+        {
+            T v = {};
+            if (offset + sizeof(T) > data.size())
+            {
+                ok = false;
+                return v;
+            }
+            std::memcpy(&v, data.data() + offset, sizeof(T));
+            offset += sizeof(T);
+            return v;
+        }
+
+        std::string string()
+        {
+            const uint32_t size = value<uint32_t>();
+            if (!ok || offset + size > data.size())
+            {
+                ok = false;
+                return {};
+            }
+            std::string s(reinterpret_cast<const char*>(data.data() + offset), size);
+            offset += size;
+            return s;
+        }
+
+        // counts come from disk, don't let a corrupt one allocate gigabytes
+        uint32_t count()
+        {
+            const uint32_t n = value<uint32_t>();
+            if (n > data.size() - std::min(offset, data.size())) ok = false;
+            return ok ? n : 0;
+        }
+    };
+
     export struct ShaderReflection
     {
+        // binding count of unsized arrays, e.g. Sampler2D textures[]
+        static constexpr uint32_t UNBOUNDED = ~0u;
+
         struct UniformBuffer
         {
             std::string name;
@@ -25,6 +100,15 @@ namespace Rendering
             uint32_t set;
             size_t size;
             std::vector<std::pair<std::string, size_t>> members; // member name, offset
+            vk::ShaderStageFlags stages;
+        };
+
+        enum class TextureType : uint32_t
+        {
+            Sampled,
+            CombinedSampler,
+            Storage,
+            Sampler
         };
     
         struct Texture
@@ -33,6 +117,10 @@ namespace Rendering
             uint32_t binding;
             uint32_t set;
             bool isSampler;
+            TextureType type;
+            // descriptor count, 1 unless it's an array-- UNBOUNDED for unsized arrays
+            uint32_t count;
+            vk::ShaderStageFlags stages;
         };
     
         struct PushConstant
@@ -40,6 +128,7 @@ namespace Rendering
             std::string name;
             size_t size;
             size_t offset;
+            vk::ShaderStageFlags stages;
         };
     
         struct VertexInput
@@ -48,13 +137,212 @@ namespace Rendering
             uint32_t location;
             std::string type; // "float3", "float2", etc.
         };
+
+        struct EntryPoint
+        {
+            std::string name; // name in the SPIR-V, pass to PipelineBuilder::addShaderStage
+            vk::ShaderStageFlagBits stage;
+        };
     
+        std::vector<EntryPoint> entryPoints;
         std::vector<UniformBuffer> uniformBuffers;
         std::vector<Texture> textures;
         std::vector<PushConstant> pushConstants;
         std::vector<VertexInput> vertexInputs;
-        std::string raw_json;
-        
+
+        /**
+         * Push constant ranges for a pipeline layout. Vulkan allows a stage in only one range, so each stage gets the
+         * span of everything it uses and stages with the same span share a range
+         * @return ranges ready for vk::PipelineLayoutCreateInfo
+         */
+        std::vector<vk::PushConstantRange> pushConstantRanges() const
+        {
+            std::vector<vk::PushConstantRange> ranges;
+            for (uint32_t bit = 0; bit < 32; ++bit)
+            {
+                const auto stage = static_cast<vk::ShaderStageFlagBits>(1u << bit);
+                size_t begin = ~size_t(0);
+                size_t end = 0;
+                for (const auto& constant : pushConstants)
+                {
+                    if (!(constant.stages & stage)) continue;
+                    begin = std::min(begin, constant.offset);
+                    end = std::max(end, constant.offset + constant.size);
+                }
+                if (end == 0) continue;
+
+                auto same = std::ranges::find_if(ranges, [&](const vk::PushConstantRange& range)
+                {
+                    return range.offset == begin && range.size == end - begin;
+                });
+                if (same != ranges.end())
+                {
+                    same->stageFlags |= stage;
+                }
+                else
+                {
+                    ranges.emplace_back(stage, static_cast<uint32_t>(begin), static_cast<uint32_t>(end - begin));
+                }
+            }
+            return ranges;
+        }
+
+        /**
+         * Appends the compact binary form, used by the shader cache
+         * @param out buffer to append to
+         */
+        void serialize(std::vector<uint8_t>& out) const
+        {
+            BinaryWriter writer{out};
+            writer.value(static_cast<uint32_t>(entryPoints.size()));
+            for (const auto& entry_point : entryPoints)
+            {
+                writer.string(entry_point.name);
+                writer.value(entry_point.stage);
+            }
+
+            writer.value(static_cast<uint32_t>(uniformBuffers.size()));
+            for (const auto& buffer : uniformBuffers)
+            {
+                writer.string(buffer.name);
+                writer.value(buffer.binding);
+                writer.value(buffer.set);
+                writer.value(static_cast<uint64_t>(buffer.size));
+                writer.value(static_cast<uint32_t>(buffer.stages));
+                writer.value(static_cast<uint32_t>(buffer.members.size()));
+                for (const auto& [member, offset] : buffer.members)
+                {
+                    writer.string(member);
+                    writer.value(static_cast<uint64_t>(offset));
+                }
+            }
+
+            writer.value(static_cast<uint32_t>(textures.size()));
+            for (const auto& texture : textures)
+            {
+                writer.string(texture.name);
+                writer.value(texture.binding);
+                writer.value(texture.set);
+                writer.value(texture.type);
+                writer.value(texture.count);
+                writer.value(static_cast<uint32_t>(texture.stages));
+            }
+
+            writer.value(static_cast<uint32_t>(pushConstants.size()));
+            for (const auto& constant : pushConstants)
+            {
+                writer.string(constant.name);
+                writer.value(static_cast<uint64_t>(constant.size));
+                writer.value(static_cast<uint64_t>(constant.offset));
+                writer.value(static_cast<uint32_t>(constant.stages));
+            }
+
+            writer.value(static_cast<uint32_t>(vertexInputs.size()));
+            for (const auto& input : vertexInputs)
+            {
+                writer.string(input.name);
+                writer.value(input.location);
+                writer.string(input.type);
+            }
+        }
+
+        /**
+         * Reads what serialize wrote
+         * @param data serialized bytes
+         * @return false if the data is truncated or corrupt
+         */
+        bool deserialize(std::span<const uint8_t> data)
+        {
+            BinaryReader reader{data};
+            *this = {};
+
+            entryPoints.resize(reader.count());
+            for (auto& entry_point : entryPoints)
+            {
+                entry_point.name = reader.string();
+                entry_point.stage = reader.value<vk::ShaderStageFlagBits>();
+            }
+
+            uniformBuffers.resize(reader.count());
+            for (auto& buffer : uniformBuffers)
+            {
+                buffer.name = reader.string();
+                buffer.binding = reader.value<uint32_t>();
+                buffer.set = reader.value<uint32_t>();
+                buffer.size = static_cast<size_t>(reader.value<uint64_t>());
+                buffer.stages = vk::ShaderStageFlags(reader.value<uint32_t>());
+                buffer.members.resize(reader.count());
+                for (auto& [member, offset] : buffer.members)
+                {
+                    member = reader.string();
+                    offset = static_cast<size_t>(reader.value<uint64_t>());
+                }
+            }
+
+            textures.resize(reader.count());
+            for (auto& texture : textures)
+            {
+                texture.name = reader.string();
+                texture.binding = reader.value<uint32_t>();
+                texture.set = reader.value<uint32_t>();
+                texture.type = reader.value<TextureType>();
+                texture.isSampler = texture.type == TextureType::Sampler;
+                texture.count = reader.value<uint32_t>();
+                texture.stages = vk::ShaderStageFlags(reader.value<uint32_t>());
+            }
+
+            pushConstants.resize(reader.count());
+            for (auto& constant : pushConstants)
+            {
+                constant.name = reader.string();
+                constant.size = static_cast<size_t>(reader.value<uint64_t>());
+                constant.offset = static_cast<size_t>(reader.value<uint64_t>());
+                constant.stages = vk::ShaderStageFlags(reader.value<uint32_t>());
+            }
+
+            vertexInputs.resize(reader.count());
+            for (auto& input : vertexInputs)
+            {
+                input.name = reader.string();
+                input.location = reader.value<uint32_t>();
+                input.type = reader.string();
+            }
+            return reader.ok && reader.offset == data.size();
+        }
+    };
+
+    /**
+     * Post pass run on the SPIR-V Slang emits
+     */
+    export enum class SpirvOptimization : uint32_t
+    {
+        None,
+        Performance, // spirv-opt -O
+        Size         // spirv-opt -Os
+    };
+
+    /**
+     * Cheap measurements of a SPIR-V binary, a CPU side proxy for how much work the driver and GPU get
+     */
+    export struct SpirvStats
+    {
+        size_t size_bytes = 0;
+        uint32_t instruction_count = 0;
+
+        static SpirvStats measure(std::span<const uint32_t> code)
+        {
+            SpirvStats stats = {};
+            stats.size_bytes = code.size_bytes();
+            // 5 word header, then every instruction stores its word count in the upper 16 bits of its first word
+            for (size_t i = 5; i < code.size();)
+            {
+                const uint32_t word_count = code[i] >> 16;
+                if (word_count == 0) break;
+                ++stats.instruction_count;
+                i += word_count;
+            }
+            return stats;
+        }
     };
 
     export struct CompiledShader
@@ -77,11 +365,40 @@ namespace Rendering
         ShaderError error;
         std::string name;
         std::string source;
-        ISlangBlob* spirv_code;
+        std::vector<uint32_t> spirv_code;
         ShaderReflection reflection_data;
         
+        // cache key: source, everything it imports, profile and compiler options
         size_t source_hash;
         std::filesystem::file_time_type last_edited;
+        bool from_cache = false;
+        // every file it imports or includes, relative to its directory-- the hot reload import graph
+        std::vector<std::string> dependencies;
+        // before and after the SPIR-V post pass
+        SpirvStats unoptimized_stats;
+        SpirvStats stats;
+        // feature constants switched on for this variant, sorted-- empty for the base shader
+        std::vector<std::string> features;
+    };
+
+    // bump whenever the cache file layout or what goes into the key changes
+    constexpr uint32_t SHADER_CACHE_MAGIC = 0x43534241; // 'ABSC'
+    constexpr uint32_t SHADER_CACHE_VERSION = 4;
+
+    /**
+     * Front of a <shader>.shadercache (or <shader>.<variant>.shadercache) file, followed by spirv_size bytes of SPIR-V and reflection_size bytes of
+     * ShaderReflection::serialize output
+     */
+    struct ShaderCacheHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t key;
+        uint64_t spirv_size;
+        uint64_t reflection_size;
+        // before the SPIR-V post pass, for reporting
+        uint64_t unoptimized_size;
+        uint64_t unoptimized_instruction_count;
     };
     /**
      * TODO: Deprecate this class and use a dedicated pipeline manager. for now this will handle File I/O and compiling shaders
@@ -96,17 +413,64 @@ namespace Rendering
         }
         
         void initialize(const std::string& compiler_profile = "spirv_1_5", const slang::CompilerOptionEntry& entry = {})
+        {
+            profile_name = compiler_profile;
+            updateOptionsHash();
+
+            slang_session = createSession(global_session);
+
+            if (!slang_session.get())
+            {
+                throw std::runtime_error("Failed to create slang session");
+            }
+
+            // sized up front so background reload jobs never see it move
+            worker_sessions.resize(JobSystem::WorkerCount());
+        }
+
+        /**
+         * Sets the post pass run on emitted SPIR-V. Part of the cache key, so switching it recompiles rather than
+         * mixing binaries. Defaults to Performance + stripped debug info, and None with debug info in _DEBUG builds
+         * so captures keep their source mapping
+         * @param optimization spirv-opt recipe
+         * @param strip_debug remove debug and non semantic info, for shipping builds
+         */
+        void setSpirvOptimization(SpirvOptimization optimization, bool strip_debug)
+        {
+            spirv_optimization = optimization;
+            strip_debug_info = strip_debug;
+            updateOptionsHash();
+        }
+
+        /**
+         * Sessions aren't thread safe, so every worker compiling shaders gets its own global session and session
+         * with the same settings as the main one
+         * @param global global session the session is created from
+         * @return session, null on failure
+         */
+        Slang::ComPtr<slang::ISession> createSession(slang::IGlobalSession* global) const
         {
             slang::SessionDesc session_desc = {};
             
             slang::TargetDesc target_desc = {};
             target_desc.format = SLANG_SPIRV;
-            target_desc.profile = global_session->findProfile(compiler_profile.c_str());
+            target_desc.profile = global->findProfile(profile_name.c_str());
 
             session_desc.targets = &target_desc;
             session_desc.targetCount = static_cast<SlangInt>(1);
             session_desc.defaultMatrixLayoutMode = SLANG_MATRIX_LAYOUT_COLUMN_MAJOR;
 
+            auto options = compilerOptions();
+            session_desc.compilerOptionEntries = options.data();
+            session_desc.compilerOptionEntryCount = static_cast<uint32_t>(options.size());
+
+            Slang::ComPtr<slang::ISession> session = nullptr;
+            global->createSession(session_desc, session.writeRef());
+            return session;
+        }
+
+        static std::array<slang::CompilerOptionEntry, 2> compilerOptions()
+        {
             std::array<slang::CompilerOptionEntry, 2> options = 
             {{
                 slang::CompilerOptionEntry{
@@ -114,21 +478,10 @@ namespace Rendering
                     slang::CompilerOptionValue{slang::CompilerOptionValueKind::Int, 1}
                 }
             }};
-            session_desc.compilerOptionEntries = options.data();
-            session_desc.compilerOptionEntryCount = static_cast<uint32_t>(options.size());
-
-            Slang::ComPtr<slang::ISession> session = nullptr;
-            global_session->createSession(session_desc, session.writeRef());
-
-            slang_session = session;
-
-            if (!slang_session.get())
-            {
-                throw std::runtime_error("Failed to create slang session");
-            }
+            return options;
         }
 
-        std::optional<std::string> readShaderSource(const std::string& path)
+        static std::optional<std::string> readShaderSource(const std::string& path)
         {
             std::ifstream file(path, std::ios::in | std::ios::binary);
             if (!file.is_open())
@@ -149,33 +502,594 @@ namespace Rendering
             return source;
         }
 
-        CompiledShader compileShader(const std::string& name, const std::string& directory)
+        CompiledShader compileShader(const std::string& name, const std::string& directory)
+        {
+            // a fresh session, the main one may still hold modules from before the last edit
+            Slang::ComPtr<slang::ISession> session = createSession(global_session);
+            if (!session)
+            {
+                return CompiledShader(CompiledShader::eFailedToLoad);
+            }
+            CompiledShader result = buildShader(name, directory, session);
+            if (result.error != CompiledShader::eSuccess)
+            {
+                return result;
+            }
+            CompiledShaderCode.insert_or_assign(name, std::move(result));
+            return CompiledShaderCode[name];
+        }
+
+        /**
+         * Gets a permutation of a shader. The first request compiles it in the background, in a fresh session so it
+         * is never built from a module that predates an edit, and the base shader stands in until it is ready-- ask
+         * again later, or rebuild the pipelines named by updateHotReload. \n
+         * Features are the names of `extern static const bool` declarations in the shader; the ones listed are linked
+         * in as true, every other one as false, so Slang folds the disabled paths away. Order and duplicates don't
+         * matter-- the sorted set is the key, so every material asking for the same set shares one variant
+         * @param name shader file name, e.g. "shader.slang"
+         * @param directory directory it's in
+         * @param features feature constants to enable, e.g. {"ALPHA_TEST"}
+         * @return compiled variant, the base shader while it compiles or if it failed, nullptr if neither is loaded
+         */
+        const CompiledShader* getShaderVariant(const std::string& name, const std::string& directory, std::vector<std::string> features)
+        {
+            std::ranges::sort(features);
+            features.erase(std::unique(features.begin(), features.end()), features.end());
+
+            publishVariants();
+            std::string variant = variantName(name, features);
+            auto loaded = CompiledShaderCode.find(variant);
+            if (loaded != CompiledShaderCode.end())
+            {
+                return &loaded->second;
+            }
+
+            if (!variant_builds.contains(variant) && !failed_variants.contains(variant))
+            {
+                auto build = std::make_shared<VariantBuild>();
+                build->name = name;
+                build->directory = directory;
+                build->features = std::move(features);
+                variant_builds.emplace(variant, build);
+                JobSystem::SubmitJob(JobSystem::Job{"CompileShaderVariant", [this, build]()
+                {
+                    slang::IGlobalSession* global = globalSessionForThisThread();
+                    Slang::ComPtr<slang::ISession> session = global ? createSession(global) : nullptr;
+                    // not use_loaded: the owning thread keeps writing CompiledShaderCode meanwhile
+                    build->result = session ? buildShader(build->name, build->directory, session, false, build->features)
+                                            : CompiledShader(CompiledShader::eFailedToLoad);
+                    build->done.store(true, std::memory_order_release);
+                }}, variant_jobs, JobSystem::Priority::Normal);
+            }
+            return getShader(name);
+        }
+
+        /**
+         * Name a variant is stored under in CompiledShaderCode, e.g. "shader.slang#ALPHA_TEST+UNLIT"
+         * @param name shader file name
+         * @param features sorted feature set
+         * @return the file name itself when features is empty
+         */
+        static std::string variantName(const std::string& name, const std::vector<std::string>& features)
+        {
+            std::string variant = name;
+            for (size_t i = 0; i < features.size(); ++i)
+            {
+                variant += (i == 0 ? '#' : '+');
+                variant += features[i];
+            }
+            return variant;
+        }
+
+        /**
+         * @param variant name as returned by variantName
+         * @return shader file the variant was compiled from
+         */
+        static std::string shaderFileName(const std::string& variant)
+        {
+            return variant.substr(0, variant.find('#'));
+        }
+
+        /**
+         * Reads shader sources and cache entries through the FileLoaderSystem instead of blocking reads, so shader
+         * loading overlaps the texture and mesh I/O at startup. Without one (tools) files are read by the compile jobs
+         * @param loader file loader, null to go back to blocking reads
+         */
+        void setFileLoader(AngelBase::Core::FileLoaderSystem* loader)
+        {
+            file_loader = loader;
+        }
+
+        /**
+         * Compiles a batch of shaders in parallel on the job workers, each worker with its own Slang session, fresh
+         * for every batch so edits made since the last one are picked up.
+         * Cache hits are just file reads. Results land in CompiledShaderCode once the whole batch is done \n
+         * With a file loader set, the source and cache entry of every shader are requested up front and each compile
+         * job is submitted by the continuation of its last read
+         * @param names shader file names, e.g. "shader.slang"
+         * @param directory directory they're in
+         * @return error per shader, same order as names
+         */
+        std::vector<CompiledShader::ShaderError> compileShaders(const std::vector<std::string>& names, const std::string& directory)
+        {
+            // sized before any job runs, each slot is only ever touched by its own worker
+            if (worker_sessions.size() < JobSystem::WorkerCount())
+            {
+                worker_sessions.resize(JobSystem::WorkerCount());
+            }
+            resetSessions();
+
+            std::vector<CompiledShader> results(names.size());
+            Atomics::Counter compile_jobs;
+            if (file_loader)
+            {
+                streamShaders(names, directory, results, compile_jobs);
+            }
+            else
+            {
+                for (size_t i = 0; i < names.size(); ++i)
+                {
+                    JobSystem::SubmitJob(JobSystem::Job{"CompileShader", [this, &names, &directory, &results, i]()
+                    {
+                        slang::ISession* session = sessionForThisThread();
+                        results[i] = session ? buildShader(names[i], directory, session)
+                                             : CompiledShader(CompiledShader::eFailedToLoad);
+                    }}, compile_jobs, JobSystem::Priority::High);
+                }
+            }
+            JobSystem::WaitForCounter(compile_jobs);
+
+            std::vector<CompiledShader::ShaderError> errors;
+            errors.reserve(names.size());
+            for (size_t i = 0; i < names.size(); ++i)
+            {
+                errors.push_back(results[i].error);
+                if (results[i].error == CompiledShader::eSuccess)
+                {
+                    CompiledShaderCode.insert_or_assign(names[i], std::move(results[i]));
+                }
+                else
+                {
+                    std::cerr << "Failed to compile shader " << names[i] << std::endl;
+                }
+            }
+            return errors;
+        }
+
+        /**
+         * Starts watching a shader directory. Saved shaders and everything importing them are recompiled in the
+         * background, see updateHotReload
+         * @param directory directory passed to compileShader(s)
+         */
+        void enableHotReload(const std::string& directory)
+        {
+            reload_directory = directory;
+            shader_watcher = std::make_unique<ShaderWatcher>(directory);
+        }
+
+        /**
+         * Call once a frame from the thread that owns the ShaderManager. Publishes a finished background recompile
+         * into CompiledShaderCode, then starts the next one if files changed. \n
+         * Shaders that fail to compile keep their last good version
+         * @return names of shaders that changed this call-- rebuild pipelines using them (PipelineManager::reloadPipelinesUsing)
+         */
+        std::vector<std::string> updateHotReload()
+        {
+            // variants finished in the background count as changed too, their pipelines still use the base shader
+            std::vector<std::string> reloaded = publishVariants();
+            if (!shader_watcher) return reloaded;
+
+            if (reload_in_flight)
+            {
+                if (reload_jobs.get() > 0) return reloaded;
+                reload_in_flight = false;
+                for (auto& shader : reload_results)
+                {
+                    if (shader.error != CompiledShader::eSuccess) continue;
+                    reloaded.push_back(shader.name);
+                    std::string name = shader.name;
+                    CompiledShaderCode.insert_or_assign(std::move(name), std::move(shader));
+                }
+                reload_results.clear();
+            }
+
+            std::vector<std::string> changed = shader_watcher->takeChanges();
+            if (changed.empty()) return reloaded;
+            // the edit may be the fix. Variants still compiling may have read the old source, they are dropped and
+            // start over on the next request-- their jobs only write the orphaned build
+            failed_variants.clear();
+            variant_builds.clear();
+
+            // changed files themselves plus everything that imports them
+            std::unordered_set<std::string> changed_set(changed.begin(), changed.end());
+            std::vector<std::string> affected;
+            std::vector<std::vector<std::string>> affected_features;
+            for (const auto& [name, shader] : CompiledShaderCode)
+            {
+                bool dirty = changed_set.contains(shaderFileName(name));
+                for (const auto& dependency : shader.dependencies)
+                {
+                    dirty = dirty || changed_set.contains(dependency);
+                }
+                if (dirty)
+                {
+                    affected.push_back(name);
+                    affected_features.push_back(shader.features);
+                }
+            }
+            // new top level shaders
+            for (const auto& file : changed)
+            {
+                if (file.ends_with(".slang") && file.find('/') == std::string::npos && !CompiledShaderCode.contains(file) &&
+                    std::filesystem::exists(reload_directory + "/" + file))
+                {
+                    affected.push_back(file);
+                    affected_features.emplace_back();
+                }
+            }
+            if (affected.empty()) return reloaded;
+
+            reload_results.assign(affected.size(), CompiledShader(CompiledShader::eFailedToLoad));
+            for (size_t i = 0; i < affected.size(); ++i)
+            {
+                reload_results[i].name = affected[i];
+                // copied now, the jobs must not read CompiledShaderCode while the main thread can still add variants
+                reload_results[i].features = std::move(affected_features[i]);
+                if (!std::filesystem::exists(reload_directory + "/" + shaderFileName(affected[i]))) continue;
+
+                // a fresh session per compile: sessions keep every module they've loaded, so an old one would hand
+                // back the stale version of whatever changed
+                JobSystem::SubmitJob(JobSystem::Job{"ReloadShader", [this, i]()
+                {
+                    slang::IGlobalSession* global = globalSessionForThisThread();
+                    if (!global) return;
+                    Slang::ComPtr<slang::ISession> session = createSession(global);
+                    if (!session) return;
+
+                    CompiledShader shader = buildShader(shaderFileName(reload_results[i].name), reload_directory, session,
+                                                        false, reload_results[i].features);
+                    if (shader.error != CompiledShader::eSuccess)
+                    {
+                        std::cerr << "Hot reload: " << reload_results[i].name << " failed to compile, keeping the old version" << std::endl;
+                        return;
+                    }
+                    shader.name = reload_results[i].name;
+                    reload_results[i] = std::move(shader);
+                }}, reload_jobs, JobSystem::Priority::Low);
+            }
+            reload_in_flight = true;
+            return reloaded;
+        }
+
+        /**
+         * Turns off reading the disk cache, for measuring cold compiles. Entries are still written
+         */
+        void setDiskCacheEnabled(bool enabled)
+        {
+            disk_cache_enabled = enabled;
+        }
+
+        /**
+         * Where .shadercache files are read and written. Entries depend on the compiler build and options, so keep
+         * them out of the source tree and out of the shipped archive (e.g. a directory in the build tree)
+         * @param directory cache directory, created on first write-- empty for <shader directory>/cache
+         */
+        void setCacheDirectory(const std::string& directory)
+        {
+            cache_directory_override = directory;
+        }
+
+    private:
+        /**
+         * A variant compiling in the background, see getShaderVariant. Shared with its job
+         */
+        struct VariantBuild
+        {
+            std::string name;
+            std::string directory;
+            std::vector<std::string> features;
+            CompiledShader result;
+            std::atomic<bool> done = false;
+        };
+
+        /**
+         * Moves finished variant builds into CompiledShaderCode. Owning thread only
+         * @return names of the variants that became available
+         */
+        std::vector<std::string> publishVariants()
+        {
+            std::vector<std::string> published;
+            for (auto it = variant_builds.begin(); it != variant_builds.end();)
+            {
+                VariantBuild& build = *it->second;
+                if (!build.done.load(std::memory_order_acquire))
+                {
+                    ++it;
+                    continue;
+                }
+                if (build.result.error == CompiledShader::eSuccess)
+                {
+                    build.result.name = it->first;
+                    published.push_back(it->first);
+                    CompiledShaderCode.insert_or_assign(it->first, std::move(build.result));
+                }
+                else
+                {
+                    std::cerr << "Failed to compile shader variant " << it->first << ", using the base shader" << std::endl;
+                    failed_variants.insert(it->first);
+                }
+                it = variant_builds.erase(it);
+            }
+            return published;
+        }
+
+        /**
+         * Files of one shader in flight through the FileLoaderSystem. Heap allocated, the requests point into it
+         */
+        struct ShaderLoad
+        {
+            std::string source_path;
+            std::string cache_path;
+            std::string source;
+            std::vector<uint8_t> cache_entry;
+            bool source_ok = false;
+            bool cache_ok = false;
+            // the read that brings this to zero submits the compile job
+            std::atomic<uint32_t> reads_left = 0;
+        };
+
+        /**
+         * The FileLoaderSystem half of compileShaders: requests every source and cache entry, the last read of each
+         * shader submits its compile job. Returns once every compile job has been submitted
+         * @param names shader file names
+         * @param directory directory they're in
+         * @param results one per name, written by the compile jobs
+         * @param compile_jobs counter the compile jobs are submitted with
+         */
+        void streamShaders(const std::vector<std::string>& names, const std::string& directory,
+                           std::vector<CompiledShader>& results, Atomics::Counter& compile_jobs)
+        {
+            namespace Core = AngelBase::Core;
+            std::vector<std::unique_ptr<ShaderLoad>> loads;
+            loads.reserve(names.size());
+            for (const auto& name : names)
+            {
+                auto load = std::make_unique<ShaderLoad>();
+                load->source_path = directory + "/" + name;
+                load->cache_path = cacheEntryPath(cacheDirectoryFor(directory), stripSlangFileExtension(name)).string();
+                loads.push_back(std::move(load));
+            }
+
+            auto submitCompile = [this, &names, &directory, &results, &compile_jobs](size_t i, ShaderLoad& load)
+            {
+                if (!load.source_ok)
+                {
+                    results[i] = CompiledShader(CompiledShader::eFailedToOpen);
+                    return;
+                }
+                JobSystem::SubmitJob(JobSystem::Job{"CompileShader", [this, &names, &directory, &results, &load, i]()
+                {
+                    slang::ISession* session = sessionForThisThread();
+                    // submitted from a read continuation, so a full queue runs this inline on the I/O thread-- the
+                    // owning thread's sessions may be in use meanwhile, compile with ones of its own
+                    Slang::ComPtr<slang::IGlobalSession> io_global;
+                    Slang::ComPtr<slang::ISession> io_session;
+                    if (JobSystem::WorkerIndex() == JobSystem::NOT_A_WORKER && std::this_thread::get_id() != owning_thread)
+                    {
+                        slang::createGlobalSession(io_global.writeRef());
+                        io_session = io_global ? createSession(io_global) : nullptr;
+                        session = io_session;
+                    }
+                    results[i] = session
+                        ? buildShaderFromSource(names[i], directory, std::move(load.source),
+                                                load.cache_ok ? std::span<const uint8_t>(load.cache_entry) : std::span<const uint8_t>(),
+                                                session)
+                        : CompiledShader(CompiledShader::eFailedToLoad);
+                }}, compile_jobs, JobSystem::Priority::High);
+            };
+
+            Atomics::Counter reads;
+            for (size_t i = 0; i < loads.size(); ++i)
+            {
+                ShaderLoad& load = *loads[i];
+                std::error_code ec;
+                const auto source_size = std::filesystem::file_size(load.source_path, ec);
+                if (ec)
+                {
+                    std::cerr << "Failed to open shader file: " << load.source_path << std::endl;
+                    results[i] = CompiledShader(CompiledShader::eFailedToOpen);
+                    continue;
+                }
+                const auto cache_size = disk_cache_enabled ? std::filesystem::file_size(load.cache_path, ec) : 0;
+                const bool read_cache = disk_cache_enabled && !ec && cache_size > 0;
+
+                load.source.resize(static_cast<size_t>(source_size));
+                load.reads_left.store(read_cache ? 2 : 1, std::memory_order_relaxed);
+                auto finished = [&submitCompile, &load, i]()
+                {
+                    if (load.reads_left.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    {
+                        submitCompile(i, load);
+                    }
+                };
+
+                if (read_cache)
+                {
+                    load.cache_entry.resize(static_cast<size_t>(cache_size));
+                    (void)file_loader->asyncReadFileThen(load.cache_path.c_str(), load.cache_entry.data(), load.cache_entry.size(),
+                        Core::AsyncFilePriority::High, reads, [&load, finished](const Core::AsyncRequestHandle& handle)
+                    {
+                        load.cache_ok = handle.result->load(std::memory_order_acquire) == Core::AsyncFileResult::Success &&
+                                        handle.actual_size == load.cache_entry.size();
+                        finished();
+                    });
+                }
+                (void)file_loader->asyncReadFileThen(load.source_path.c_str(), reinterpret_cast<Core::AsyncFileBuffer>(load.source.data()),
+                    load.source.size(), Core::AsyncFilePriority::High, reads, [&load, finished](const Core::AsyncRequestHandle& handle)
+                {
+                    load.source_ok = handle.result->load(std::memory_order_acquire) == Core::AsyncFileResult::Success;
+                    if (load.source_ok)
+                    {
+                        load.source.resize(handle.actual_size);
+                    }
+                    finished();
+                });
+            }
+
+            // continuations run before a read's counter drops, so every compile job is submitted once this returns.
+            // Helps with the compiles that are already queued meanwhile
+            JobSystem::WaitForCounter(reads);
+            // the compile jobs still reference the loads
+            JobSystem::WaitForCounter(compile_jobs);
+        }
+
+        /**
+         * Session for the calling thread-- the main one off the job workers (or while the main thread helps out in
+         * WaitForCounter), a per worker one created on first use otherwise
+         */
+        slang::ISession* sessionForThisThread()
+        {
+            const uint32_t worker = JobSystem::WorkerIndex();
+            if (worker == JobSystem::NOT_A_WORKER || worker >= worker_sessions.size())
+            {
+                return slang_session;
+            }
+
+            WorkerSession& context = worker_sessions[worker];
+            if (!context.session)
+            {
+                slang::IGlobalSession* global = globalSessionForThisThread();
+                if (global)
+                {
+                    context.session = createSession(global);
+                }
+            }
+            return context.session;
+        }
+
+        /**
+         * Drops every long lived session so the next batch loads modules from disk again. Sessions keep every module
+         * they've loaded, so one that outlives an edit compiles the old version-- and writeCacheEntry would store it
+         * under the new source's key. Call from the owning thread while no compile job is running
+         */
+        void resetSessions()
+        {
+            owning_thread = std::this_thread::get_id();
+            slang_session = createSession(global_session);
+            for (auto& context : worker_sessions)
+            {
+                context.session = nullptr;
+            }
+        }
+
+        slang::IGlobalSession* globalSessionForThisThread()
+        {
+            const uint32_t worker = JobSystem::WorkerIndex();
+            if (worker == JobSystem::NOT_A_WORKER || worker >= worker_sessions.size())
+            {
+                return global_session;
+            }
+
+            WorkerSession& context = worker_sessions[worker];
+            if (!context.global_session)
+            {
+                slang::createGlobalSession(context.global_session.writeRef());
+            }
+            return context.global_session;
+        }
+
+        /**
+         * Compiles one shader (or loads it from the cache) without touching CompiledShaderCode, safe to call from
+         * several threads with different sessions. Reads the source on the calling thread
+         * @param name shader file name
+         * @param directory directory it's in
+         * @param session Slang session owned by the calling thread
+         * @param use_loaded return the entry in CompiledShaderCode if it is up to date-- only when nothing writes it concurrently
+         * @param features sorted feature constants to enable, see getShaderVariant
+         * @return compiled shader, error set on failure
+         */
+        CompiledShader buildShader(const std::string& name, const std::string& directory, slang::ISession* session, bool use_loaded = true,
+                                   const std::vector<std::string>& features = {}) const
+        {
+            auto source = readShaderSource(directory + "/" + name);
+            if (!source)
+            {
+                return CompiledShader(CompiledShader::eFailedToOpen);
+            }
+            return buildShaderFromSource(name, directory, std::move(source.value()), std::nullopt, session, use_loaded, features);
+        }
+
+        /**
+         * buildShader once the files are in memory
+         * @param name shader file name
+         * @param directory directory it's in
+         * @param source shader source
+         * @param cache_entry bytes of the shader's cache file if they were already read (empty: there is none),
+         * nullopt to read it here
+         * @param session Slang session owned by the calling thread
+         * @param use_loaded see buildShader
+         * @param features sorted feature constants to enable, see getShaderVariant
+         * @return compiled shader, error set on failure
+         */
+        CompiledShader buildShaderFromSource(const std::string& name, const std::string& directory, std::string source,
+                                             std::optional<std::span<const uint8_t>> cache_entry, slang::ISession* session,
+                                             bool use_loaded = true, const std::vector<std::string>& features = {}) const
         {
             //check to ensure it's a proper slang file and get the raw filename to save metadata
             std::string raw_filename = stripSlangFileExtension(name);
+            const std::string variant = variantName(name, features);
+            const std::string cache_filename = variantCacheName(raw_filename, features);
             
             Slang::ComPtr<slang::IModule> slang_module;
             
             std::string updated_path = directory + "/" +  name;
-            
-            //1. Try to get shader source from path
-            //TODO: Replace this with I/O handler
-            auto source = readShaderSource(updated_path);
-            if (!source)
+
+            //1.5 Warm cache-- skips Slang entirely
+            const std::string cache_directory = cacheDirectoryFor(directory);
+            std::vector<std::string> dependencies;
+            uint64_t cache_key = computeCacheKey(source, directory, &dependencies);
+            for (const auto& feature : features)
             {
-                return CompiledShader(CompiledShader::eFailedToOpen);
+                cache_key = AngelBase::Core::Hash::fnv1a64(feature, AngelBase::Core::Hash::combine(cache_key, feature.size()));
+            }
+            std::error_code ec;
+            const auto last_edited = std::filesystem::last_write_time(updated_path, ec);
+            if (use_loaded)
+            {
+                // only written between batches, so reading it here is fine
+                auto cached = CompiledShaderCode.find(variant);
+                if (cached != CompiledShaderCode.end() && cached->second.source_hash == cache_key)
+                {
+                    return cached->second;
+                }
+            }
+            {
+                CompiledShader cached = {};
+                const bool hit = disk_cache_enabled &&
+                    (cache_entry ? parseCacheEntry(*cache_entry, cache_key, cached)
+                                 : readCacheEntry(cache_directory, cache_filename, cache_key, cached));
+                if (hit)
+                {
+                    cached.error = CompiledShader::eSuccess;
+                    cached.name = variant;
+                    cached.features = features;
+                    cached.source = std::move(source);
+                    cached.source_hash = cache_key;
+                    cached.last_edited = last_edited;
+                    cached.from_cache = true;
+                    cached.dependencies = std::move(dependencies);
+                    return cached;
+                }
             }
 
             //2. Load shader module for compiling
             Slang::ComPtr<slang::IBlob> diagnostics_blob;
             {
-                slang_module = slang_session->loadModuleFromSourceString(
+                slang_module = session->loadModuleFromSourceString(
                     raw_filename.c_str(),
                     updated_path.c_str(),
-                    // there is an option without src string but I think we should use this for now
-                    // this allows us to change this out for our own I/O system who can get the relevant data without blocking.
-                    //TODO: make a loading system that will handle I/O without blocking
-                    source->c_str(),
+                    // from a string so the source can come from the FileLoaderSystem (compileShaders)
+                    source.c_str(),
                     diagnostics_blob.writeRef());
                 diagnoseIfNeeded(diagnostics_blob);
                 
@@ -186,9 +1100,54 @@ namespace Rendering
             }
             
 
-            //3. Get Target Code-- does all the steps for us
+            //2.5 Feature constants-- a generated module defining every extern the shader declares, linked in next to it
+            Slang::ComPtr<slang::IModule> constants_module;
+            const std::vector<std::string> constants = findFeatureConstants(source);
+            for (const auto& feature : features)
+            {
+                if (!std::ranges::contains(constants, feature))
+                {
+                    std::cerr << name << " has no feature constant " << feature << ", ignoring it" << std::endl;
+                }
+            }
+            if (!constants.empty())
+            {
+                std::string constants_source;
+                for (const auto& constant : constants)
+                {
+                    constants_source += "export static const bool " + constant + " = " +
+                                        (std::ranges::contains(features, constant) ? "true" : "false") + ";\n";
+                }
+                const std::string constants_name = cache_filename + "_features";
+                constants_module = session->loadModuleFromSourceString(
+                    constants_name.c_str(),
+                    (constants_name + ".slang").c_str(),
+                    constants_source.c_str(),
+                    diagnostics_blob.writeRef());
+                diagnoseIfNeeded(diagnostics_blob);
+                if (constants_module.get() == nullptr)
+                {
+                    return CompiledShader(CompiledShader::eFailedToLoad);
+                }
+            }
+
+            //3. Get Target Code-- does all the steps for us. With feature constants the module can't stand alone,
+            // so the code comes from the program linked together with them
             Slang::ComPtr<ISlangBlob> spirv;
-            slang_module->getTargetCode(0, spirv.writeRef(), diagnostics_blob.writeRef());
+            Slang::ComPtr<slang::IComponentType> linked_program;
+            if (constants_module)
+            {
+                linked_program = linkProgram(session, slang_module, constants_module);
+                if (linked_program.get() == nullptr)
+                {
+                    return CompiledShader(CompiledShader::eFailedToLinkShader);
+                }
+                linked_program->getTargetCode(0, spirv.writeRef(), diagnostics_blob.writeRef());
+            }
+            else
+            {
+                slang_module->getTargetCode(0, spirv.writeRef(), diagnostics_blob.writeRef());
+            }
             diagnoseIfNeeded(diagnostics_blob);
             if (spirv.get() == nullptr)
             {
@@ -196,14 +1155,15 @@ namespace Rendering
             }
 
             //Link Shader specifically for reflection
-            Slang::ComPtr<slang::IComponentType> linked_program;
-            slang_module.get()->link(linked_program.writeRef(), diagnostics_blob.writeRef());
+            if (!linked_program)
+            {
+                linked_program = linkProgram(session, slang_module, nullptr);
+            }
             if (linked_program.get() == nullptr)
             {
                 return CompiledShader(CompiledShader::eFailedToLinkShader);
             }
-            ShaderReflection shader_reflection = getReflectionData(slang_module);
-            writeJsonFile(raw_filename, directory + "/cache", shader_reflection.raw_json);
+            ShaderReflection shader_reflection = getReflectionData(linked_program);
 
             
             //TODO:perhaps a simpler way to do this with GetTargetCode
@@ -260,19 +1220,42 @@ namespace Rendering
             //
             CompiledShader result = {};
             result.error = CompiledShader::eSuccess;
-            result.name = name;
-            result.source = source.value();
-            
-            result.spirv_code = spirv;
-            saveSpirvToFile(spirv, directory + "/cache",raw_filename);
-            
-            std::cout << source.value() << std::endl;
+            result.name = variant;
+            result.features = features;
+            result.source = source;
+            result.source_hash = cache_key;
+            result.last_edited = last_edited;
+            result.dependencies = std::move(dependencies);
+            result.reflection_data = std::move(shader_reflection);
 
-            CompiledShaderCode.emplace(result.name, std::move(result));
-            
-            return CompiledShaderCode[name];
+            // copy out of the blob-- it goes away with this scope
+            const size_t word_count = spirv->getBufferSize() / sizeof(uint32_t);
+            const uint32_t* words = static_cast<const uint32_t*>(spirv->getBufferPointer());
+            result.spirv_code.assign(words, words + word_count);
+
+            //4. Optional spirv-opt pass, keeps the unoptimized code if it fails
+            result.unoptimized_stats = SpirvStats::measure(result.spirv_code);
+            if (!optimizeSpirv(result.spirv_code, spirv_optimization, strip_debug_info))
+            {
+                std::cerr << "spirv-opt failed on " << variant << ", using unoptimized SPIR-V" << std::endl;
+            }
+            result.stats = SpirvStats::measure(result.spirv_code);
+
+            if (!writeCacheEntry(cache_directory, cache_filename, result))
+            {
+                std::cerr << "Failed to write shader cache for " << variant << std::endl;
+            }
+
+            return result;
+        }
+
+        std::string cacheDirectoryFor(const std::string& directory) const
+        {
+            return cache_directory_override.empty() ? directory + "/cache" : cache_directory_override;
         }
 
+    public:
+
         static std::string stripSlangFileExtension(const std::string& name)
         {
             std::string raw_name;
@@ -288,66 +1271,327 @@ namespace Rendering
             return raw_name;
         }
 
-        //I'm not certain how useful this is-- we can always just cache the pipelines and descriptors
-        // temp pasting of raw json
-        bool writeJsonFile(const std::string& raw_filename, const std::string& path, const std::string& raw)
+        void updateOptionsHash()
+        {
+            // everything that changes the generated code goes into every cache key
+            using namespace AngelBase::Core;
+            options_hash = Hash::fnv1a64(profile_name);
+            options_hash = Hash::fnv1a64(std::string_view(global_session->getBuildTagString()), options_hash);
+            options_hash = Hash::combine(options_hash, static_cast<uint64_t>(SLANG_MATRIX_LAYOUT_COLUMN_MAJOR));
+            for (const auto& option : compilerOptions())
+            {
+                options_hash = Hash::combine(options_hash, static_cast<uint64_t>(option.name));
+                options_hash = Hash::combine(options_hash, static_cast<uint64_t>(option.value.kind));
+                options_hash = Hash::combine(options_hash, static_cast<uint64_t>(option.value.intValue0));
+                options_hash = Hash::combine(options_hash, static_cast<uint64_t>(option.value.intValue1));
+                options_hash = Hash::fnv1a64(std::string_view(option.value.stringValue0 ? option.value.stringValue0 : ""), options_hash);
+                options_hash = Hash::fnv1a64(std::string_view(option.value.stringValue1 ? option.value.stringValue1 : ""), options_hash);
+            }
+            options_hash = Hash::combine(options_hash, static_cast<uint64_t>(spirv_optimization));
+            options_hash = Hash::combine(options_hash, strip_debug_info);
+#if ANGELBASE_SPIRV_OPT
+            // same recipe name, different optimizer-- different binary
+            options_hash = Hash::combine(options_hash, 1);
+#endif
+        }
+
+        /**
+         * Runs spirv-opt over the code in place. Without SPIRV-Tools (ANGELBASE_SPIRV_OPT) this is a no-op
+         * @param code SPIR-V words, replaced on success
+         * @param optimization recipe to run
+         * @param strip_debug strip debug and non semantic instructions
+         * @return false if the optimizer rejected the module-- code is left untouched
+         */
+        static bool optimizeSpirv(std::vector<uint32_t>& code, SpirvOptimization optimization, bool strip_debug)
         {
-            std::filesystem::path p (path);
-            if (!std::filesystem::exists(p))
+            if (optimization == SpirvOptimization::None && !strip_debug) return true;
+#if ANGELBASE_SPIRV_OPT
+            // spirv_1_5 profile -> Vulkan 1.2 environment
+            spvtools::Optimizer optimizer(SPV_ENV_VULKAN_1_2);
+            optimizer.SetMessageConsumer([](spv_message_level_t level, const char*, const spv_position_t&, const char* message)
             {
-                if (!std::filesystem::create_directories(p))
+                if (level <= SPV_MSG_ERROR)
                 {
-                    return false;
+                    std::cerr << "spirv-opt: " << message << std::endl;
                 }
+            });
+            if (strip_debug)
+            {
+                optimizer.RegisterPass(spvtools::CreateStripDebugInfoPass());
+                optimizer.RegisterPass(spvtools::CreateStripNonSemanticInfoPass());
+            }
+            switch (optimization)
+            {
+            case SpirvOptimization::Performance:
+                optimizer.RegisterPerformancePasses();
+                break;
+            case SpirvOptimization::Size:
+                optimizer.RegisterSizePasses();
+                break;
+            case SpirvOptimization::None:
+                break;
             }
-            std::filesystem::path full_path = p / (raw_filename + ".json");
 
-            std::ofstream file(full_path, std::ios::binary);
-            if (!file.is_open())
+            std::vector<uint32_t> optimized;
+            if (!optimizer.Run(code.data(), code.size(), &optimized))
             {
                 return false;
             }
-
-            file.write(raw.data(), raw.size());
-    
-            file.close();
+            code = std::move(optimized);
+            return true;
+#else
+            static std::once_flag warned;
+            std::call_once(warned, []
+            {
+                std::cerr << "ShaderManager: built without SPIRV-Tools, SPIR-V is not optimized" << std::endl;
+            });
             return true;
+#endif
         }
 
-        bool saveSpirvToFile(ISlangBlob* spir_v_code,
-                     const std::string& output_dir,
-                     const std::string& raw_filename)
+        /**
+         * Hashes the source and, recursively, every file it imports or includes from the same directory.
+         * Combined with the profile and compiler options from initialize
+         * @param source shader source
+         * @param directory directory imports are resolved against
+         * @param dependencies optional, receives the resolved files relative to directory
+         * @return cache key
+         */
+        uint64_t computeCacheKey(const std::string& source, const std::string& directory, std::vector<std::string>* dependencies = nullptr) const
         {
-            
-            namespace fs = std::filesystem;
-    
-            if (!spir_v_code) {
-                return false;
+            using namespace AngelBase::Core;
+            uint64_t key = Hash::combine(options_hash, SHADER_CACHE_VERSION);
+            key = Hash::fnv1a64(source, key);
+
+            std::unordered_set<std::string> visited;
+            std::vector<std::string> pending = findShaderDependencies(source);
+            while (!pending.empty())
+            {
+                std::string dependency = std::move(pending.back());
+                pending.pop_back();
+                if (!visited.insert(dependency).second) continue;
+
+                // missing files still change the key, so adding one later invalidates the entry
+                key = Hash::fnv1a64(dependency, key);
+                std::filesystem::path path = resolveShaderDependency(directory, dependency);
+                if (path.empty()) continue;
+                if (dependencies)
+                {
+                    dependencies->push_back(std::filesystem::path(path).lexically_relative(directory).generic_string());
+                }
+
+                auto dependency_source = readShaderSource(path.string());
+                if (!dependency_source) continue;
+                key = Hash::fnv1a64(dependency_source.value(), key);
+                for (auto& nested : findShaderDependencies(dependency_source.value()))
+                {
+                    pending.push_back(std::move(nested));
+                }
             }
-    
-            // Create directory if it doesn't exist
-            fs::path dir_path(output_dir);
-            if (!fs::exists(dir_path)) {
-                if (!fs::create_directories(dir_path)) {
-                    return false;
+            return key;
+        }
+
+        /**
+         * Scans for `import x;`, `__include x;` and `#include "x"`. Doesn't need to be exact-- a false positive
+         * only adds a name to the key
+         * @param source shader source
+         * @return module names / include paths as written
+         */
+        static std::vector<std::string> findShaderDependencies(std::string_view source)
+        {
+            std::vector<std::string> dependencies;
+            for (auto line_range : std::views::split(source, '\n'))
+            {
+                std::string_view line(line_range.begin(), line_range.end());
+                line.remove_prefix(std::min(line.find_first_not_of(" \t"), line.size()));
+
+                std::string_view rest;
+                for (std::string_view keyword : {"import ", "__include ", "#include "})
+                {
+                    if (line.starts_with(keyword))
+                    {
+                        rest = line.substr(keyword.size());
+                        break;
+                    }
+                }
+                if (rest.empty()) continue;
+
+                rest.remove_prefix(std::min(rest.find_first_not_of(" \t\"<"), rest.size()));
+                rest = rest.substr(0, rest.find_first_of(";\">\r \t"));
+                if (!rest.empty())
+                {
+                    dependencies.emplace_back(rest);
                 }
             }
-            
-            // Construct full file path
-            fs::path file_path = dir_path / (raw_filename + ".spv");
-    
-            // Open file in binary mode
-            std::ofstream file(file_path, std::ios::binary);
-            if (!file.is_open()) {
+            return dependencies;
+        }
+
+        /**
+         * Scans for `extern static const bool NAME;`, the feature constants a variant can switch on
+         * @param source shader source
+         * @return constant names in declaration order
+         */
+        static std::vector<std::string> findFeatureConstants(std::string_view source)
+        {
+            constexpr std::string_view declaration = "extern static const bool ";
+            std::vector<std::string> constants;
+            for (auto line_range : std::views::split(source, '\n'))
+            {
+                std::string_view line(line_range.begin(), line_range.end());
+                line.remove_prefix(std::min(line.find_first_not_of(" \t"), line.size()));
+                if (!line.starts_with(declaration)) continue;
+
+                std::string_view rest = line.substr(declaration.size());
+                rest.remove_prefix(std::min(rest.find_first_not_of(" \t"), rest.size()));
+                rest = rest.substr(0, rest.find_first_of(";=\r \t"));
+                if (!rest.empty() && !std::ranges::contains(constants, rest))
+                {
+                    constants.emplace_back(rest);
+                }
+            }
+            return constants;
+        }
+
+        /**
+         * Cache file name of a variant-- the base shader keeps <raw_filename>, variants get the hash of their feature
+         * set appended so they don't overwrite each other
+         * @param raw_filename shader name without extension
+         * @param features sorted feature set
+         */
+        static std::string variantCacheName(const std::string& raw_filename, const std::vector<std::string>& features)
+        {
+            if (features.empty()) return raw_filename;
+            uint64_t hash = 0;
+            for (const auto& feature : features)
+            {
+                hash = AngelBase::Core::Hash::fnv1a64(feature, AngelBase::Core::Hash::combine(hash, feature.size()));
+            }
+            return std::format("{}.{:016x}", raw_filename, hash);
+        }
+
+        /**
+         * Maps an import to a file the way Slang does: dots are directories, underscores may be dashes
+         * @return path to the file, or empty if it isn't in directory (e.g. the standard library)
+         */
+        static std::filesystem::path resolveShaderDependency(const std::string& directory, const std::string& dependency)
+        {
+            namespace fs = std::filesystem;
+            if (dependency.ends_with(".slang") || dependency.ends_with(".h") || dependency.ends_with(".slangh"))
+            {
+                fs::path path = fs::path(directory) / dependency;
+                return fs::exists(path) ? path : fs::path();
+            }
+
+            std::string module_path = dependency;
+            std::ranges::replace(module_path, '.', '/');
+            fs::path path = fs::path(directory) / (module_path + ".slang");
+            if (fs::exists(path)) return path;
+
+            std::ranges::replace(module_path, '_', '-');
+            path = fs::path(directory) / (module_path + ".slang");
+            return fs::exists(path) ? path : fs::path();
+        }
+
+        /**
+         * Loads <raw_filename>.shadercache if it was written for this key
+         * @param output_dir cache directory
+         * @param raw_filename shader name without extension, see variantCacheName
+         * @param key expected cache key
+         * @param out receives SPIR-V and reflection on a hit
+         * @return true on a hit
+         */
+        bool readCacheEntry(const std::string& output_dir, const std::string& raw_filename, uint64_t key, CompiledShader& out) const
+        {
+            std::ifstream file(cacheEntryPath(output_dir, raw_filename), std::ios::binary | std::ios::ate);
+            if (!file.is_open()) return false;
+
+            std::vector<uint8_t> bytes(static_cast<size_t>(file.tellg()));
+            file.seekg(0, std::ios::beg);
+            file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+            return file && parseCacheEntry(bytes, key, out);
+        }
+
+        /**
+         * Same as readCacheEntry for a cache file that is already in memory
+         * @param bytes whole .shadercache file
+         * @param key expected cache key
+         * @param out receives SPIR-V and reflection on a hit
+         * @return true on a hit
+         */
+        static bool parseCacheEntry(std::span<const uint8_t> bytes, uint64_t key, CompiledShader& out)
+        {
+            ShaderCacheHeader header = {};
+            if (bytes.size() < sizeof(header)) return false;
+            std::memcpy(&header, bytes.data(), sizeof(header));
+            if (header.magic != SHADER_CACHE_MAGIC || header.version != SHADER_CACHE_VERSION ||
+                header.key != key || header.spirv_size == 0 || header.spirv_size % sizeof(uint32_t) != 0 ||
+                bytes.size() - sizeof(header) != header.spirv_size + header.reflection_size)
+            {
                 return false;
             }
-    
-            // Write SPIR-V data directly from blob
-            file.write(static_cast<const char*>(spir_v_code->getBufferPointer()),
-                       spir_v_code->getBufferSize());
-    
-            file.close();
-            return true;
+
+            const uint8_t* spirv = bytes.data() + sizeof(header);
+            out.spirv_code.resize(header.spirv_size / sizeof(uint32_t));
+            std::memcpy(out.spirv_code.data(), spirv, header.spirv_size);
+            out.stats = SpirvStats::measure(out.spirv_code);
+            out.unoptimized_stats.size_bytes = static_cast<size_t>(header.unoptimized_size);
+            out.unoptimized_stats.instruction_count = static_cast<uint32_t>(header.unoptimized_instruction_count);
+            return out.reflection_data.deserialize(std::span(spirv + header.spirv_size, header.reflection_size));
+        }
+
+        static std::filesystem::path cacheEntryPath(const std::string& output_dir, const std::string& raw_filename)
+        {
+            return std::filesystem::path(output_dir) / (raw_filename + ".shadercache");
+        }
+
+        /**
+         * Writes <raw_filename>.shadercache. Goes through a temp file so a crash never leaves a torn entry behind
+         * @param output_dir cache directory, created if missing
+         * @param raw_filename shader name without extension, see variantCacheName
+         * @param shader compiled shader with source_hash set
+         * @return false if the file couldn't be written
+         */
+        bool writeCacheEntry(const std::string& output_dir, const std::string& raw_filename, const CompiledShader& shader) const
+        {
+            namespace fs = std::filesystem;
+            std::error_code ec;
+            fs::create_directories(output_dir, ec);
+
+            const fs::path file_path = cacheEntryPath(output_dir, raw_filename);
+            fs::path temp_path = file_path;
+            temp_path += ".tmp";
+            {
+                std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+                if (!file.is_open()) return false;
+
+                std::vector<uint8_t> reflection;
+                shader.reflection_data.serialize(reflection);
+
+                ShaderCacheHeader header = {};
+                header.magic = SHADER_CACHE_MAGIC;
+                header.version = SHADER_CACHE_VERSION;
+                header.key = shader.source_hash;
+                header.spirv_size = shader.spirv_code.size() * sizeof(uint32_t);
+                header.reflection_size = reflection.size();
+                header.unoptimized_size = shader.unoptimized_stats.size_bytes;
+                header.unoptimized_instruction_count = shader.unoptimized_stats.instruction_count;
+                file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                file.write(reinterpret_cast<const char*>(shader.spirv_code.data()), static_cast<std::streamsize>(header.spirv_size));
+                file.write(reinterpret_cast<const char*>(reflection.data()), static_cast<std::streamsize>(header.reflection_size));
+                if (!file) return false;
+            }
+            fs::rename(temp_path, file_path, ec);
+            return !ec;
+        }
+
+        /**
+         * @param name shader file name, e.g. "shader.slang"
+         * @return compiled shader, nullptr if it hasn't been compiled
+         */
+        const CompiledShader* getShader(const std::string& name) const
+        {
+            auto it = CompiledShaderCode.find(name);
+            return it != CompiledShaderCode.end() ? &it->second : nullptr;
         }
 
         CompiledShader recompileShader(const std::string& name, const std::string& path)
@@ -381,49 +1625,292 @@ namespace Rendering
             if (it == CompiledShaderCode.end()) return VK_NULL_HANDLE;
 
             vk::ShaderModuleCreateInfo createInfo = {};
-            createInfo.codeSize = it->second.spirv_code->getBufferSize();
-            createInfo.pCode = static_cast<const uint32_t*>(it->second.spirv_code->getBufferPointer());
+            createInfo.codeSize = it->second.spirv_code.size() * sizeof(uint32_t);
+            createInfo.pCode = it->second.spirv_code.data();
 
             vk::ShaderModule shaderModule = device.createShaderModule(createInfo);
             return shaderModule;
         }
 
-        ShaderReflection getReflectionData(slang::IModule* module)
+        /**
+         * Composes the module with all its entry points (and the feature constants, if any) and links it
+         * @param session session the modules were loaded in
+         * @param module loaded module
+         * @param constants generated feature constant module, may be null
+         * @return linked program, null on failure
+         */
+        static Slang::ComPtr<slang::IComponentType> linkProgram(slang::ISession* session, slang::IModule* module, slang::IModule* constants)
         {
-            
+            // the ComPtrs own the references getDefinedEntryPoint hands out
+            std::vector<Slang::ComPtr<slang::IEntryPoint>> entry_points(module->getDefinedEntryPointCount());
             std::vector<slang::IComponentType*> components = {module};
-            
-            for (uint32_t i = 0; i < module->getDefinedEntryPointCount(); i++)
+            if (constants)
             {
-                slang::IEntryPoint* point = nullptr;
-                module->getDefinedEntryPoint(i, &point);
-                components.emplace_back(point);
+                components.emplace_back(constants);
+            }
+            for (uint32_t i = 0; i < entry_points.size(); i++)
+            {
+                module->getDefinedEntryPoint(i, entry_points[i].writeRef());
+                components.emplace_back(entry_points[i]);
             }
 
+            Slang::ComPtr<slang::IBlob> diagnostics_blob;
             Slang::ComPtr<slang::IComponentType> composedProgram;
-            slang_session->createCompositeComponentType(
+            session->createCompositeComponentType(
                 components.data(), components.size(),
-                composedProgram.writeRef());
+                composedProgram.writeRef(), diagnostics_blob.writeRef());
+            diagnoseIfNeeded(diagnostics_blob);
+            if (!composedProgram) return nullptr;
 
             Slang::ComPtr<slang::IComponentType> linkedProgram;
-            composedProgram->link(linkedProgram.writeRef());
-            
+            composedProgram->link(linkedProgram.writeRef(), diagnostics_blob.writeRef());
+            diagnoseIfNeeded(diagnostics_blob);
+            return linkedProgram;
+        }
+
+        /**
+         * Walks the Slang reflection of a linked program into ShaderReflection. \n
+         * Globals are assumed visible to every stage in the module, entry point parameters only to their own stage--
+         * entry point uniforms are push constants on Vulkan
+         * @param linkedProgram program from linkProgram
+         * @return reflection
+         */
+        static ShaderReflection getReflectionData(slang::IComponentType* linkedProgram)
+        {
             ShaderReflection reflection = {};
-            ISlangBlob* test;
-            linkedProgram->getLayout()->toJson(&test);
+            slang::ProgramLayout* layout = linkedProgram->getLayout();
+            if (!layout) return reflection;
+
+            vk::ShaderStageFlags all_stages = {};
+            for (SlangUInt i = 0; i < layout->getEntryPointCount(); ++i)
+            {
+                all_stages |= toVulkanStage(layout->getEntryPointByIndex(i)->getStage());
+            }
 
-            const char* jsonData = static_cast<const char*>(test->getBufferPointer());
-            size_t jsonSize = test->getBufferSize();
+            for (unsigned i = 0; i < layout->getParameterCount(); ++i)
+            {
+                reflectParameter(reflection, layout->getParameterByIndex(i), all_stages);
+            }
 
-            reflection.raw_json = std::string(jsonData, jsonData + jsonSize);
-            
+            for (SlangUInt i = 0; i < layout->getEntryPointCount(); ++i)
+            {
+                slang::EntryPointReflection* entry_point = layout->getEntryPointByIndex(i);
+                const vk::ShaderStageFlags stage = toVulkanStage(entry_point->getStage());
+                const char* entry_name = entry_point->getNameOverride() ? entry_point->getNameOverride() : entry_point->getName();
+                reflection.entryPoints.push_back({entry_name ? entry_name : "main",
+                                                  static_cast<vk::ShaderStageFlagBits>(static_cast<uint32_t>(stage))});
+                for (unsigned p = 0; p < entry_point->getParameterCount(); ++p)
+                {
+                    slang::VariableLayoutReflection* parameter = entry_point->getParameterByIndex(p);
+                    if (entry_point->getStage() == SLANG_STAGE_VERTEX &&
+                        parameter->getCategory() == slang::ParameterCategory::VaryingInput)
+                    {
+                        reflectVertexInput(reflection, parameter, 0);
+                        continue;
+                    }
+                    reflectParameter(reflection, parameter, stage);
+                }
+            }
             return reflection;
         }
 
+        static vk::ShaderStageFlags toVulkanStage(SlangStage stage)
+        {
+            switch (stage)
+            {
+            case SLANG_STAGE_VERTEX:         return vk::ShaderStageFlagBits::eVertex;
+            case SLANG_STAGE_HULL:           return vk::ShaderStageFlagBits::eTessellationControl;
+            case SLANG_STAGE_DOMAIN:         return vk::ShaderStageFlagBits::eTessellationEvaluation;
+            case SLANG_STAGE_GEOMETRY:       return vk::ShaderStageFlagBits::eGeometry;
+            case SLANG_STAGE_FRAGMENT:       return vk::ShaderStageFlagBits::eFragment;
+            case SLANG_STAGE_COMPUTE:        return vk::ShaderStageFlagBits::eCompute;
+            case SLANG_STAGE_RAY_GENERATION: return vk::ShaderStageFlagBits::eRaygenKHR;
+            case SLANG_STAGE_INTERSECTION:   return vk::ShaderStageFlagBits::eIntersectionKHR;
+            case SLANG_STAGE_ANY_HIT:        return vk::ShaderStageFlagBits::eAnyHitKHR;
+            case SLANG_STAGE_CLOSEST_HIT:    return vk::ShaderStageFlagBits::eClosestHitKHR;
+            case SLANG_STAGE_MISS:           return vk::ShaderStageFlagBits::eMissKHR;
+            case SLANG_STAGE_CALLABLE:       return vk::ShaderStageFlagBits::eCallableKHR;
+            case SLANG_STAGE_MESH:           return vk::ShaderStageFlagBits::eMeshEXT;
+            case SLANG_STAGE_AMPLIFICATION:  return vk::ShaderStageFlagBits::eTaskEXT;
+            default:                         return {};
+            }
+        }
+
+        /**
+         * Sorts one global or entry point parameter into uniform buffers, textures or push constants
+         */
+        static void reflectParameter(ShaderReflection& reflection, slang::VariableLayoutReflection* parameter, vk::ShaderStageFlags stages)
+        {
+            slang::TypeLayoutReflection* type_layout = parameter->getTypeLayout();
+            if (!type_layout) return;
+            const char* name = parameter->getName() ? parameter->getName() : "";
+
+            // plain uniforms on an entry point (e.g. `uniform ShaderData* data`), and [[vk::push_constant]] blocks
+            if (parameter->getCategory() == slang::ParameterCategory::Uniform ||
+                parameter->getCategory() == slang::ParameterCategory::PushConstantBuffer)
+            {
+                slang::TypeLayoutReflection* data_layout = type_layout;
+                if (type_layout->getKind() == slang::TypeReflection::Kind::ConstantBuffer)
+                {
+                    data_layout = type_layout->getElementTypeLayout();
+                }
+                ShaderReflection::PushConstant constant = {};
+                constant.name = name;
+                constant.offset = parameter->getOffset(slang::ParameterCategory::Uniform);
+                constant.size = data_layout->getSize(slang::ParameterCategory::Uniform);
+                constant.stages = stages;
+                if (constant.size > 0)
+                {
+                    reflection.pushConstants.push_back(std::move(constant));
+                }
+                return;
+            }
+
+            uint32_t count = 1;
+            slang::TypeLayoutReflection* element_layout = type_layout;
+            if (type_layout->getKind() == slang::TypeReflection::Kind::Array)
+            {
+                const size_t elements = type_layout->getElementCount();
+                count = elements == SLANG_UNBOUNDED_SIZE || elements == 0 ? ShaderReflection::UNBOUNDED : static_cast<uint32_t>(elements);
+                element_layout = type_layout->getElementTypeLayout();
+            }
+
+            switch (element_layout->getKind())
+            {
+            case slang::TypeReflection::Kind::ConstantBuffer:
+            case slang::TypeReflection::Kind::ParameterBlock:
+            {
+                ShaderReflection::UniformBuffer buffer = {};
+                buffer.name = name;
+                buffer.binding = parameter->getBindingIndex();
+                buffer.set = parameter->getBindingSpace();
+                buffer.stages = stages;
+                slang::TypeLayoutReflection* data_layout = element_layout->getElementTypeLayout();
+                buffer.size = data_layout ? data_layout->getSize(slang::ParameterCategory::Uniform) : 0;
+                for (unsigned f = 0; data_layout && f < data_layout->getFieldCount(); ++f)
+                {
+                    slang::VariableLayoutReflection* field = data_layout->getFieldByIndex(f);
+                    buffer.members.emplace_back(field->getName() ? field->getName() : "",
+                                                field->getOffset(slang::ParameterCategory::Uniform));
+                }
+                reflection.uniformBuffers.push_back(std::move(buffer));
+                break;
+            }
+            case slang::TypeReflection::Kind::Resource:
+            case slang::TypeReflection::Kind::SamplerState:
+            {
+                ShaderReflection::Texture texture = {};
+                texture.name = name;
+                texture.binding = parameter->getBindingIndex();
+                texture.set = parameter->getBindingSpace();
+                texture.count = count;
+                texture.stages = stages;
+                texture.type = ShaderReflection::TextureType::Sampled;
+                if (element_layout->getKind() == slang::TypeReflection::Kind::SamplerState)
+                {
+                    texture.type = ShaderReflection::TextureType::Sampler;
+                }
+                else if (element_layout->getBindingRangeCount() > 0)
+                {
+                    switch (element_layout->getBindingRangeType(0))
+                    {
+                    case slang::BindingType::CombinedTextureSampler:
+                        texture.type = ShaderReflection::TextureType::CombinedSampler;
+                        break;
+                    case slang::BindingType::MutableTexture:
+                        texture.type = ShaderReflection::TextureType::Storage;
+                        break;
+                    default:
+                        break;
+                    }
+                }
+                texture.isSampler = texture.type == ShaderReflection::TextureType::Sampler;
+                reflection.textures.push_back(std::move(texture));
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+        /**
+         * Flattens vertex shader inputs (structs included) into locations
+         */
+        static void reflectVertexInput(ShaderReflection& reflection, slang::VariableLayoutReflection* input, uint32_t base_location)
+        {
+            const char* semantic = input->getSemanticName();
+            if (semantic && std::string_view(semantic).starts_with("SV_"))
+            {
+                return;
+            }
+
+            slang::TypeLayoutReflection* type_layout = input->getTypeLayout();
+            const uint32_t location = base_location + static_cast<uint32_t>(input->getOffset(slang::ParameterCategory::VaryingInput));
+            if (type_layout->getKind() == slang::TypeReflection::Kind::Struct)
+            {
+                for (unsigned f = 0; f < type_layout->getFieldCount(); ++f)
+                {
+                    reflectVertexInput(reflection, type_layout->getFieldByIndex(f), location);
+                }
+                return;
+            }
+
+            ShaderReflection::VertexInput vertex_input = {};
+            vertex_input.name = input->getName() ? input->getName() : "";
+            vertex_input.location = location;
+            vertex_input.type = typeName(type_layout->getType());
+            reflection.vertexInputs.push_back(std::move(vertex_input));
+        }
+
+        /**
+         * @return HLSL style name, "float3", "uint", "float4x4"...
+         */
+        static std::string typeName(slang::TypeReflection* type)
+        {
+            if (!type) return {};
+            auto scalarName = [](slang::TypeReflection::ScalarType scalar) -> std::string
+            {
+                switch (scalar)
+                {
+                case slang::TypeReflection::ScalarType::Bool:    return "bool";
+                case slang::TypeReflection::ScalarType::Int32:   return "int";
+                case slang::TypeReflection::ScalarType::UInt32:  return "uint";
+                case slang::TypeReflection::ScalarType::Int64:   return "int64_t";
+                case slang::TypeReflection::ScalarType::UInt64:  return "uint64_t";
+                case slang::TypeReflection::ScalarType::Float16: return "half";
+                case slang::TypeReflection::ScalarType::Float32: return "float";
+                case slang::TypeReflection::ScalarType::Float64: return "double";
+                case slang::TypeReflection::ScalarType::Int16:   return "int16_t";
+                case slang::TypeReflection::ScalarType::UInt16:  return "uint16_t";
+                case slang::TypeReflection::ScalarType::Int8:    return "int8_t";
+                case slang::TypeReflection::ScalarType::UInt8:   return "uint8_t";
+                default:                                         return "unknown";
+                }
+            };
+
+            switch (type->getKind())
+            {
+            case slang::TypeReflection::Kind::Scalar:
+                return scalarName(type->getScalarType());
+            case slang::TypeReflection::Kind::Vector:
+                return scalarName(type->getElementType()->getScalarType()) + std::to_string(type->getElementCount());
+            case slang::TypeReflection::Kind::Matrix:
+                return scalarName(type->getElementType()->getScalarType()) + std::to_string(type->getRowCount()) + "x" + std::to_string(type->getColumnCount());
+            default:
+                return type->getName() ? type->getName() : "";
+            }
+        }
+
         ~ShaderManager()
         {
+            // background reloads use the sessions and write into this
+            shader_watcher.reset();
+            JobSystem::WaitForCounter(reload_jobs);
+            JobSystem::WaitForCounter(variant_jobs);
+            worker_sessions.clear();
+
             auto session = slang_session.detach();
-            session->release();
+            if (session) session->release();
             auto global = global_session.detach();
             global->release();
             clearCache();
@@ -431,7 +1918,44 @@ namespace Rendering
     private:
         Slang::ComPtr<slang::ISession> slang_session = nullptr;
         Slang::ComPtr<slang::IGlobalSession> global_session = nullptr;
+        // thread that uses slang_session and global_session, see resetSessions
+        std::thread::id owning_thread;
         std::unordered_map<std::string, CompiledShader> CompiledShaderCode;
+        // profile, Slang build and compiler options, set in initialize
+        uint64_t options_hash = 0;
+        std::string profile_name = "spirv_1_5";
+#ifdef _DEBUG
+        SpirvOptimization spirv_optimization = SpirvOptimization::None;
+        bool strip_debug_info = false;
+#else
+        SpirvOptimization spirv_optimization = SpirvOptimization::Performance;
+        bool strip_debug_info = true;
+#endif
+        bool disk_cache_enabled = true;
+        // see setCacheDirectory
+        std::string cache_directory_override;
+        // not owned, see setFileLoader
+        AngelBase::Core::FileLoaderSystem* file_loader = nullptr;
+
+        struct WorkerSession
+        {
+            Slang::ComPtr<slang::IGlobalSession> global_session;
+            Slang::ComPtr<slang::ISession> session;
+        };
+        // indexed by JobSystem::WorkerIndex()
+        std::vector<WorkerSession> worker_sessions;
+
+        // hot reload
+        std::unique_ptr<ShaderWatcher> shader_watcher;
+        std::string reload_directory;
+        Atomics::Counter reload_jobs;
+        std::vector<CompiledShader> reload_results;
+        bool reload_in_flight = false;
+
+        // background variant compiles, keyed by variantName
+        Atomics::Counter variant_jobs;
+        std::unordered_map<std::string, std::shared_ptr<VariantBuild>> variant_builds;
+        std::unordered_set<std::string> failed_variants;
     };
     
     
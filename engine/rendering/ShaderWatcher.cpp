@@ -0,0 +1,207 @@
+module;
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+#include <cstdint>
+export module ShaderWatcher;
+
+import std;
+
+namespace Rendering
+{
+    /**
+     * Watches a shader directory (and its subdirectories) for saved files on a background thread. \n
+     * Uses inotify on Linux, elsewhere it falls back to polling write times. Changes are debounced, since most editors
+     * save in several steps (truncate, write, rename)
+     */
+    export class ShaderWatcher
+    {
+    public:
+        ShaderWatcher() = delete;
+        /**
+         * @param directory root shader directory, changed paths are reported relative to it
+         */
+        explicit ShaderWatcher(const std::string& directory)
+            :root(directory)
+        {
+            watch_thread = std::thread(&ShaderWatcher::watchLoop, this);
+        }
+
+        ~ShaderWatcher()
+        {
+            stop.store(true, std::memory_order_release);
+            if (watch_thread.joinable())
+            {
+                watch_thread.join();
+            }
+        }
+
+        ShaderWatcher(const ShaderWatcher&) = delete;
+        ShaderWatcher& operator=(const ShaderWatcher&) = delete;
+
+        /**
+         * Takes every change that has settled since the last call
+         * @return paths relative to the root directory, '/' separated
+         */
+        std::vector<std::string> takeChanges()
+        {
+            std::lock_guard lock(changes_mutex);
+            std::vector<std::string> settled;
+            if (!changed.empty() && std::chrono::steady_clock::now() - last_change >= DEBOUNCE)
+            {
+                settled.assign(changed.begin(), changed.end());
+                changed.clear();
+            }
+            return settled;
+        }
+
+    private:
+        static constexpr std::chrono::milliseconds DEBOUNCE{50};
+        static constexpr std::chrono::milliseconds POLL_INTERVAL{100};
+
+        static bool isShaderFile(const std::filesystem::path& path)
+        {
+            const auto extension = path.extension();
+            return extension == ".slang" || extension == ".slangh" || extension == ".h";
+        }
+
+        void recordChange(const std::filesystem::path& path)
+        {
+            if (!isShaderFile(path)) return;
+            std::error_code ec;
+            std::string relative = std::filesystem::relative(path, root, ec).generic_string();
+            if (ec || relative.empty()) return;
+
+            std::lock_guard lock(changes_mutex);
+            changed.insert(std::move(relative));
+            last_change = std::chrono::steady_clock::now();
+        }
+
+        // the compiled output lives next to the sources, don't watch it
+        static bool isCacheDirectory(const std::filesystem::path& path)
+        {
+            return path.filename() == "cache";
+        }
+
+#ifdef __linux__
+        void watchLoop()
+        {
+            int notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (notify < 0)
+            {
+                std::cerr << "ShaderWatcher: inotify unavailable, falling back to polling" << std::endl;
+                pollLoop();
+                return;
+            }
+
+            std::unordered_map<int, std::filesystem::path> watched;
+            auto addWatch = [&](const std::filesystem::path& directory)
+            {
+                int wd = inotify_add_watch(notify, directory.c_str(),
+                                           IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+                if (wd >= 0) watched[wd] = directory;
+            };
+
+            std::error_code ec;
+            addWatch(root);
+            for (auto it = std::filesystem::recursive_directory_iterator(root, ec);
+                 it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+            {
+                if (ec) break;
+                if (!it->is_directory()) continue;
+                if (isCacheDirectory(it->path()))
+                {
+                    it.disable_recursion_pending();
+                    continue;
+                }
+                addWatch(it->path());
+            }
+
+            alignas(inotify_event) char buffer[4096];
+            while (!stop.load(std::memory_order_acquire))
+            {
+                pollfd descriptor = {notify, POLLIN, 0};
+                if (poll(&descriptor, 1, static_cast<int>(POLL_INTERVAL.count())) <= 0) continue;
+
+                ssize_t length = read(notify, buffer, sizeof(buffer));
+                for (ssize_t offset = 0; offset < length;)
+                {
+                    const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                    offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+
+                    auto directory = watched.find(event->wd);
+                    if (directory == watched.end() || event->len == 0) continue;
+
+                    std::filesystem::path path = directory->second / event->name;
+                    if ((event->mask & IN_ISDIR) && (event->mask & IN_CREATE) && !isCacheDirectory(path))
+                    {
+                        addWatch(path);
+                        continue;
+                    }
+                    recordChange(path);
+                }
+            }
+
+            for (const auto& [wd, directory] : watched)
+            {
+                inotify_rm_watch(notify, wd);
+            }
+            close(notify);
+        }
+#else
+        void watchLoop()
+        {
+            pollLoop();
+        }
+#endif
+
+        /**
+         * Portable fallback: compares write times of every shader file each interval
+         */
+        void pollLoop()
+        {
+            namespace fs = std::filesystem;
+            std::unordered_map<std::string, fs::file_time_type> write_times;
+            bool first_scan = true;
+            while (!stop.load(std::memory_order_acquire))
+            {
+                std::error_code ec;
+                for (auto it = fs::recursive_directory_iterator(root, ec); it != fs::recursive_directory_iterator(); it.increment(ec))
+                {
+                    if (ec) break;
+                    if (it->is_directory() && isCacheDirectory(it->path()))
+                    {
+                        it.disable_recursion_pending();
+                        continue;
+                    }
+                    if (!it->is_regular_file() || !isShaderFile(it->path())) continue;
+
+                    auto time = it->last_write_time(ec);
+                    auto [entry, inserted] = write_times.try_emplace(it->path().string(), time);
+                    if (!inserted && entry->second != time)
+                    {
+                        entry->second = time;
+                        recordChange(it->path());
+                    }
+                    else if (inserted && !first_scan)
+                    {
+                        recordChange(it->path());
+                    }
+                }
+                first_scan = false;
+                std::this_thread::sleep_for(POLL_INTERVAL * 2);
+            }
+        }
+
+        std::filesystem::path root;
+        std::thread watch_thread;
+        std::atomic<bool> stop = false;
+
+        std::mutex changes_mutex;
+        std::unordered_set<std::string> changed;
+        std::chrono::steady_clock::time_point last_change;
+    };
+}
@@ -10,6 +10,10 @@ import FileLoaderSystem;
 import ServiceLocator;
 import Atomics;
 import VulkanCommand;
+import VulkanTransfer;
+import VulkanDescriptors;
+import JsonParser;
+import AssetManifest;
 #define DEFAULT_TEXTURE_SIZE 512
 
 //TODO: have this happen async
@@ -21,27 +25,70 @@ namespace Rendering
         TextureManager() = delete;
         TextureManager(const Vulkan::Context& context)
             :m_context(context),
-            current_texture_index(0),
-            raw_texture_data(32, std::vector<unsigned char>(DEFAULT_TEXTURE_SIZE * DEFAULT_TEXTURE_SIZE))
+            current_texture_index(0)
         {
         }
 
-        void loadAllPaths()
+        /**
+         * Destroy before the device and the allocator. The bindless slots go away with the DescriptorManager
+         */
+        ~TextureManager()
         {
-            //read json for all relevant file paths
+            for (auto& texture : textures)
+            {
+                if (texture.view) m_context.device.destroyImageView(texture.view);
+                if (texture.image) vmaDestroyImage(m_context.vram_allocator, static_cast<VkImage>(texture.image), texture.allocation);
+            }
+            if (sampler) m_context.device.destroySampler(sampler);
         }
 
-        size_t loadTexture(const char* path)
+        /**
+         * Reads the texture list of an asset manifest and requests every texture in it
+         * @param manifest_path asset manifest, see AngelBase::Core::AssetManifest
+         * @return false if the manifest couldn't be loaded
+         */
+        bool loadAllPaths(const std::string& manifest_path = "../assets/manifest.json")
+        {
+            // the requests in flight point into the manifest's strings
+            texture_counter.wait_for_zero();
+            if (!manifest_parser.LoadJsonFile(manifest_path, asset_manifest))
+            {
+                return false;
+            }
+
+            for (const auto& texture : asset_manifest.textures)
+            {
+                loadTexture(texture.path.c_str(),
+                            texture.width ? texture.width : DEFAULT_TEXTURE_SIZE,
+                            texture.height ? texture.height : DEFAULT_TEXTURE_SIZE);
+            }
+            return true;
+        }
+
+        /**
+         * Requests a texture's raw RGBA8 texels
+         * @param path path to the file, must stay valid until the read completes
+         * @param width width in texels
+         * @param height height in texels
+         * @return index of the texture, see GetTextureSlot
+         */
+        size_t loadTexture(const char* path, uint32_t width = DEFAULT_TEXTURE_SIZE, uint32_t height = DEFAULT_TEXTURE_SIZE)
         {
-            //increment index and reserve the slot to prevent invalidation
             size_t index = current_texture_index++;
-            raw_texture_data.emplace_back();
+            // every texture gets a destination of its own, sized for the whole image-- growing the outer vector
+            // moves the inner vectors but not the buffers the reads in flight write into
+            if (raw_texture_data.size() <= index)
+            {
+                raw_texture_data.resize(index + 1);
+            }
+            raw_texture_data[index].resize(static_cast<size_t>(width) * height * 4);
+            texture_extents.push_back(vk::Extent3D{width, height, 1});
             {
                 auto fs = ServiceLocator::Instance()->Get<AngelBase::Core::FileLoaderSystem>();
                 AngelBase::Core::AsyncRequestHandle h =  fs->asyncReadFile(
                     path, 
                     raw_texture_data[index].data(), 
-                    DEFAULT_TEXTURE_SIZE,
+                    raw_texture_data[index].size(),
                     AngelBase::Core::AsyncFilePriority::Critical, 
                     texture_counter, 
                     nullptr);
@@ -52,20 +99,49 @@ namespace Rendering
             return index;
         }
 
+        /**
+         * Creates an image per loaded texture and records its copy on the transfer queue (UploadScheduler), staged
+         * through the StagingRing, then gives it a bindless slot (GetTextureSlot). Returns without waiting for the
+         * copies-- the frame that first samples the textures waits on GetUploadValue. Render thread only, it submits
+         * when the ring fills up
+         */
         void UploadTexturesToVRAM()
         {
             texture_counter.wait_for_zero();
-            
-            for (size_t i = 0; i < raw_texture_data.size(); ++i)
+            auto scheduler = ServiceLocator::Instance()->Get<Vulkan::UploadScheduler>();
+            auto staging_ring = ServiceLocator::Instance()->Get<Vulkan::StagingRing>();
+            auto descriptor_manager = ServiceLocator::Instance()->Get<Vulkan::DescriptorManager>();
+            if (!sampler)
+            {
+                // every texture is single mip and sampled the same way, so they share one sampler
+                vk::SamplerCreateInfo samplerCI{};
+                samplerCI.magFilter = vk::Filter::eLinear;
+                samplerCI.minFilter = vk::Filter::eLinear;
+                samplerCI.mipmapMode = vk::SamplerMipmapMode::eLinear;
+                samplerCI.addressModeU = vk::SamplerAddressMode::eRepeat;
+                samplerCI.addressModeV = vk::SamplerAddressMode::eRepeat;
+                samplerCI.addressModeW = vk::SamplerAddressMode::eRepeat;
+                samplerCI.maxLod = 1.0f;
+                if (m_context.device.createSampler(&samplerCI, nullptr, &sampler) != vk::Result::eSuccess)
+                {
+                    std::cerr << "Failed to create texture sampler!" << std::endl;
+                    sampler = nullptr;
+                }
+            }
+
+            const size_t first = textures.size();
+            textures.resize(texture_metadata.size());
+            for (size_t i = first; i < textures.size(); ++i)
             {
+                const vk::DeviceSize image_size = raw_texture_data[i].size();
                 vk::ImageCreateInfo texImgCI{};
                 texImgCI.imageType = vk::ImageType::e2D;
                 // .tga?
                 texImgCI.format = vk::Format::eB8G8R8A8Unorm;
-                // not correct we need to look at the base width and height of textures
-                texImgCI.extent = vk::Extent3D{DEFAULT_TEXTURE_SIZE, DEFAULT_TEXTURE_SIZE, 1};
+                texImgCI.extent = texture_extents[i];
                 // ? format dependent methinks
                 texImgCI.mipLevels = 1;
+                texImgCI.arrayLayers = 1;
                 texImgCI.samples = vk::SampleCountFlagBits::e1;
                 texImgCI.tiling = vk::ImageTiling::eOptimal;
                 texImgCI.usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
@@ -74,134 +150,89 @@ namespace Rendering
                 VmaAllocationCreateInfo texImageAllocCI {};
                 texImageAllocCI.usage = VMA_MEMORY_USAGE_AUTO;
 
-                vmaCreateImage(m_context.vram_allocator,
+                if (vmaCreateImage(m_context.vram_allocator,
                     reinterpret_cast<VkImageCreateInfo*>(&texImgCI), 
                     &texImageAllocCI,
                     reinterpret_cast<VkImage*>(&textures[i].image), 
                     &textures[i].allocation,
-                    nullptr);
+                    nullptr) != VK_SUCCESS)
+                {
+                    std::cerr << "Failed to create image for uploaded texture!" << std::endl;
+                    continue;
+                }
 
                 vk::ImageViewCreateInfo texViewCI{};
                 texViewCI.image = textures[i].image;
                 texViewCI.viewType = vk::ImageViewType::e2D;
                 texViewCI.format = texImgCI.format;
                 //custom mip levels per image
-                texViewCI.subresourceRange = vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1};
+                texViewCI.subresourceRange = vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1};
 
                 if (m_context.device.createImageView(&texViewCI, nullptr, &textures[i].view) != vk::Result::eSuccess)
                 {
                     std::cerr << "Image view has failed to be created for uploaded texture!" << std::endl;
+                    textures[i].view = nullptr;
+                    continue;
                 }
 
-                vk::Buffer image_source_buffer{};
-                VmaAllocation image_source_allocation{};
-                vk::BufferCreateInfo bufferCI{};
-                //get size of each individual texture's data
-                bufferCI.size = static_cast<uint32_t>(raw_texture_data[i].size());
-                bufferCI.usage = vk::BufferUsageFlagBits::eTransferSrc;
+                Vulkan::StagingRing::Allocation staging = staging_ring->Allocate(image_size);
+                if (!staging)
+                {
+                    // the ring is held by copies recorded since the last submit
+                    scheduler->Submit();
+                    staging = staging_ring->Allocate(image_size);
+                }
+                if (!staging)
+                {
+                    std::cerr << "Texture is larger than the staging ring!" << std::endl;
+                    continue;
+                }
+
+                // a short read leaves the rest of the (zero-initialised) destination as is
+                std::memcpy(staging.data, raw_texture_data[i].data(), image_size);
+                staging_ring->Flush(staging);
 
-                VmaAllocationCreateInfo imgSrcAllocCI{};
-                imgSrcAllocCI.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
-                imgSrcAllocCI.usage = VMA_MEMORY_USAGE_AUTO;
+                vk::BufferImageCopy region{};
+                region.bufferOffset = staging.offset;
+                region.imageSubresource = vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, 0, 0, 1};
+                region.imageExtent = texImgCI.extent;
+                const uint64_t value = scheduler->CopyBufferToImage(staging.buffer, textures[i].image, {&region, 1},
+                                                                    texViewCI.subresourceRange,
+                                                                    vk::ImageLayout::eShaderReadOnlyOptimal,
+                                                                    vk::PipelineStageFlagBits2::eFragmentShader);
+                staging_ring->Release(staging, value);
+                upload_value = std::max(upload_value, value);
 
-                if (vmaCreateBuffer(m_context.vram_allocator, reinterpret_cast<VkBufferCreateInfo*>(&bufferCI),
-                    &imgSrcAllocCI, reinterpret_cast<VkBuffer*>(&image_source_buffer),
-                    &image_source_allocation, nullptr) != VK_SUCCESS)
+                // written now, only sampled by frames that wait on upload_value
+                if (sampler && descriptor_manager)
                 {
-                    std::cerr << "Failed to create image buffer!" << std::endl;
+                    textures[i].sampler = sampler;
+                    textures[i].slot = descriptor_manager->addTexture(textures[i].view, sampler,
+                                                                      vk::ImageLayout::eShaderReadOnlyOptimal);
+                    if (textures[i].slot == Vulkan::DescriptorManager::INVALID_SLOT)
+                    {
+                        std::cerr << "Bindless texture heap is full!" << std::endl;
+                    }
                 }
-
-                void * imgSrcBufferPtr{nullptr};
-                vmaMapMemory(m_context.vram_allocator, image_source_allocation, &imgSrcBufferPtr);
-                memcpy(imgSrcBufferPtr, raw_texture_data[i].data(), raw_texture_data[i].size());
-            }
-            
-            vk::FenceCreateInfo fenceOneTimeCI {};
-            vk::Fence UploadFence;
-            if (!m_context.device.createFence(fenceOneTimeCI))
-            {
-                std::cerr << "Failed to create fence!" << std::endl;
-            }
-            
-            vk::CommandBuffer buffer;
-            {
-                auto pool_manager = ServiceLocator::Instance()->Get<Vulkan::CommandPoolManager>();
-                buffer = pool_manager->GetTransferCommandBuffer();
-                pool_manager->BeginRecordTransferCommands();
-            }
-            vk::ImageMemoryBarrier2 barrier_texture_image
-            {
-                .srcStageMask = VK_PIPELINE_STAGE_2_NONE,
-                .srcAccessMask = VK_ACCESS_2_NONE,
-                .dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
-                .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
-                .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-                .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                .image = textures[i].image,
-                .subresourceRange = { .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .levelCount = ktxTexture->numLevels, .layerCount = 1 }
-            };
-            
-            vk::DependencyInfo barrier_texture_dependency_info =
-            {
-                .imageMemoryBarrierCount = 1,
-                .pImageMemoryBarrier = &barrier_texture_image
-            };
-            
-            vkCmdPipelineBarrier2(buffer, barrier_texture_dependency_info);
-            
-            std::vector<vk::BufferImageCopy> bufferImageCopies;
-            
-            for (auto j = 0; j < ktxTexture->numLevels; j++) {
-                ktx_size_t mipOffset{0};
-                KTX_error_code ret = ktxTexture_GetImageOffset(ktxTexture, j, 0, 0, &mipOffset);
-                copyRegions.push_back({
-                    .bufferOffset = mipOffset,
-                    .imageSubresource{.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = (uint32_t)j, .layerCount = 1},
-                    .imageExtent{.width = ktxTexture->baseWidth >> j, .height = ktxTexture->baseHeight >> j, .depth = 1 },
-                });
             }
-            vkCmdCopyBufferToImage(cbOneTime, imgSrcBuffer, textures[i].image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
-            VkImageMemoryBarrier2 barrierTexRead{
-                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
-                .srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT,
-                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-                .dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
-                .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                .newLayout = VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL,
-                .image = textures[i].image,
-                .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .levelCount = ktxTexture->numLevels, .layerCount = 1 }
-            };
-            barrierTexInfo.pImageMemoryBarriers = &barrierTexRead;
-            vkCmdPipelineBarrier2(cbOneTime, &barrierTexInfo);
-            chk(vkEndCommandBuffer(cbOneTime));
-            VkSubmitInfo oneTimeSI{
-                .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-                .commandBufferCount = 1,
-                .pCommandBuffers = &cbOneTime
-            };
-            chk(vkQueueSubmit(queue, 1, &oneTimeSI, fenceOneTime));
-            chk(vkWaitForFences(device, 1, &fenceOneTime, VK_TRUE, UINT64_MAX));
-            //next upload commands to upload all of these to GPU
-            //use fences for synchronizing, and create samplers and descriptors for each texture
-            
-            VkSamplerCreateInfo samplerCI{
-                .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-                .magFilter = VK_FILTER_LINEAR,
-                .minFilter = VK_FILTER_LINEAR,
-                .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
-                .anisotropyEnable = VK_TRUE,
-                .maxAnisotropy = 8.0f, // 8 is a widely supported value for max anisotropy
-                .maxLod = (float)ktxTexture->numLevels,
-            };
-            chk(vkCreateSampler(device, &samplerCI, nullptr, &textures[i].sampler));
-            
-            ktxTexture_Destroy(ktxTexture);
-            textureDescriptors.push_back({
-                .sampler = textures[i].sampler,
-                .imageView = textures[i].view,
-                .imageLayout = VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL
-            });
+            // the copies go out with the next frame's Submit, the ring space is reused after that
+        }
+
+        /**
+         * @param index index returned by loadTexture
+         * @return the texture's index into the bindless texture array, INVALID_SLOT until it has been uploaded
+         */
+        uint32_t GetTextureSlot(size_t index) const
+        {
+            return index < textures.size() ? textures[index].slot : Vulkan::DescriptorManager::INVALID_SLOT;
+        }
+
+        /**
+         * Timeline value of the last UploadTexturesToVRAM, see UploadScheduler::GetWaitInfo
+         */
+        uint64_t GetUploadValue() const
+        {
+            return upload_value;
         }
 
         
@@ -209,15 +240,25 @@ namespace Rendering
         
         Atomics::Counter texture_counter;
         const Vulkan::Context& m_context;
+        // kept so reloading the manifest reuses the parser and the entries' strings
+        JsonParser manifest_parser;
+        AngelBase::Core::AssetManifest asset_manifest;
         std::vector<std::vector<unsigned char>> raw_texture_data;
+        // per texture, same index as raw_texture_data
+        std::vector<vk::Extent3D> texture_extents;
         std::vector<AngelBase::Core::AsyncRequestHandle> texture_metadata;
         struct VulkanImage
         {
             vk::Image image;
             vk::ImageView view;
             VmaAllocation allocation;
+            // shared, owned by the manager
+            vk::Sampler sampler;
+            uint32_t slot = Vulkan::DescriptorManager::INVALID_SLOT;
         };
         std::vector<VulkanImage> textures;
+        vk::Sampler sampler;
+        uint64_t upload_value = 0;
         size_t current_texture_index;
     };
 }
\ No newline at end of file
@@ -5,10 +5,33 @@ export module VulkanCommand;
 import std;
 import VulkanContext;
 import ServiceLocator;
+import JobSystem;
+import Atomics;
 
 namespace Rendering::Vulkan
 {
-    //TODO: I think we want the ability to record across multiple threads maybe?
+    /**
+     * What one frame's recording cost, see CommandPoolManager::GetLastFrameStats
+     */
+    export struct CommandFrameStats
+    {
+        // command buffers handed out
+        uint32_t primaries = 0;
+        uint32_t secondaries = 0;
+        // of those, freshly allocated-- zero once the rings have grown to what a frame needs
+        uint32_t allocations = 0;
+        // wall time spent in RecordParallel, and the recording time of all threads added up
+        double record_ms = 0.0;
+        double record_cpu_ms = 0.0;
+    };
+
+    /**
+     * Command pools for the renderer: a ring of primaries per frame, plus a pool per job worker per frame that
+     * secondaries are recorded from in parallel (RecordParallel) \n
+     * BeginFrame resets a frame's pools as a whole once its fence has signaled, the command buffers in them are
+     * handed out again instead of reallocated \n
+     * Pools are never shared between threads, command pools aren't thread safe
+     */
     export class CommandPoolManager : public ISystem
     {
     public:
@@ -21,6 +44,15 @@ namespace Rendering::Vulkan
             for (uint32_t i = 0; i < FRAMES; i++)
             {
                 m_context.device.destroyCommandPool(rendering_command.command_pools[i]);
+                for (ThreadCommandPool& thread_pool : thread_pools[i])
+                {
+                    m_context.device.destroyCommandPool(thread_pool.command_pool);
+                }
+            }
+            if (transfer_command.command_pool)
+            {
+                m_context.device.destroyCommandPool(transfer_command.command_pool);
+                m_context.device.destroyFence(transfer_command.transfer_fence);
             }
         }
         CommandPoolManager() = delete;
@@ -30,21 +62,30 @@ namespace Rendering::Vulkan
         CommandPoolManager& operator=(CommandPoolManager&&) = delete;
         
 
+        // first primary of the frame's ring, the one the first AcquireCommandBuffer after BeginFrame hands out
         vk::CommandBuffer& GetRenderingCommandBuffer(uint32_t frameIndex)
         {
             assert(frameIndex < FRAMES && "frameIndex is greater than the amount of frames possible.");
-            return rendering_command.command_buffers[frameIndex];
+            return rendering_command.command_buffers[frameIndex].front();
         }
         
         vk::CommandBuffer& GetTransferCommandBuffer()
         {
             return transfer_command.command_buffer;
         }
+
+        // signaled once the last transfer recording has executed, submit the recording with it
+        vk::Fence GetTransferFence() const
+        {
+            return transfer_command.transfer_fence;
+        }
         
         void BuildRenderCommandStructures()
         {
             vk::CommandPoolCreateInfo command_pool_info = {};
             command_pool_info.queueFamilyIndex = m_context.graphics_queue_index;
+            // reset as a whole by BeginFrame, never per buffer
+            command_pool_info.flags = vk::CommandPoolCreateFlagBits::eTransient;
             
             for (uint32_t i = 0; i < FRAMES; ++i)
             {
@@ -55,11 +96,181 @@ namespace Rendering::Vulkan
                 command_buffer_info.commandBufferCount = 1;
                 command_buffer_info.level = vk::CommandBufferLevel::ePrimary;
 
-                //just grab the first for now
-                rendering_command.command_buffers[i] = m_context.device.allocateCommandBuffers(command_buffer_info)[0];
+                // the ring starts with one, AcquireCommandBuffer grows it
+                rendering_command.command_buffers[i] = m_context.device.allocateCommandBuffers(command_buffer_info);
+                rendering_command.used[i] = 0;
+            }
+        }
+
+        /**
+         * Waits for the frame's fence, then resets the frame's pools so their command buffers can be recorded
+         * again. Resetting the fence is left to whoever submits the frame
+         * @param frameIndex frame about to be recorded
+         * @param frame_fence fence the frame's last submit signaled
+         */
+        void BeginFrame(uint32_t frameIndex, vk::Fence frame_fence)
+        {
+            assert(frameIndex < FRAMES && "frameIndex is greater than the amount of frames possible.");
+            if (frame_fence && m_context.device.waitForFences(frame_fence, VK_TRUE, UINT64_MAX) != vk::Result::eSuccess)
+            {
+                assert(false && "failed to wait for the frame fence");
+            }
+
+            last_frame_stats = collectStats(frameIndex);
+            frame_stats[frameIndex].reset();
+
+            m_context.device.resetCommandPool(rendering_command.command_pools[frameIndex]);
+            rendering_command.used[frameIndex] = 0;
+            if (!thread_pools[frameIndex].empty())
+            {
+                ResetThreadCommandPools(frameIndex);
+            }
+        }
+
+        /**
+         * Next primary of the frame's ring, allocated only when the ring has none left. Render thread only
+         * @param frameIndex frame being recorded
+         */
+        vk::CommandBuffer AcquireCommandBuffer(uint32_t frameIndex)
+        {
+            assert(frameIndex < FRAMES && "frameIndex is greater than the amount of frames possible.");
+            std::vector<vk::CommandBuffer>& ring = rendering_command.command_buffers[frameIndex];
+            size_t& used = rendering_command.used[frameIndex];
+            if (used == ring.size())
+            {
+                vk::CommandBufferAllocateInfo command_buffer_info = {};
+                command_buffer_info.commandPool = rendering_command.command_pools[frameIndex];
+                command_buffer_info.commandBufferCount = 1;
+                command_buffer_info.level = vk::CommandBufferLevel::ePrimary;
+                ring.push_back(m_context.device.allocateCommandBuffers(command_buffer_info)[0]);
+                frame_stats[frameIndex].allocations.fetch_add(1, std::memory_order_relaxed);
             }
+            frame_stats[frameIndex].primaries.fetch_add(1, std::memory_order_relaxed);
+            return ring[used++];
+        }
+
+        /**
+         * Counts and timings of the frame the last BeginFrame recycled
+         */
+        const CommandFrameStats& GetLastFrameStats() const
+        {
+            return last_frame_stats;
         }
         
+        /**
+         * Creates a pool per job worker per frame for secondary command buffers, plus one for the render thread.
+         * Call after JobSystem::Initialize
+         */
+        void BuildThreadCommandStructures()
+        {
+            vk::CommandPoolCreateInfo command_pool_info = {};
+            command_pool_info.queueFamilyIndex = m_context.graphics_queue_index;
+            // reset as a whole every frame, never per buffer
+            command_pool_info.flags = vk::CommandPoolCreateFlagBits::eTransient;
+
+            const uint32_t thread_count = JobSystem::WorkerCount() + 1;
+            for (uint32_t i = 0; i < FRAMES; ++i)
+            {
+                thread_pools[i].resize(thread_count);
+                for (ThreadCommandPool& thread_pool : thread_pools[i])
+                {
+                    thread_pool.command_pool = m_context.device.createCommandPool(command_pool_info, nullptr);
+                }
+            }
+        }
+
+        /**
+         * Recycles the frame's secondary command buffers. Only once the frame's fence has signaled
+         * @param frameIndex frame about to be recorded
+         */
+        void ResetThreadCommandPools(uint32_t frameIndex)
+        {
+            assert(frameIndex < FRAMES && "frameIndex is greater than the amount of frames possible.");
+            for (ThreadCommandPool& thread_pool : thread_pools[frameIndex])
+            {
+                m_context.device.resetCommandPool(thread_pool.command_pool);
+                thread_pool.used = 0;
+            }
+        }
+
+        /**
+         * A secondary command buffer from the calling thread's pool, allocated only when the pool has none left
+         * over from earlier frames. Job workers and the render thread only, each has its own pool
+         * @param frameIndex frame being recorded
+         */
+        vk::CommandBuffer AcquireSecondaryCommandBuffer(uint32_t frameIndex)
+        {
+            assert(frameIndex < FRAMES && "frameIndex is greater than the amount of frames possible.");
+            ThreadCommandPool& thread_pool = threadPool(frameIndex);
+            if (thread_pool.used == thread_pool.command_buffers.size())
+            {
+                vk::CommandBufferAllocateInfo command_buffer_info = {};
+                command_buffer_info.commandPool = thread_pool.command_pool;
+                command_buffer_info.commandBufferCount = 1;
+                command_buffer_info.level = vk::CommandBufferLevel::eSecondary;
+                thread_pool.command_buffers.push_back(m_context.device.allocateCommandBuffers(command_buffer_info)[0]);
+                frame_stats[frameIndex].allocations.fetch_add(1, std::memory_order_relaxed);
+            }
+            frame_stats[frameIndex].secondaries.fetch_add(1, std::memory_order_relaxed);
+            return thread_pool.command_buffers[thread_pool.used++];
+        }
+
+        /**
+         * Records draw_count draws into secondaries on the job workers and executes them from primary in draw
+         * order. primary must be inside vkCmdBeginRendering with eContentsSecondaryCommandBuffers. \n
+         * Secondaries inherit nothing but the attachments-- record sets its own pipeline, viewport, scissor and
+         * descriptor sets. \n
+         * \b Usage: RecordParallel(frame, cmd, draws.size(), inheritance, [&](vk::CommandBuffer cb, uint32_t first, uint32_t count) { ... });
+         * @param frameIndex frame being recorded
+         * @param primary command buffer the secondaries are executed from
+         * @param draw_count amount of draws to split up
+         * @param rendering attachment formats and samples of the rendering primary is in
+         * @param record records draws [first, first + count) into the given command buffer, called from workers
+         * @param min_draws_per_job below this a range isn't worth a job
+         */
+        template <typename Record>
+        void RecordParallel(uint32_t frameIndex, vk::CommandBuffer primary, uint32_t draw_count,
+                            const vk::CommandBufferInheritanceRenderingInfo& rendering, Record&& record,
+                            uint32_t min_draws_per_job = 512)
+        {
+            if (draw_count == 0) return;
+            using Clock = std::chrono::steady_clock;
+            const auto start = Clock::now();
+            const uint32_t max_jobs = static_cast<uint32_t>(thread_pools[frameIndex].size());
+            const uint32_t job_count = std::clamp((draw_count + min_draws_per_job - 1) / min_draws_per_job, 1u, max_jobs);
+
+            secondary_scratch.assign(job_count, nullptr);
+            Atomics::Counter record_jobs;
+            for (uint32_t job = 0; job < job_count; ++job)
+            {
+                const uint32_t first = static_cast<uint32_t>(static_cast<uint64_t>(draw_count) * job / job_count);
+                const uint32_t last = static_cast<uint32_t>(static_cast<uint64_t>(draw_count) * (job + 1) / job_count);
+                JobSystem::SubmitJob(JobSystem::Job{"RecordDraws", [this, frameIndex, &rendering, &record, job, first, last]()
+                {
+                    const auto job_start = Clock::now();
+                    vk::CommandBuffer command_buffer = AcquireSecondaryCommandBuffer(frameIndex);
+
+                    vk::CommandBufferInheritanceInfo inheritance = {};
+                    inheritance.pNext = &rendering;
+                    vk::CommandBufferBeginInfo begin_info = {};
+                    begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit |
+                                       vk::CommandBufferUsageFlagBits::eRenderPassContinue;
+                    begin_info.pInheritanceInfo = &inheritance;
+
+                    command_buffer.begin(begin_info);
+                    record(command_buffer, first, last - first);
+                    command_buffer.end();
+                    secondary_scratch[job] = command_buffer;
+                    addTime(frame_stats[frameIndex].record_cpu_ns, job_start);
+                }}, record_jobs, JobSystem::Priority::High);
+            }
+            JobSystem::WaitForCounter(record_jobs);
+
+            // in job order, so draws keep their order
+            primary.executeCommands(secondary_scratch);
+            addTime(frame_stats[frameIndex].record_ns, start);
+        }
+
         void BuildTransferCommandStructures()
         {
             vk::CommandPoolCreateInfo command_pool_info = {};
@@ -76,15 +287,30 @@ namespace Rendering::Vulkan
             
             
             
+            // signaled, so the first BeginRecordTransferCommands doesn't wait on a submit that never happened
             vk::FenceCreateInfo fence_info = {};
+            fence_info.flags = vk::FenceCreateFlagBits::eSignaled;
             
             transfer_command.transfer_fence = m_context.device.createFence(fence_info);
         }
         
+        /**
+         * Waits for the last transfer recording to finish executing, then resets and begins it again. Submit it
+         * with GetTransferFence
+         */
         void BeginRecordTransferCommands()
         {
+            // a begin without a reset needs a pool that resets single buffers, and the buffer may still be
+            // executing-- simultaneous use doesn't allow re-recording it either
+            if (m_context.device.waitForFences(transfer_command.transfer_fence, VK_TRUE, UINT64_MAX) != vk::Result::eSuccess)
+            {
+                assert(false && "failed to wait for the transfer fence");
+            }
+            m_context.device.resetFences(transfer_command.transfer_fence);
+            m_context.device.resetCommandPool(transfer_command.command_pool);
+
             vk::CommandBufferBeginInfo begin_info = {};
-            begin_info.flags = vk::CommandBufferUsageFlags::BitsType::eSimultaneousUse;
+            begin_info.flags = vk::CommandBufferUsageFlags::BitsType::eOneTimeSubmit;
             transfer_command.command_buffer.begin(begin_info);
         }
         
@@ -99,9 +325,51 @@ namespace Rendering::Vulkan
         struct RenderCommandStructures
         {
             vk::CommandPool command_pools[FRAMES];
-            vk::CommandBuffer command_buffers[FRAMES];
+            // ring per frame, [0, used) are handed out this frame
+            std::vector<vk::CommandBuffer> command_buffers[FRAMES];
+            size_t used[FRAMES] = {};
         }rendering_command;
 
+        // added to from the recording workers
+        struct AtomicFrameStats
+        {
+            std::atomic<uint32_t> primaries = 0;
+            std::atomic<uint32_t> secondaries = 0;
+            std::atomic<uint32_t> allocations = 0;
+            std::atomic<uint64_t> record_ns = 0;
+            std::atomic<uint64_t> record_cpu_ns = 0;
+
+            void reset()
+            {
+                primaries = 0;
+                secondaries = 0;
+                allocations = 0;
+                record_ns = 0;
+                record_cpu_ns = 0;
+            }
+        };
+        AtomicFrameStats frame_stats[FRAMES];
+        CommandFrameStats last_frame_stats;
+
+        CommandFrameStats collectStats(uint32_t frameIndex) const
+        {
+            const AtomicFrameStats& stats = frame_stats[frameIndex];
+            CommandFrameStats out;
+            out.primaries = stats.primaries.load(std::memory_order_relaxed);
+            out.secondaries = stats.secondaries.load(std::memory_order_relaxed);
+            out.allocations = stats.allocations.load(std::memory_order_relaxed);
+            out.record_ms = stats.record_ns.load(std::memory_order_relaxed) / 1'000'000.0;
+            out.record_cpu_ms = stats.record_cpu_ns.load(std::memory_order_relaxed) / 1'000'000.0;
+            return out;
+        }
+
+        static void addTime(std::atomic<uint64_t>& total, std::chrono::steady_clock::time_point start)
+        {
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+            total.fetch_add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()),
+                            std::memory_order_relaxed);
+        }
+
         
         struct TransferCommandStructures
         {
@@ -110,6 +378,30 @@ namespace Rendering::Vulkan
             vk::Fence transfer_fence;
             std::vector<vk::Buffer> staging_buffers;
         }transfer_command;
+
+        struct ThreadCommandPool
+        {
+            vk::CommandPool command_pool;
+            // allocated once, handed out again after every reset
+            std::vector<vk::CommandBuffer> command_buffers;
+            size_t used = 0;
+        };
+        // [frame][JobSystem::WorkerIndex()], the last one is the render thread's
+        std::vector<ThreadCommandPool> thread_pools[FRAMES];
+        // secondaries of the RecordParallel in progress, kept to not reallocate every frame
+        std::vector<vk::CommandBuffer> secondary_scratch;
+
+        ThreadCommandPool& threadPool(uint32_t frameIndex)
+        {
+            std::vector<ThreadCommandPool>& pools = thread_pools[frameIndex];
+            assert(!pools.empty() && "BuildThreadCommandStructures wasn't called");
+            const uint32_t worker = JobSystem::WorkerIndex();
+            if (worker == JobSystem::NOT_A_WORKER || worker + 1 >= pools.size())
+            {
+                return pools.back();
+            }
+            return pools[worker];
+        }
     };
 
     
@@ -20,6 +20,8 @@ export namespace Rendering::Vulkan
         vk::Device device;
         vk::PhysicalDevice physical_device;
         vk::Queue graphics_queue;
+        // the graphics queue itself when the device has no other queue to copy on
+        vk::Queue transfer_queue;
         vk::SurfaceKHR surface;
         VmaAllocator vram_allocator;
         int32_t graphics_queue_index = -1;
@@ -4,14 +4,27 @@ export module VulkanDescriptors;
 
 import VulkanContext;
 import ServiceLocator;
+import std;
+
 namespace Rendering::Vulkan
 {
     // bindless design
     //TODO: Sakura, we're only using descriptors for the textures, otherwise buffer device address
     //TODO: Descriptors are only used for ImageSamplers/textures so we need to refactor
+    /**
+     * Bindless texture heap: one update-after-bind set holding every texture as a combined image sampler, bound
+     * once and indexed by slot in shaders (textures[slot]). \n
+     * Slots come off a free list in constant time. Freed slots are reused only after FRAMES frames, since frames
+     * in flight may still sample them, and writes are batched into one updateDescriptorSets per frame
+     */
     export class DescriptorManager: public ISystem
     {
     public:
+        // returned by allocateTextureSlot when the heap is full
+        static constexpr uint32_t INVALID_SLOT = ~0u;
+        // upper bound on the heap, drivers report limits in the millions that we'd never fill
+        static constexpr uint32_t MAX_BINDLESS_TEXTURES = 1u << 16;
+
         DescriptorManager() = delete;
 
         DescriptorManager(const Vulkan::Context& context)
@@ -27,7 +40,150 @@ namespace Rendering::Vulkan
             m_context.device.destroyDescriptorPool(m_pool);
             
         }
+
+        // layout of the bindless texture set, pipeline layouts derived from shaders reuse it for their texture array
+        vk::DescriptorSetLayout getLayout() const { return m_layout; }
+        vk::DescriptorSet getDescriptorSet() const { return m_set; }
+        uint32_t getTextureCapacity() const { return m_capacity; }
+        // slots handed out and not freed yet
+        uint32_t getUsedSlotCount() const { return m_capacity - static_cast<uint32_t>(m_free_slots.size() + m_retired_slots.size()); }
+
+        /**
+         * Takes a free slot, O(1)
+         * @return slot index for shaders, INVALID_SLOT if the heap is full
+         */
+        uint32_t allocateTextureSlot()
+        {
+            if (m_free_slots.empty())
+            {
+                return INVALID_SLOT;
+            }
+            const uint32_t slot = m_free_slots.back();
+            m_free_slots.pop_back();
+            return slot;
+        }
+
+        /**
+         * Points a slot at a texture. Queued, it's written by the next flushWrites/advanceFrame-- update-after-bind
+         * makes that legal while the set is bound, as long as no frame in flight uses the slot
+         * @param slot from allocateTextureSlot
+         * @param view image view to sample
+         * @param sampler sampler to sample it with
+         * @param layout layout the image is in when sampled
+         */
+        void writeTexture(uint32_t slot, vk::ImageView view, vk::Sampler sampler,
+                          vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal)
+        {
+            assert(slot < m_capacity && "texture slot out of range");
+            m_pending_writes.push_back({slot, vk::DescriptorImageInfo(sampler, view, layout)});
+        }
+
+        /**
+         * allocateTextureSlot and writeTexture in one
+         * @return slot index, INVALID_SLOT if the heap is full
+         */
+        uint32_t addTexture(vk::ImageView view, vk::Sampler sampler,
+                            vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal)
+        {
+            const uint32_t slot = allocateTextureSlot();
+            if (slot != INVALID_SLOT)
+            {
+                writeTexture(slot, view, sampler, layout);
+            }
+            return slot;
+        }
+
+        /**
+         * Gives a slot back. It returns to the free list FRAMES frames later, draws recorded before this may still
+         * read it. The descriptor is left as is (partially bound), nothing should index it after this
+         * @param slot from allocateTextureSlot
+         */
+        void freeTextureSlot(uint32_t slot)
+        {
+            assert(slot < m_capacity && "texture slot out of range");
+            m_retired_slots.push_back({slot, FRAMES});
+        }
+
+        /**
+         * Call once per frame before recording: slots freed FRAMES frames ago become free, queued writes are flushed
+         */
+        void advanceFrame()
+        {
+            for (RetiredSlot& retired : m_retired_slots)
+            {
+                --retired.frames_left;
+            }
+            std::erase_if(m_retired_slots, [this](const RetiredSlot& retired)
+            {
+                if (retired.frames_left > 0) return false;
+                m_free_slots.push_back(retired.slot);
+                return true;
+            });
+            flushWrites();
+        }
+
+        /**
+         * Writes every queued slot with one updateDescriptorSets, runs of consecutive slots share a write
+         * @return amount of slots written
+         */
+        uint32_t flushWrites()
+        {
+            if (m_pending_writes.empty())
+            {
+                return 0;
+            }
+            // later writes to a slot win, stable sort keeps them after the earlier ones
+            std::ranges::stable_sort(m_pending_writes, {}, &PendingWrite::slot);
+            m_write_infos.clear();
+            m_writes.clear();
+            for (size_t i = 0; i < m_pending_writes.size(); ++i)
+            {
+                const PendingWrite& pending = m_pending_writes[i];
+                if (i + 1 < m_pending_writes.size() && m_pending_writes[i + 1].slot == pending.slot) continue;
+                m_write_infos.push_back(pending.info);
+
+                const bool extends_run = !m_writes.empty() &&
+                    m_writes.back().dstArrayElement + m_writes.back().descriptorCount == pending.slot;
+                if (extends_run)
+                {
+                    ++m_writes.back().descriptorCount;
+                    continue;
+                }
+                vk::WriteDescriptorSet write{};
+                write.dstSet = m_set;
+                write.dstBinding = 0;
+                write.dstArrayElement = pending.slot;
+                write.descriptorCount = 1;
+                write.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+                m_writes.push_back(write);
+            }
+
+            // each run's infos are contiguous, point the writes at them now that the vector stopped growing
+            size_t first = 0;
+            for (vk::WriteDescriptorSet& write : m_writes)
+            {
+                write.pImageInfo = m_write_infos.data() + first;
+                first += write.descriptorCount;
+            }
+
+            m_context.device.updateDescriptorSets(static_cast<uint32_t>(m_writes.size()), m_writes.data(), 0, nullptr);
+            const uint32_t written = static_cast<uint32_t>(m_write_infos.size());
+            m_pending_writes.clear();
+            return written;
+        }
     private:
+        struct PendingWrite
+        {
+            uint32_t slot;
+            vk::DescriptorImageInfo info;
+        };
+
+        struct RetiredSlot
+        {
+            uint32_t slot;
+            uint32_t frames_left;
+        };
+
         vk::DescriptorSetLayoutCreateInfo m_layout_create_info;
         //we're going to need 1
         vk::DescriptorSetLayout m_layout;
@@ -37,24 +193,56 @@ namespace Rendering::Vulkan
         vk::DescriptorSetLayoutBinding m_layout_binding;
         
         vk::DescriptorPool m_pool;
+        vk::DescriptorSet m_set;
+        uint32_t m_capacity = 0;
+
+        // free slots, popped from the back so recently freed ones get reused first
+        std::vector<uint32_t> m_free_slots;
+        std::vector<RetiredSlot> m_retired_slots;
+        // queued writes and the scratch flushWrites builds them into, kept to not reallocate every frame
+        std::vector<PendingWrite> m_pending_writes;
+        std::vector<vk::DescriptorImageInfo> m_write_infos;
+        std::vector<vk::WriteDescriptorSet> m_writes;
         
         const Vulkan::Context& m_context;
+
+        // as many textures as an update-after-bind set may hold on this device, capped at MAX_BINDLESS_TEXTURES
+        uint32_t queryCapacity() const
+        {
+            const auto properties = m_context.physical_device.getProperties2<vk::PhysicalDeviceProperties2,
+                                                                              vk::PhysicalDeviceVulkan12Properties>();
+            const auto& vulkan12 = properties.get<vk::PhysicalDeviceVulkan12Properties>();
+            return std::min({
+                MAX_BINDLESS_TEXTURES,
+                vulkan12.maxDescriptorSetUpdateAfterBindSampledImages,
+                vulkan12.maxDescriptorSetUpdateAfterBindSamplers,
+                vulkan12.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                vulkan12.maxPerStageDescriptorUpdateAfterBindSamplers,
+                vulkan12.maxUpdateAfterBindDescriptorsInAllPools
+            });
+        }
+
         void initialize()
         {
             //only ever need one descriptor pool/set since the GPU will use it all
+            m_capacity = queryCapacity();
             
-            // creating the descriptor set layouts just for the textures
-            m_binding_flags = vk::DescriptorBindingFlagBits::eVariableDescriptorCount;
+            // creating the descriptor set layouts just for the textures. Same flags PipelineManager gives unbounded
+            // arrays, so layouts derived from shaders pick this one up
+            m_binding_flags = vk::DescriptorBindingFlagBits::ePartiallyBound |
+                              vk::DescriptorBindingFlagBits::eVariableDescriptorCount |
+                              vk::DescriptorBindingFlagBits::eUpdateAfterBind;
 
             m_desc_binding_flags_create_info.bindingCount = 1;
             m_desc_binding_flags_create_info.pBindingFlags = &m_binding_flags;
             
             m_layout_binding.descriptorType = vk::DescriptorType::eCombinedImageSampler;
-            //TODO: size of total textures
-            m_layout_binding.descriptorCount = 1;
-            m_layout_binding.stageFlags = vk::ShaderStageFlagBits::eFragment;
+            m_layout_binding.descriptorCount = m_capacity;
+            // any stage may index the heap (compute culling, ray tracing hit shaders)
+            m_layout_binding.stageFlags = vk::ShaderStageFlagBits::eAll;
 
             m_layout_create_info = vk::DescriptorSetLayoutCreateInfo();
+            m_layout_create_info.flags = vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool;
             m_layout_create_info.bindingCount = 1;
             m_layout_create_info.pBindings = &m_layout_binding;
             m_layout_create_info.pNext = &m_desc_binding_flags_create_info;
@@ -66,23 +254,23 @@ namespace Rendering::Vulkan
 
             std::vector<vk::DescriptorPoolSize> poolSizes = {
                 // only allocate descriptors for images/ textures
-                vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 1)
+                vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, m_capacity)
             };
             
 
             vk::DescriptorPoolCreateInfo poolCreateInfo = {};
+            poolCreateInfo.flags = vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind;
             poolCreateInfo.poolSizeCount = 1;
             poolCreateInfo.pPoolSizes = poolSizes.data();
-            //TODO: not sure if this is correct
-            poolCreateInfo.maxSets = FRAMES;
+            // one set shared by all frames, update-after-bind keeps it valid while in flight frames use other slots
+            poolCreateInfo.maxSets = 1;
 
             if (m_context.device.createDescriptorPool(&poolCreateInfo, nullptr, &m_pool) != vk::Result::eSuccess)
             {
                 assert(false && "failed to create descriptor pool");
             }
 
-            //TODO: as above, texture size
-            uint32_t descriptor_count = 1;
+            uint32_t descriptor_count = m_capacity;
             vk::DescriptorSetVariableDescriptorCountAllocateInfo variable_desc_count_info = {};
             variable_desc_count_info.descriptorSetCount = 1;
             variable_desc_count_info.pDescriptorCounts = &descriptor_count;
@@ -94,16 +282,15 @@ namespace Rendering::Vulkan
             allocateInfo.pNext = &variable_desc_count_info;
 
 
-            vk::DescriptorSet set;
             // Allocate descriptor set-- we are only allocating 1 for images
-            set = m_context.device.allocateDescriptorSets(allocateInfo)[0];
-
-            std::vector<vk::WriteDescriptorSet> write_descriptor_sets = {
-                //vk::WriteDescriptorSet(set, vk::DescriptorType::eCombinedImageSampler, 0, &Texture.sampler)
-            };
+            m_set = m_context.device.allocateDescriptorSets(allocateInfo)[0];
 
-            m_context.device.updateDescriptorSets(static_cast<uint32_t>(write_descriptor_sets.size()), write_descriptor_sets.data(), 0, nullptr);
-            
+            // slot 0 is handed out first
+            m_free_slots.resize(m_capacity);
+            for (uint32_t i = 0; i < m_capacity; ++i)
+            {
+                m_free_slots[i] = m_capacity - 1 - i;
+            }
         }
     };
 }
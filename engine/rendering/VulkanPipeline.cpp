@@ -5,22 +5,58 @@ export module VulkanPipeline;
 import ServiceLocator;
 import VulkanContext;
 import RenderTargetManager;
+import ShaderManager;
+import Hash;
+import JobSystem;
+import Atomics;
+import VulkanRayTracing;
 
 import std;
 
 namespace Rendering::Vulkan
 {
+    // bump whenever the file layout changes
+    constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x43504241; // 'ABPC'
+    constexpr uint32_t PIPELINE_CACHE_VERSION = 1;
+
+    // Front of the pipeline cache file, followed by dataSize bytes of vkGetPipelineCacheData output.
+    // The data carries vendor, device and cache UUID itself-- the driver version is only here
+    struct PipelineCacheFileHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint32_t driverVersion;
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+        uint64_t dataSize;
+        uint64_t dataHash;
+    };
+
     export class PipelineManager : public ISystem
     {
     public:
         PipelineManager() = delete;
-        PipelineManager(const Context& context) : m_context(context) {}
+        PipelineManager(const Context& context) : m_context(context) {
+            m_pipelineCache = m_context.device.createPipelineCache(vk::PipelineCacheCreateInfo{});
+            m_rayTracing = queryRayTracingSupport(m_context);
+
+            // without fast linking a "fast" link may compile as long as a full build, not worth the libraries
+            const auto features = m_context.physical_device.getFeatures2<vk::PhysicalDeviceFeatures2,
+                vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT>();
+            const auto properties = m_context.physical_device.getProperties2<vk::PhysicalDeviceProperties2,
+                vk::PhysicalDeviceGraphicsPipelineLibraryPropertiesEXT>();
+            m_libraryLinking = features.get<vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT>().graphicsPipelineLibrary &&
+                               properties.get<vk::PhysicalDeviceGraphicsPipelineLibraryPropertiesEXT>().graphicsPipelineLibraryFastLinking;
+        }
 
         ~PipelineManager()
         {
             cleanup();
         }
 
+        // Pipelines are looked up by a hash of their complete state, see PipelineBuilder::key
+        using PipelineKey = uint64_t;
+
         // Nested PipelineBuilder class
         class PipelineBuilder
         {
@@ -31,12 +67,25 @@ namespace Rendering::Vulkan
                 RayTracing
             };
 
+            // Parts of a graphics pipeline library (VK_EXT_graphics_pipeline_library), each one cached on its own
+            enum class LibraryPart : uint8_t {
+                VertexInput,
+                PreRasterization,
+                FragmentShader,
+                FragmentOutput
+            };
+            static constexpr size_t LIBRARY_PART_COUNT = 4;
+
         private:
             PipelineType m_type;
             const Context& m_context;
             
             // Shader stages (common to all pipeline types)
             std::vector<vk::PipelineShaderStageCreateInfo> m_shaderStages;
+            // per stage, 0 if the stage is keyed by its module handle
+            std::vector<uint64_t> m_stageCodeHashes;
+            // pName points into these once built, so a copied builder (async requests) doesn't dangle
+            std::vector<std::string> m_entryPoints;
             
             // Graphics-specific state
             vk::PipelineVertexInputStateCreateInfo m_vertexInput;
@@ -55,16 +104,19 @@ namespace Rendering::Vulkan
             // Ray tracing specific
             std::vector<vk::RayTracingShaderGroupCreateInfoKHR> m_rtShaderGroups;
             uint32_t m_maxRecursionDepth = 1;
+            const RayTracingSupport* m_rayTracing = nullptr;
             
             // Common properties
             vk::PipelineLayout m_layout;
+            vk::PipelineCache m_cache = nullptr;
             std::vector<vk::DynamicState> m_dynamicStates;
             std::vector<vk::Format> m_colorFormats;
             vk::Format m_depthFormat = vk::Format::eUndefined;
             
         public:
-            PipelineBuilder(const Context& context) 
-                : m_type(PipelineType::Graphics), m_context(context) 
+            PipelineBuilder(const Context& context, vk::PipelineCache cache = nullptr,
+                            const RayTracingSupport* rayTracing = nullptr) 
+                : m_type(PipelineType::Graphics), m_context(context), m_cache(cache), m_rayTracing(rayTracing) 
             {
                 setDefaults();
             }
@@ -76,19 +128,26 @@ namespace Rendering::Vulkan
             }
             
             // Shader stage management
+            // codeHash: hash of the module's SPIR-V, so modules created separately from the same code share a
+            // pipeline. Left 0 the stage is keyed by the module handle
             PipelineBuilder& addShaderStage(vk::ShaderStageFlagBits stage, 
                                            vk::ShaderModule module, 
-                                           const char* entryPoint = "main") {
+                                           const char* entryPoint = "main",
+                                           uint64_t codeHash = 0) {
                 vk::PipelineShaderStageCreateInfo stageInfo{};
                 stageInfo.stage = stage;
                 stageInfo.module = module;
                 stageInfo.pName = entryPoint;
                 m_shaderStages.push_back(stageInfo);
+                m_stageCodeHashes.push_back(codeHash);
+                m_entryPoints.emplace_back(entryPoint);
                 return *this;
             }
             
             PipelineBuilder& clearShaderStages() {
                 m_shaderStages.clear();
+                m_stageCodeHashes.clear();
+                m_entryPoints.clear();
                 return *this;
             }
             
@@ -193,17 +252,170 @@ namespace Rendering::Vulkan
                 m_layout = layout;
                 return *this;
             }
+
+            // Cache the driver looks compiled pipelines up in, builders from getBuilder use the manager's.
+            // Building from several threads? Give each one its own (PipelineManager::createWorkerCache)
+            PipelineBuilder& setPipelineCache(vk::PipelineCache cache) {
+                m_cache = cache;
+                return *this;
+            }
             
+            vk::PipelineLayout getLayout() const {
+                return m_layout;
+            }
+
+            // Canonical key of everything that ends up in the pipeline: stages, vertex input, raster, depth,
+            // multisample and blend state, dynamic states, attachment formats and layout. Equal state gives an
+            // equal key, whatever order the dynamic states were added in
+            PipelineKey key() const {
+                using namespace AngelBase::Core;
+                uint64_t key = Hash::combine(0, static_cast<uint32_t>(m_type));
+                key = hashStages(key, [](vk::ShaderStageFlagBits) { return true; });
+                key = Hash::combine(key, m_layout ? handleBits(m_layout) : 0);
+
+                if (m_type == PipelineType::Graphics) {
+                    key = hashVertexInput(key);
+                    key = hashRasterization(key);
+                    key = hashDepthStencil(key);
+                    key = hashMultisample(key);
+                    key = hashBlend(key);
+                    key = hashDynamicStates(key);
+                    key = hashFormats(key);
+                }
+                else if (m_type == PipelineType::RayTracing) {
+                    for (const auto& group : m_rtShaderGroups) {
+                        key = Hash::combine(key, static_cast<uint32_t>(group.type));
+                        key = Hash::combine(key, (static_cast<uint64_t>(group.generalShader) << 32) | group.closestHitShader);
+                        key = Hash::combine(key, (static_cast<uint64_t>(group.anyHitShader) << 32) | group.intersectionShader);
+                    }
+                    key = Hash::combine(key, m_maxRecursionDepth);
+                }
+                return key;
+            }
+            
+            PipelineType getType() const {
+                return m_type;
+            }
+
+            // Key of the state one library part is made of, parts with equal keys are interchangeable
+            PipelineKey libraryKey(LibraryPart part) const {
+                using namespace AngelBase::Core;
+                auto fragment = [](vk::ShaderStageFlagBits stage) { return stage == vk::ShaderStageFlagBits::eFragment; };
+                uint64_t key = Hash::combine(0x4c4942, static_cast<uint32_t>(part));
+                switch (part) {
+                    case LibraryPart::VertexInput:
+                        key = hashVertexInput(key);
+                        break;
+                    case LibraryPart::PreRasterization:
+                        key = hashStages(key, [&](vk::ShaderStageFlagBits stage) { return !fragment(stage); });
+                        key = Hash::combine(key, m_layout ? handleBits(m_layout) : 0);
+                        key = hashRasterization(key);
+                        break;
+                    case LibraryPart::FragmentShader:
+                        key = hashStages(key, fragment);
+                        key = Hash::combine(key, m_layout ? handleBits(m_layout) : 0);
+                        key = hashDepthStencil(key);
+                        key = hashMultisample(key);
+                        break;
+                    case LibraryPart::FragmentOutput:
+                        key = hashBlend(key);
+                        key = hashMultisample(key);
+                        break;
+                }
+                // dynamic states and formats are passed to every part, they have to match at link time
+                key = hashDynamicStates(key);
+                return hashFormats(key);
+            }
+
+            // Creates one part as a pipeline library, retaining what the optimized link needs
+            vk::Pipeline buildLibrary(LibraryPart part) {
+                prepareGraphicsState();
+
+                std::vector<vk::PipelineShaderStageCreateInfo> stages;
+                for (const auto& stage : m_shaderStages) {
+                    const bool fragment = stage.stage == vk::ShaderStageFlagBits::eFragment;
+                    if ((part == LibraryPart::FragmentShader && fragment) ||
+                        (part == LibraryPart::PreRasterization && !fragment)) {
+                        stages.push_back(stage);
+                    }
+                }
+
+                vk::GraphicsPipelineLibraryCreateInfoEXT libraryInfo{};
+                switch (part) {
+                    case LibraryPart::VertexInput:      libraryInfo.flags = vk::GraphicsPipelineLibraryFlagBitsEXT::eVertexInputInterface; break;
+                    case LibraryPart::PreRasterization: libraryInfo.flags = vk::GraphicsPipelineLibraryFlagBitsEXT::ePreRasterizationShaders; break;
+                    case LibraryPart::FragmentShader:   libraryInfo.flags = vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentShader; break;
+                    case LibraryPart::FragmentOutput:   libraryInfo.flags = vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentOutputInterface; break;
+                }
+                // view mask and attachment formats, everything but vertex input reads them
+                libraryInfo.pNext = part == LibraryPart::VertexInput ? nullptr : &m_renderingInfo;
+
+                vk::GraphicsPipelineCreateInfo pipelineInfo{};
+                pipelineInfo.pNext = &libraryInfo;
+                pipelineInfo.flags = vk::PipelineCreateFlagBits::eLibraryKHR |
+                                     vk::PipelineCreateFlagBits::eRetainLinkTimeOptimizationInfoEXT;
+                pipelineInfo.stageCount = static_cast<uint32_t>(stages.size());
+                pipelineInfo.pStages = stages.empty() ? nullptr : stages.data();
+                pipelineInfo.pDynamicState = m_dynamicStates.empty() ? nullptr : &m_dynamicState;
+                switch (part) {
+                    case LibraryPart::VertexInput:
+                        pipelineInfo.pVertexInputState = &m_vertexInput;
+                        pipelineInfo.pInputAssemblyState = &m_inputAssembly;
+                        break;
+                    case LibraryPart::PreRasterization:
+                        pipelineInfo.pViewportState = &m_viewportState;
+                        pipelineInfo.pRasterizationState = &m_rasterization;
+                        pipelineInfo.layout = m_layout;
+                        break;
+                    case LibraryPart::FragmentShader:
+                        pipelineInfo.pDepthStencilState = &m_depthStencil;
+                        pipelineInfo.pMultisampleState = &m_multisample;
+                        pipelineInfo.layout = m_layout;
+                        break;
+                    case LibraryPart::FragmentOutput:
+                        pipelineInfo.pColorBlendState = &m_colorBlend;
+                        pipelineInfo.pMultisampleState = &m_multisample;
+                        break;
+                }
+
+                auto result = m_context.device.createGraphicsPipeline(m_cache, pipelineInfo);
+                if (result.result != vk::Result::eSuccess) {
+                    throw std::runtime_error("Failed to create graphics pipeline library");
+                }
+                return result.value;
+            }
+
+            // Links one library of every part into a complete pipeline. The fast link only stitches the compiled
+            // parts together, optimized runs link time optimization over them (as slow as a monolithic build)
+            vk::Pipeline linkLibraries(std::span<const vk::Pipeline> libraries, bool optimized) {
+                vk::PipelineLibraryCreateInfoKHR libraryInfo{};
+                libraryInfo.libraryCount = static_cast<uint32_t>(libraries.size());
+                libraryInfo.pLibraries = libraries.data();
+
+                vk::GraphicsPipelineCreateInfo pipelineInfo{};
+                pipelineInfo.pNext = &libraryInfo;
+                pipelineInfo.layout = m_layout;
+                if (optimized) {
+                    pipelineInfo.flags = vk::PipelineCreateFlagBits::eLinkTimeOptimizationEXT;
+                }
+
+                auto result = m_context.device.createGraphicsPipeline(m_cache, pipelineInfo);
+                if (result.result != vk::Result::eSuccess) {
+                    throw std::runtime_error("Failed to link graphics pipeline libraries");
+                }
+                return result.value;
+            }
+
             // Build method - returns pipeline for manager to cache
+            // ray tracing pipelines are nullptr on devices without ray tracing, skip what would use them
             vk::Pipeline build() {
                 switch (m_type) {
                     case PipelineType::Graphics:
                         return buildGraphics();
                     case PipelineType::Compute:
                         return buildCompute();
-                    //TODO:
                     case PipelineType::RayTracing:
-                        return buildGraphics();
+                        return buildRayTracing();
                 }
                 return nullptr;
             }
@@ -236,7 +448,120 @@ namespace Rendering::Vulkan
                 m_multisample.minSampleShading = 1.0f;
             }
             
-            vk::Pipeline buildGraphics() {
+            template <typename Handle>
+            static uint64_t handleBits(Handle handle) {
+                return reinterpret_cast<uint64_t>(static_cast<typename Handle::CType>(handle));
+            }
+
+            static uint64_t floatBits(float value) {
+                return static_cast<uint64_t>(std::bit_cast<uint32_t>(value));
+            }
+
+            // stages for which include(stage) is true
+            template <typename Include>
+            uint64_t hashStages(uint64_t key, Include include) const {
+                using namespace AngelBase::Core;
+                for (size_t i = 0; i < m_shaderStages.size(); ++i) {
+                    const auto& stage = m_shaderStages[i];
+                    if (!include(stage.stage)) continue;
+                    key = Hash::combine(key, static_cast<uint32_t>(stage.stage));
+                    key = Hash::combine(key, m_stageCodeHashes[i] ? m_stageCodeHashes[i] : handleBits(stage.module));
+                    key = Hash::fnv1a64(std::string_view(m_entryPoints[i]), key);
+                }
+                return key;
+            }
+
+            uint64_t hashVertexInput(uint64_t key) const {
+                using namespace AngelBase::Core;
+                for (const auto& binding : m_vertexBindings) {
+                    key = Hash::combine(key, binding.binding);
+                    key = Hash::combine(key, binding.stride);
+                    key = Hash::combine(key, static_cast<uint32_t>(binding.inputRate));
+                }
+                for (const auto& attribute : m_vertexAttributes) {
+                    key = Hash::combine(key, attribute.location);
+                    key = Hash::combine(key, attribute.binding);
+                    key = Hash::combine(key, static_cast<uint32_t>(attribute.format));
+                    key = Hash::combine(key, attribute.offset);
+                }
+                key = Hash::combine(key, static_cast<uint32_t>(m_inputAssembly.topology));
+                return Hash::combine(key, m_inputAssembly.primitiveRestartEnable);
+            }
+
+            uint64_t hashRasterization(uint64_t key) const {
+                using namespace AngelBase::Core;
+                key = Hash::combine(key, static_cast<uint32_t>(m_rasterization.polygonMode));
+                key = Hash::combine(key, static_cast<uint32_t>(m_rasterization.cullMode));
+                key = Hash::combine(key, static_cast<uint32_t>(m_rasterization.frontFace));
+                key = Hash::combine(key, m_rasterization.depthClampEnable);
+                key = Hash::combine(key, m_rasterization.rasterizerDiscardEnable);
+                key = Hash::combine(key, m_rasterization.depthBiasEnable);
+                key = Hash::combine(key, floatBits(m_rasterization.depthBiasConstantFactor));
+                key = Hash::combine(key, floatBits(m_rasterization.depthBiasSlopeFactor));
+                return Hash::combine(key, floatBits(m_rasterization.lineWidth));
+            }
+
+            uint64_t hashDepthStencil(uint64_t key) const {
+                using namespace AngelBase::Core;
+                key = Hash::combine(key, m_depthStencil.depthTestEnable);
+                key = Hash::combine(key, m_depthStencil.depthWriteEnable);
+                key = Hash::combine(key, static_cast<uint32_t>(m_depthStencil.depthCompareOp));
+                return Hash::combine(key, m_depthStencil.stencilTestEnable);
+            }
+
+            uint64_t hashMultisample(uint64_t key) const {
+                using namespace AngelBase::Core;
+                key = Hash::combine(key, static_cast<uint32_t>(m_multisample.rasterizationSamples));
+                key = Hash::combine(key, m_multisample.sampleShadingEnable);
+                key = Hash::combine(key, floatBits(m_multisample.minSampleShading));
+                return Hash::combine(key, m_multisample.alphaToCoverageEnable);
+            }
+
+            uint64_t hashBlend(uint64_t key) const {
+                using namespace AngelBase::Core;
+                key = Hash::combine(key, m_colorBlendAttachment.blendEnable);
+                if (m_colorBlendAttachment.blendEnable) {
+                    key = Hash::combine(key, static_cast<uint32_t>(m_colorBlendAttachment.srcColorBlendFactor));
+                    key = Hash::combine(key, static_cast<uint32_t>(m_colorBlendAttachment.dstColorBlendFactor));
+                    key = Hash::combine(key, static_cast<uint32_t>(m_colorBlendAttachment.colorBlendOp));
+                    key = Hash::combine(key, static_cast<uint32_t>(m_colorBlendAttachment.srcAlphaBlendFactor));
+                    key = Hash::combine(key, static_cast<uint32_t>(m_colorBlendAttachment.dstAlphaBlendFactor));
+                    key = Hash::combine(key, static_cast<uint32_t>(m_colorBlendAttachment.alphaBlendOp));
+                }
+                return Hash::combine(key, static_cast<uint32_t>(m_colorBlendAttachment.colorWriteMask));
+            }
+
+            uint64_t hashDynamicStates(uint64_t key) const {
+                using namespace AngelBase::Core;
+                std::vector<vk::DynamicState> dynamicStates = m_dynamicStates;
+                std::ranges::sort(dynamicStates);
+                for (vk::DynamicState state : dynamicStates) {
+                    key = Hash::combine(key, static_cast<uint32_t>(state));
+                }
+                return key;
+            }
+
+            uint64_t hashFormats(uint64_t key) const {
+                using namespace AngelBase::Core;
+                for (vk::Format format : m_colorFormats) {
+                    key = Hash::combine(key, static_cast<uint32_t>(format));
+                }
+                return Hash::combine(key, static_cast<uint32_t>(m_depthFormat));
+            }
+
+            // point everything at this builder's own storage, it may be a copy
+            void fixupPointers() {
+                for (size_t i = 0; i < m_shaderStages.size(); ++i) {
+                    m_shaderStages[i].pName = m_entryPoints[i].c_str();
+                }
+                m_renderingInfo.colorAttachmentCount = static_cast<uint32_t>(m_colorFormats.size());
+                m_renderingInfo.pColorAttachmentFormats = m_colorFormats.data();
+            }
+
+            // fixupPointers plus the create infos built from the builder's vectors
+            void prepareGraphicsState() {
+                fixupPointers();
+
                 // Setup vertex input state
                 m_vertexInput.vertexBindingDescriptionCount = static_cast<uint32_t>(m_vertexBindings.size());
                 m_vertexInput.pVertexBindingDescriptions = m_vertexBindings.data();
@@ -256,7 +581,11 @@ namespace Rendering::Vulkan
                 // Setup viewport state (typically dynamic)
                 m_viewportState.viewportCount = 1;
                 m_viewportState.scissorCount = 1;
-                
+            }
+
+            vk::Pipeline buildGraphics() {
+                prepareGraphicsState();
+
                 vk::GraphicsPipelineCreateInfo pipelineInfo{};
                 pipelineInfo.pNext = &m_renderingInfo;
                 pipelineInfo.stageCount = static_cast<uint32_t>(m_shaderStages.size());
@@ -271,7 +600,7 @@ namespace Rendering::Vulkan
                 pipelineInfo.pDynamicState = m_dynamicStates.empty() ? nullptr : &m_dynamicState;
                 pipelineInfo.layout = m_layout;
                 
-                auto result = m_context.device.createGraphicsPipeline(nullptr, pipelineInfo);
+                auto result = m_context.device.createGraphicsPipeline(m_cache, pipelineInfo);
                 if (result.result != vk::Result::eSuccess) {
                     throw std::runtime_error("Failed to create graphics pipeline");
                 }
@@ -282,53 +611,486 @@ namespace Rendering::Vulkan
                 if (m_shaderStages.empty() || m_shaderStages[0].stage != vk::ShaderStageFlagBits::eCompute) {
                     throw std::runtime_error("Compute pipeline requires a compute shader stage");
                 }
+                fixupPointers();
                 
                 vk::ComputePipelineCreateInfo pipelineInfo{};
                 pipelineInfo.stage = m_shaderStages[0];
                 pipelineInfo.layout = m_layout;
                 
-                auto result = m_context.device.createComputePipeline(nullptr, pipelineInfo);
+                auto result = m_context.device.createComputePipeline(m_cache, pipelineInfo);
                 if (result.result != vk::Result::eSuccess) {
                     throw std::runtime_error("Failed to create compute pipeline");
                 }
                 return result.value;
             }
-            /*
+
+            // Compiled through a deferred host operation, so the job workers help compile instead of it all
+            // landing on this thread. RT pipelines are the slowest to build by far
             vk::Pipeline buildRayTracing() {
+                if (!m_rayTracing || !m_rayTracing->supported) {
+                    return nullptr;
+                }
+                if (m_rtShaderGroups.empty()) {
+                    throw std::runtime_error("Ray tracing pipeline requires shader groups");
+                }
+                fixupPointers();
+                if (!m_dynamicStates.empty()) {
+                    m_dynamicState.dynamicStateCount = static_cast<uint32_t>(m_dynamicStates.size());
+                    m_dynamicState.pDynamicStates = m_dynamicStates.data();
+                }
+
                 vk::RayTracingPipelineCreateInfoKHR pipelineInfo{};
                 pipelineInfo.stageCount = static_cast<uint32_t>(m_shaderStages.size());
                 pipelineInfo.pStages = m_shaderStages.data();
                 pipelineInfo.groupCount = static_cast<uint32_t>(m_rtShaderGroups.size());
                 pipelineInfo.pGroups = m_rtShaderGroups.data();
-                pipelineInfo.maxPipelineRayRecursionDepth = m_maxRecursionDepth;
+                pipelineInfo.maxPipelineRayRecursionDepth = std::min(m_maxRecursionDepth, m_rayTracing->properties.maxRayRecursionDepth);
+                pipelineInfo.pDynamicState = m_dynamicStates.empty() ? nullptr : &m_dynamicState;
                 pipelineInfo.layout = m_layout;
-                
-                auto result = m_context.device.createRayTracingPipelineKHR(nullptr, nullptr, pipelineInfo);
-                if (result.result != vk::Result::eSuccess) {
+
+                const auto& dispatch = m_rayTracing->dispatch;
+                VkDevice device = m_context.device;
+                VkDeferredOperationKHR deferred = VK_NULL_HANDLE;
+                if (dispatch.vkCreateDeferredOperationKHR(device, nullptr, &deferred) != VK_SUCCESS) {
+                    deferred = VK_NULL_HANDLE;
+                }
+
+                // the handle is written when the operation completes, it must outlive the call
+                VkPipeline pipeline = VK_NULL_HANDLE;
+                VkResult result = dispatch.vkCreateRayTracingPipelinesKHR(device, deferred, m_cache, 1,
+                    reinterpret_cast<const VkRayTracingPipelineCreateInfoKHR*>(&pipelineInfo), nullptr, &pipeline);
+                if (result == VK_OPERATION_DEFERRED_KHR) {
+                    joinDeferredOperation(deferred);
+                    result = dispatch.vkGetDeferredOperationResultKHR(device, deferred);
+                }
+                if (deferred) {
+                    dispatch.vkDestroyDeferredOperationKHR(device, deferred, nullptr);
+                }
+                if (result != VK_SUCCESS && result != VK_OPERATION_NOT_DEFERRED_KHR) {
                     throw std::runtime_error("Failed to create ray tracing pipeline");
                 }
-                return result.value;
-            }*/
+                return pipeline;
+            }
+
+            // Runs the operation on up to its max concurrency threads: this one plus job workers
+            void joinDeferredOperation(VkDeferredOperationKHR deferred) {
+                const auto& dispatch = m_rayTracing->dispatch;
+                VkDevice device = m_context.device;
+                auto join = [&dispatch, device, deferred]() {
+                    for (;;) {
+                        const VkResult result = dispatch.vkDeferredOperationJoinKHR(device, deferred);
+                        // THREAD_IDLE: nothing to do right now, but the operation isn't done
+                        if (result != VK_THREAD_IDLE_KHR) break;
+                        std::this_thread::yield();
+                    }
+                };
+
+                const uint32_t concurrency = dispatch.vkGetDeferredOperationMaxConcurrencyKHR(device, deferred);
+                // 0 once the operation has completed
+                const uint32_t helpers = std::min(std::max(concurrency, 1u), JobSystem::WorkerCount() + 1) - 1;
+                Atomics::Counter joins;
+                for (uint32_t i = 0; i < helpers; ++i) {
+                    JobSystem::SubmitJob(JobSystem::Job{"JoinDeferredOperation", [join]() { join(); }}, joins, JobSystem::Priority::High);
+                }
+                join();
+                JobSystem::WaitForCounter(joins);
+            }
         };
 
         // Get a builder instance
         PipelineBuilder getBuilder() {
-            return PipelineBuilder(m_context);
+            return PipelineBuilder(m_context, m_pipelineCache, &m_rayTracing);
+        }
+
+        // false on devices without ray tracing pipelines, ray tracing builds return nullptr there
+        bool isRayTracingSupported() const {
+            return m_rayTracing.supported;
+        }
+
+        const RayTracingSupport& getRayTracingSupport() const {
+            return m_rayTracing;
+        }
+
+        // Shader binding table for a ray tracing pipeline, nullptr when ray tracing isn't supported
+        // groupCount: amount of shader groups the pipeline was built with
+        std::unique_ptr<ShaderBindingTable> createShaderBindingTable(PipelineKey key, uint32_t groupCount,
+                                                                     const ShaderBindingTable::Desc& desc) const {
+            if (!m_rayTracing.supported) {
+                return nullptr;
+            }
+            auto table = std::make_unique<ShaderBindingTable>(m_context, m_rayTracing);
+            if (!table->build(getPipeline(key), groupCount, desc)) {
+                return nullptr;
+            }
+            return table;
+        }
+
+        // Replaces the pipeline cache with the one saved at path. Files written by another device, driver version
+        // or cache layout are ignored and the cache starts empty. savePipelineCache writes back to the same path
+        // returns false if nothing usable was loaded
+        bool loadPipelineCache(const std::string& path) {
+            m_cachePath = path;
+
+            std::vector<uint8_t> data;
+            {
+                std::ifstream file(path, std::ios::binary);
+                if (!file.is_open()) return false;
+
+                PipelineCacheFileHeader header{};
+                file.read(reinterpret_cast<char*>(&header), sizeof(header));
+                if (!file || !isCompatible(header)) {
+                    std::cerr << "Pipeline cache " << path << " is from another device or driver, starting empty" << std::endl;
+                    return false;
+                }
+                data.resize(static_cast<size_t>(header.dataSize));
+                file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+                if (!file || AngelBase::Core::Hash::fnv1a64(data.data(), data.size()) != header.dataHash) {
+                    std::cerr << "Pipeline cache " << path << " is truncated or corrupt, starting empty" << std::endl;
+                    return false;
+                }
+            }
+            if (!isCompatibleCacheData(data)) {
+                std::cerr << "Pipeline cache " << path << " has a mismatched header, starting empty" << std::endl;
+                return false;
+            }
+
+            vk::PipelineCacheCreateInfo cacheInfo{};
+            cacheInfo.initialDataSize = data.size();
+            cacheInfo.pInitialData = data.data();
+            vk::PipelineCache loaded = nullptr;
+            if (m_context.device.createPipelineCache(&cacheInfo, nullptr, &loaded) != vk::Result::eSuccess) {
+                return false;
+            }
+            m_context.device.destroyPipelineCache(m_pipelineCache);
+            m_pipelineCache = loaded;
+            return true;
+        }
+
+        // Merges the worker caches in and writes the cache to path (the one passed to loadPipelineCache if empty).
+        // Goes through a temp file so a crash never leaves a torn cache behind
+        bool savePipelineCache(const std::string& path = {}) {
+            namespace fs = std::filesystem;
+            const fs::path filePath = path.empty() ? fs::path(m_cachePath) : fs::path(path);
+            if (filePath.empty() || !m_pipelineCache) return false;
+
+            waitForPendingPipelines();
+            mergeWorkerCaches();
+            std::vector<uint8_t> data = m_context.device.getPipelineCacheData(m_pipelineCache);
+
+            const vk::PhysicalDeviceProperties properties = m_context.physical_device.getProperties();
+            PipelineCacheFileHeader header{};
+            header.magic = PIPELINE_CACHE_MAGIC;
+            header.version = PIPELINE_CACHE_VERSION;
+            header.vendorID = properties.vendorID;
+            header.deviceID = properties.deviceID;
+            header.driverVersion = properties.driverVersion;
+            std::memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID.data(), VK_UUID_SIZE);
+            header.dataSize = data.size();
+            header.dataHash = AngelBase::Core::Hash::fnv1a64(data.data(), data.size());
+
+            std::error_code ec;
+            if (filePath.has_parent_path()) {
+                fs::create_directories(filePath.parent_path(), ec);
+            }
+            fs::path tempPath = filePath;
+            tempPath += ".tmp";
+            {
+                std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+                if (!file.is_open()) return false;
+                file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+                if (!file) return false;
+            }
+            fs::rename(tempPath, filePath, ec);
+            return !ec;
+        }
+
+        // Empty cache for one thread building pipelines (pipeline caches are internally synchronized, but a
+        // shared one serializes the builds on some drivers). Merged into the main cache by mergeWorkerCaches
+        vk::PipelineCache createWorkerCache() {
+            vk::PipelineCache cache = m_context.device.createPipelineCache(vk::PipelineCacheCreateInfo{});
+            std::lock_guard lock(m_workerCacheMutex);
+            m_workerCaches.push_back(cache);
+            return cache;
+        }
+
+        // Folds every worker cache into the main one and destroys them. No builds may be using them, requested
+        // pipelines included (waitForPendingPipelines)
+        void mergeWorkerCaches() {
+            std::lock_guard lock(m_workerCacheMutex);
+            m_threadCaches.clear();
+            if (m_workerCaches.empty()) return;
+            if (m_context.device.mergePipelineCaches(m_pipelineCache, m_workerCaches) != vk::Result::eSuccess) {
+                std::cerr << "Failed to merge worker pipeline caches" << std::endl;
+            }
+            for (vk::PipelineCache cache : m_workerCaches) {
+                m_context.device.destroyPipelineCache(cache);
+            }
+            m_workerCaches.clear();
+        }
+
+        vk::PipelineCache getPipelineCache() const {
+            return m_pipelineCache;
+        }
+
+        // Builds the pipeline unless one with the same state exists already. Draws look it up with the returned
+        // key, debugName is only an alias for tools and logs (getPipeline(name) is the slow path)
+        // may throw like build does
+        PipelineKey getOrCreatePipeline(PipelineBuilder& builder, const std::string& debugName = {}) {
+            const PipelineKey key = builder.key();
+            auto it = m_pipelines.find(key);
+            if (it == m_pipelines.end()) {
+                vk::Pipeline pipeline = builder.build();
+                // skipped, ray tracing on a device without it
+                if (!pipeline) return key;
+                it = m_pipelines.emplace(key, PipelineEntry{pipeline, builder.getLayout(), debugName}).first;
+            }
+            if (!debugName.empty()) {
+                m_aliases[debugName] = key;
+                if (it->second.debugName.empty()) it->second.debugName = debugName;
+            }
+            return key;
+        }
+
+        // Same, and the pipeline gets rebuilt when one of its shaders is hot reloaded. The key stays valid
+        // across reloads even though the rebuilt pipeline's state hashes differently
+        PipelineKey getOrCreatePipeline(PipelineBuilder& builder, const std::string& debugName,
+                                        std::vector<std::string> shaders, std::function<vk::Pipeline()> rebuild) {
+            const PipelineKey key = getOrCreatePipeline(builder, debugName);
+            m_reloadRecipes[key] = ReloadRecipe{std::move(shaders), std::move(rebuild)};
+            return key;
+        }
+
+        // Queues the pipeline for compilation on a job worker and returns its key right away. Until it's ready
+        // getPipelineOrFallback hands out fallback (or the default fallback, or nothing-- skip the draw then).
+        // Finished pipelines are picked up by advanceFrame. The builder is copied, its shader modules must live
+        // until isPipelineReady or the compile failed (getPipelineOrFallback keeps returning the fallback)
+        PipelineKey requestPipeline(const PipelineBuilder& builder, const std::string& debugName = {},
+                                    std::optional<PipelineKey> fallback = std::nullopt) {
+            const PipelineKey key = builder.key();
+            if (!debugName.empty()) {
+                m_aliases[debugName] = key;
+            }
+            if (m_pipelines.contains(key) || m_pendingPipelines.contains(key)) {
+                return key;
+            }
+
+            prepareThreadCaches();
+            auto pending = std::make_shared<PendingPipeline>(builder);
+            pending->debugName = debugName;
+            pending->fallback = fallback;
+            m_pendingPipelines.emplace(key, pending);
+            submitCompile(pending);
+            return key;
+        }
+
+        // Builds the pipeline out of graphics pipeline library parts-- vertex input, pre-rasterization, fragment
+        // shader and fragment output are compiled and cached separately, so a material sharing its vertex format,
+        // raster state or render targets with another only compiles what differs. The parts are fast linked right
+        // away, an optimized link runs in the background and advanceFrame swaps it in.
+        // Without fast linking support this is getOrCreatePipeline. May throw like build does
+        PipelineKey getOrCreateLinkedPipeline(PipelineBuilder& builder, const std::string& debugName = {}) {
+            if (!m_libraryLinking || builder.getType() != PipelineBuilder::PipelineType::Graphics) {
+                return getOrCreatePipeline(builder, debugName);
+            }
+            const PipelineKey key = builder.key();
+            if (!debugName.empty()) {
+                m_aliases[debugName] = key;
+            }
+            if (m_pipelines.contains(key)) {
+                return key;
+            }
+
+            std::array<vk::Pipeline, PipelineBuilder::LIBRARY_PART_COUNT> libraries;
+            for (size_t part = 0; part < libraries.size(); ++part) {
+                libraries[part] = getOrCreateLibrary(builder, static_cast<PipelineBuilder::LibraryPart>(part));
+            }
+            m_pipelines.emplace(key, PipelineEntry{builder.linkLibraries(libraries, false), builder.getLayout(), debugName});
+
+            prepareThreadCaches();
+            auto pending = std::make_shared<PendingPipeline>(builder);
+            pending->debugName = debugName;
+            pending->libraries = libraries;
+            m_optimizingPipelines.emplace(key, pending);
+            submitCompile(pending);
+            return key;
         }
 
-        // Cache and manage pipeline lifetime
-        vk::Pipeline cachePipeline(const std::string& name, vk::Pipeline pipeline, vk::PipelineLayout layout) {
-            m_pipelines[name] = pipeline;
+        // amount of cached library parts, for stats
+        size_t getLibraryCount() const {
+            return m_libraries.size();
+        }
+
+        // Pipeline draws use while the requested one compiles, if the request didn't name its own
+        void setFallbackPipeline(std::optional<PipelineKey> fallback) {
+            m_defaultFallback = fallback;
+        }
+
+        // The pipeline if it's ready, otherwise the request's fallback. nullptr means skip the draw
+        vk::Pipeline getPipelineOrFallback(PipelineKey key) const {
+            if (vk::Pipeline pipeline = getPipeline(key)) {
+                return pipeline;
+            }
+            auto pending = m_pendingPipelines.find(key);
+            std::optional<PipelineKey> fallback = m_defaultFallback;
+            if (pending != m_pendingPipelines.end() && pending->second->fallback) {
+                fallback = pending->second->fallback;
+            }
+            return fallback ? getPipeline(*fallback) : nullptr;
+        }
+
+        bool isPipelineReady(PipelineKey key) const {
+            return m_pipelines.contains(key);
+        }
+
+        size_t getPendingPipelineCount() const {
+            return m_pendingPipelines.size();
+        }
+
+        // Moves finished compiles into the cache and swaps in optimized links, called by advanceFrame. Failed requests are dropped, requesting
+        // them again retries
+        // returns amount of pipelines that became ready
+        uint32_t collectCompiledPipelines() {
+            uint32_t ready = 0;
+            std::erase_if(m_pendingPipelines, [&](const auto& item) {
+                const auto& [key, pending] = item;
+                const PendingState state = pending->state.load(std::memory_order_acquire);
+                if (state == PendingState::Compiling) return false;
+                // a null pipeline was skipped (ray tracing unsupported), nothing to cache
+                if (state == PendingState::Ready && pending->pipeline) {
+                    m_pipelines.emplace(key, PipelineEntry{pending->pipeline, pending->builder.getLayout(), pending->debugName});
+                    ++ready;
+                }
+                return true;
+            });
+
+            // optimized links replace their fast linked pipeline, which in flight frames may still be using
+            std::erase_if(m_optimizingPipelines, [&](const auto& item) {
+                const auto& [key, pending] = item;
+                const PendingState state = pending->state.load(std::memory_order_acquire);
+                if (state == PendingState::Compiling) return false;
+                if (state == PendingState::Ready) {
+                    auto it = m_pipelines.find(key);
+                    if (it == m_pipelines.end() || pending->discard) {
+                        m_context.device.destroyPipeline(pending->pipeline);
+                    } else {
+                        m_retiredPipelines.push_back({it->second.pipeline, FRAMES});
+                        it->second.pipeline = pending->pipeline;
+                        ++ready;
+                    }
+                }
+                return true;
+            });
+            return ready;
+        }
+
+        // Blocks until every requested pipeline is compiled (loading screens, shutdown)
+        void waitForPendingPipelines() {
+            JobSystem::WaitForCounter(m_compileJobs);
+            collectCompiledPipelines();
+        }
+
+        // Cache a pipeline built elsewhere and manage its lifetime. There's no builder state to hash, so it's
+        // keyed by its name and the layout is owned by the manager from here on
+        PipelineKey cachePipeline(const std::string& name, vk::Pipeline pipeline, vk::PipelineLayout layout) {
+            const PipelineKey key = AngelBase::Core::Hash::fnv1a64(std::string_view(name));
+            m_pipelines[key] = PipelineEntry{pipeline, layout, name};
+            m_aliases[name] = key;
             m_pipelineLayouts[name] = layout;
-            return pipeline;
+            return key;
         }
 
-        // Retrieve cached pipeline by name
-        vk::Pipeline getPipeline(const std::string& name) const {
-            auto it = m_pipelines.find(name);
+        // Cache a pipeline that gets rebuilt when one of its shaders is hot reloaded.
+        // rebuild recreates it from scratch (shader modules included) and may throw-- the old pipeline stays then
+        PipelineKey cachePipeline(const std::string& name, vk::Pipeline pipeline, vk::PipelineLayout layout,
+                                  std::vector<std::string> shaders, std::function<vk::Pipeline()> rebuild) {
+            const PipelineKey key = cachePipeline(name, pipeline, layout);
+            m_reloadRecipes[key] = ReloadRecipe{std::move(shaders), std::move(rebuild)};
+            return key;
+        }
+
+        // Rebuilds every pipeline using one of the given shaders and swaps it in. Old pipelines are destroyed
+        // FRAMES frames later since in flight command buffers may still reference them
+        // returns amount of pipelines swapped
+        uint32_t reloadPipelinesUsing(const std::vector<std::string>& shaders) {
+            uint32_t swapped = 0;
+            for (auto& [key, recipe] : m_reloadRecipes) {
+                bool uses = std::ranges::any_of(recipe.shaders, [&](const std::string& shader) {
+                    return std::ranges::find(shaders, shader) != shaders.end();
+                });
+                if (!uses) continue;
+
+                vk::Pipeline rebuilt = nullptr;
+                try {
+                    rebuilt = recipe.rebuild();
+                } catch (const std::exception& e) {
+                    std::cerr << "Failed to rebuild pipeline " << debugName(key) << ": " << e.what() << std::endl;
+                    continue;
+                }
+                if (!rebuilt) continue;
+
+                // an optimized link still in flight is of the old shaders
+                if (auto optimizing = m_optimizingPipelines.find(key); optimizing != m_optimizingPipelines.end()) {
+                    optimizing->second->discard = true;
+                }
+                auto it = m_pipelines.find(key);
+                if (it != m_pipelines.end()) {
+                    m_retiredPipelines.push_back({it->second.pipeline, FRAMES});
+                    it->second.pipeline = rebuilt;
+                } else {
+                    m_context.device.destroyPipeline(rebuilt);
+                    continue;
+                }
+                ++swapped;
+            }
+            return swapped;
+        }
+
+        // Call once per frame, picks up pipelines compiled in the background and destroys retired pipelines no
+        // frame can still be using
+        void advanceFrame() {
+            collectCompiledPipelines();
+
+            for (auto& retired : m_retiredPipelines) {
+                --retired.framesLeft;
+            }
+            std::erase_if(m_retiredPipelines, [this](const RetiredPipeline& retired) {
+                if (retired.framesLeft > 0) return false;
+                m_context.device.destroyPipeline(retired.pipeline);
+                return true;
+            });
+        }
+
+        // Retrieve cached pipeline by key
+        vk::Pipeline getPipeline(PipelineKey key) const {
+            auto it = m_pipelines.find(key);
             if (it != m_pipelines.end()) {
+                return it->second.pipeline;
+            }
+            return nullptr;
+        }
+
+        // Retrieve cached pipeline by debug name-- hashes the string, resolve it once with getPipelineKey instead
+        vk::Pipeline getPipeline(const std::string& name) const {
+            auto key = getPipelineKey(name);
+            return key ? getPipeline(*key) : nullptr;
+        }
+
+        // Key a debug name is an alias of
+        std::optional<PipelineKey> getPipelineKey(const std::string& name) const {
+            auto it = m_aliases.find(name);
+            if (it != m_aliases.end()) {
                 return it->second;
             }
+            return std::nullopt;
+        }
+
+        // Retrieve the layout a cached pipeline was built with
+        vk::PipelineLayout getPipelineLayout(PipelineKey key) const {
+            auto it = m_pipelines.find(key);
+            if (it != m_pipelines.end()) {
+                return it->second.layout;
+            }
             return nullptr;
         }
 
@@ -338,7 +1100,13 @@ namespace Rendering::Vulkan
             if (it != m_pipelineLayouts.end()) {
                 return it->second;
             }
-            return nullptr;
+            auto key = getPipelineKey(name);
+            return key ? getPipelineLayout(*key) : nullptr;
+        }
+
+        // amount of distinct pipelines, for stats
+        size_t getPipelineCount() const {
+            return m_pipelines.size();
         }
 
         // Create and cache pipeline layout
@@ -356,42 +1124,404 @@ namespace Rendering::Vulkan
             return layout;
         }
 
+        // Create and cache pipeline layout, push constants straight from shader reflection
+        vk::PipelineLayout createPipelineLayout(const std::string& name,
+                                               const std::vector<vk::DescriptorSetLayout>& setLayouts,
+                                               const ShaderReflection& reflection) {
+            return createPipelineLayout(name, setLayouts, reflection.pushConstantRanges());
+        }
+
+        // Set layout used for unbounded texture arrays (the bindless set from DescriptorManager), and how many
+        // descriptors a derived layout should give them if it isn't used
+        void setBindlessTextureLayout(vk::DescriptorSetLayout layout, uint32_t capacity) {
+            m_bindlessLayout = layout;
+            m_bindlessCapacity = capacity;
+        }
+
+        // Derives set layouts and push constant ranges from reflection. Layouts are deduplicated by hash, so
+        // every pipeline with the same shader interface gets the same vk::PipelineLayout-- owned by the manager,
+        // pass it to cachePipeline freely
+        vk::PipelineLayout getOrCreatePipelineLayout(const ShaderReflection& reflection) {
+            using namespace AngelBase::Core;
+
+            // set index -> bindings
+            std::map<uint32_t, std::vector<DerivedBinding>> sets;
+            for (const auto& buffer : reflection.uniformBuffers) {
+                sets[buffer.set].push_back({vk::DescriptorSetLayoutBinding(buffer.binding, vk::DescriptorType::eUniformBuffer, 1, buffer.stages), {}});
+            }
+            for (const auto& texture : reflection.textures) {
+                DerivedBinding binding{vk::DescriptorSetLayoutBinding(texture.binding, toDescriptorType(texture.type), texture.count, texture.stages), {}};
+                if (texture.count == ShaderReflection::UNBOUNDED) {
+                    binding.binding.descriptorCount = m_bindlessCapacity;
+                    binding.flags = vk::DescriptorBindingFlagBits::ePartiallyBound |
+                                    vk::DescriptorBindingFlagBits::eVariableDescriptorCount |
+                                    vk::DescriptorBindingFlagBits::eUpdateAfterBind;
+                }
+                sets[texture.set].push_back(binding);
+            }
+
+            std::vector<vk::DescriptorSetLayout> setLayouts;
+            const uint32_t setCount = sets.empty() ? 0 : sets.rbegin()->first + 1;
+            for (uint32_t set = 0; set < setCount; ++set) {
+                auto it = sets.find(set);
+                // holes still need a (empty) layout
+                setLayouts.push_back(getOrCreateSetLayout(it != sets.end() ? it->second : std::vector<DerivedBinding>{}));
+            }
+
+            // everything but buffer device address pointers goes through descriptors, pointers are push constants
+            std::vector<vk::PushConstantRange> pushConstants = reflection.pushConstantRanges();
+
+            uint64_t key = 0;
+            for (vk::DescriptorSetLayout layout : setLayouts) {
+                key = Hash::combine(key, reinterpret_cast<uint64_t>(static_cast<VkDescriptorSetLayout>(layout)));
+            }
+            for (const auto& range : pushConstants) {
+                key = Hash::combine(key, static_cast<uint32_t>(range.stageFlags));
+                key = Hash::combine(key, (static_cast<uint64_t>(range.offset) << 32) | range.size);
+            }
+
+            auto existing = m_sharedLayouts.find(key);
+            if (existing != m_sharedLayouts.end()) {
+                return existing->second;
+            }
+
+            vk::PipelineLayoutCreateInfo layoutInfo{};
+            layoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+            layoutInfo.pSetLayouts = setLayouts.data();
+            layoutInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstants.size());
+            layoutInfo.pPushConstantRanges = pushConstants.data();
+
+            vk::PipelineLayout layout = m_context.device.createPipelineLayout(layoutInfo);
+            m_sharedLayouts.emplace(key, layout);
+            m_sharedLayoutHandles.insert(static_cast<VkPipelineLayout>(layout));
+            return layout;
+        }
+
+        // amount of distinct derived layouts, for stats
+        size_t getSharedLayoutCount() const {
+            return m_sharedLayouts.size();
+        }
+
         // Check if pipeline exists
+        bool hasPipeline(PipelineKey key) const {
+            return m_pipelines.contains(key);
+        }
+
         bool hasPipeline(const std::string& name) const {
-            return m_pipelines.find(name) != m_pipelines.end();
+            auto key = getPipelineKey(name);
+            return key && hasPipeline(*key);
         }
 
-        // Remove specific pipeline
-        void removePipeline(const std::string& name) {
-            auto pipelineIt = m_pipelines.find(name);
+        // Remove specific pipeline, along with every alias of it. Deduplicated pipelines are shared, so this
+        // removes it for everyone that got the same key
+        void removePipeline(PipelineKey key) {
+            m_reloadRecipes.erase(key);
+            if (auto optimizing = m_optimizingPipelines.find(key); optimizing != m_optimizingPipelines.end()) {
+                optimizing->second->discard = true;
+            }
+            auto pipelineIt = m_pipelines.find(key);
             if (pipelineIt != m_pipelines.end()) {
-                m_context.device.destroyPipeline(pipelineIt->second);
+                m_context.device.destroyPipeline(pipelineIt->second.pipeline);
                 m_pipelines.erase(pipelineIt);
             }
+            std::erase_if(m_aliases, [key](const auto& alias) { return alias.second == key; });
+        }
+
+        void removePipeline(const std::string& name) {
+            if (auto key = getPipelineKey(name)) {
+                removePipeline(*key);
+            }
 
             auto layoutIt = m_pipelineLayouts.find(name);
             if (layoutIt != m_pipelineLayouts.end()) {
-                m_context.device.destroyPipelineLayout(layoutIt->second);
+                if (!isSharedLayout(layoutIt->second)) {
+                    m_context.device.destroyPipelineLayout(layoutIt->second);
+                }
                 m_pipelineLayouts.erase(layoutIt);
             }
         }
 
         // Cleanup all pipelines
         void cleanup() {
-            for (auto& [name, pipeline] : m_pipelines) {
-                m_context.device.destroyPipeline(pipeline);
+            // background compiles finish first (and land in m_pipelines), they'd build into destroyed caches otherwise
+            waitForPendingPipelines();
+            m_pendingPipelines.clear();
+
+            for (auto& [key, entry] : m_pipelines) {
+                m_context.device.destroyPipeline(entry.pipeline);
             }
             m_pipelines.clear();
+            m_aliases.clear();
+            m_optimizingPipelines.clear();
+
+            for (auto& [key, library] : m_libraries) {
+                m_context.device.destroyPipeline(library);
+            }
+            m_libraries.clear();
+
+            for (auto& retired : m_retiredPipelines) {
+                m_context.device.destroyPipeline(retired.pipeline);
+            }
+            m_retiredPipelines.clear();
+            m_reloadRecipes.clear();
 
             for (auto& [name, layout] : m_pipelineLayouts) {
-                m_context.device.destroyPipelineLayout(layout);
+                if (!isSharedLayout(layout)) {
+                    m_context.device.destroyPipelineLayout(layout);
+                }
             }
             m_pipelineLayouts.clear();
+
+            for (auto& [key, layout] : m_sharedLayouts) {
+                m_context.device.destroyPipelineLayout(layout);
+            }
+            m_sharedLayouts.clear();
+            m_sharedLayoutHandles.clear();
+
+            for (auto& [key, layout] : m_setLayouts) {
+                m_context.device.destroyDescriptorSetLayout(layout);
+            }
+            m_setLayouts.clear();
+
+            {
+                std::lock_guard lock(m_workerCacheMutex);
+                for (vk::PipelineCache cache : m_workerCaches) {
+                    m_context.device.destroyPipelineCache(cache);
+                }
+                m_workerCaches.clear();
+                m_threadCaches.clear();
+            }
+            if (m_pipelineCache) {
+                m_context.device.destroyPipelineCache(m_pipelineCache);
+                m_pipelineCache = nullptr;
+            }
         }
 
     private:
+        struct DerivedBinding {
+            vk::DescriptorSetLayoutBinding binding;
+            vk::DescriptorBindingFlags flags;
+        };
+
+        static vk::DescriptorType toDescriptorType(ShaderReflection::TextureType type) {
+            switch (type) {
+                case ShaderReflection::TextureType::CombinedSampler: return vk::DescriptorType::eCombinedImageSampler;
+                case ShaderReflection::TextureType::Storage:         return vk::DescriptorType::eStorageImage;
+                case ShaderReflection::TextureType::Sampler:         return vk::DescriptorType::eSampler;
+                case ShaderReflection::TextureType::Sampled:
+                default:                                             return vk::DescriptorType::eSampledImage;
+            }
+        }
+
+        // our header against the device we're running on
+        bool isCompatible(const PipelineCacheFileHeader& header) const {
+            const vk::PhysicalDeviceProperties properties = m_context.physical_device.getProperties();
+            return header.magic == PIPELINE_CACHE_MAGIC && header.version == PIPELINE_CACHE_VERSION &&
+                   header.vendorID == properties.vendorID && header.deviceID == properties.deviceID &&
+                   header.driverVersion == properties.driverVersion &&
+                   std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID.data(), VK_UUID_SIZE) == 0;
+        }
+
+        // the driver's own header at the front of the data (VkPipelineCacheHeaderVersionOne). Drivers should reject
+        // foreign data themselves, not all of them do
+        bool isCompatibleCacheData(const std::vector<uint8_t>& data) const {
+            VkPipelineCacheHeaderVersionOne header{};
+            if (data.size() < sizeof(header)) return false;
+            std::memcpy(&header, data.data(), sizeof(header));
+            const vk::PhysicalDeviceProperties properties = m_context.physical_device.getProperties();
+            return header.headerSize >= sizeof(header) && header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+                   header.vendorID == properties.vendorID && header.deviceID == properties.deviceID &&
+                   std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID.data(), VK_UUID_SIZE) == 0;
+        }
+
+        bool isSharedLayout(vk::PipelineLayout layout) const {
+            return m_sharedLayoutHandles.contains(static_cast<VkPipelineLayout>(layout));
+        }
+
+        vk::DescriptorSetLayout getOrCreateSetLayout(std::vector<DerivedBinding> bindings) {
+            using namespace AngelBase::Core;
+            std::ranges::sort(bindings, {}, [](const DerivedBinding& b) { return b.binding.binding; });
+
+            // only a combined image sampler array at binding 0 is exactly DescriptorManager's set-- Texture2D[] or
+            // storage image arrays reflect as other types and need a layout of their own
+            if (m_bindlessLayout && bindings.size() == 1 && bindings[0].binding.binding == 0 &&
+                bindings[0].binding.descriptorType == vk::DescriptorType::eCombinedImageSampler &&
+                (bindings[0].flags & vk::DescriptorBindingFlagBits::eVariableDescriptorCount)) {
+                return m_bindlessLayout;
+            }
+
+            // Vulkan only allows a variable count on the highest binding of a set. Unbounded arrays below it keep
+            // a fixed, partially bound capacity instead
+            for (size_t i = 0; i + 1 < bindings.size(); ++i) {
+                if (bindings[i].flags & vk::DescriptorBindingFlagBits::eVariableDescriptorCount) {
+                    std::cerr << "Unbounded array at binding " << bindings[i].binding.binding
+                              << " isn't the last binding of its set, giving it a fixed capacity of "
+                              << bindings[i].binding.descriptorCount << std::endl;
+                    bindings[i].flags &= ~vk::DescriptorBindingFlags(vk::DescriptorBindingFlagBits::eVariableDescriptorCount);
+                }
+            }
+
+            uint64_t key = 0;
+            bool updateAfterBind = false;
+            for (const auto& [binding, flags] : bindings) {
+                key = Hash::combine(key, binding.binding);
+                key = Hash::combine(key, static_cast<uint64_t>(binding.descriptorType));
+                key = Hash::combine(key, binding.descriptorCount);
+                key = Hash::combine(key, static_cast<uint32_t>(binding.stageFlags));
+                key = Hash::combine(key, static_cast<uint32_t>(flags));
+                updateAfterBind |= static_cast<bool>(flags & vk::DescriptorBindingFlagBits::eUpdateAfterBind);
+            }
+
+            auto existing = m_setLayouts.find(key);
+            if (existing != m_setLayouts.end()) {
+                return existing->second;
+            }
+
+            std::vector<vk::DescriptorSetLayoutBinding> layoutBindings;
+            std::vector<vk::DescriptorBindingFlags> bindingFlags;
+            for (const auto& [binding, flags] : bindings) {
+                layoutBindings.push_back(binding);
+                bindingFlags.push_back(flags);
+            }
+
+            vk::DescriptorSetLayoutBindingFlagsCreateInfo flagsInfo{};
+            flagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+            flagsInfo.pBindingFlags = bindingFlags.data();
+
+            vk::DescriptorSetLayoutCreateInfo layoutInfo{};
+            layoutInfo.pNext = &flagsInfo;
+            layoutInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
+            layoutInfo.pBindings = layoutBindings.data();
+            if (updateAfterBind) {
+                layoutInfo.flags = vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool;
+            }
+
+            vk::DescriptorSetLayout layout = m_context.device.createDescriptorSetLayout(layoutInfo);
+            m_setLayouts.emplace(key, layout);
+            return layout;
+        }
+
+        std::string debugName(PipelineKey key) const {
+            auto it = m_pipelines.find(key);
+            if (it != m_pipelines.end() && !it->second.debugName.empty()) {
+                return it->second.debugName;
+            }
+            return std::format("{:016x}", key);
+        }
+
+        struct PipelineEntry {
+            vk::Pipeline pipeline;
+            // not owned, comes from getOrCreatePipelineLayout or createPipelineLayout
+            vk::PipelineLayout layout;
+            // first name it was requested under
+            std::string debugName;
+        };
+
+        enum class PendingState : uint8_t {
+            Compiling,
+            Ready,
+            Failed
+        };
+
+        // a requestPipeline in flight. Only the compile job touches builder and pipeline until state leaves Compiling
+        struct PendingPipeline {
+            explicit PendingPipeline(const PipelineBuilder& builder) : builder(builder) {}
+
+            PipelineBuilder builder;
+            vk::Pipeline pipeline = nullptr;
+            std::atomic<PendingState> state = PendingState::Compiling;
+            std::string debugName;
+            std::optional<PipelineKey> fallback;
+            // set for optimized links of these library parts instead of a build
+            std::optional<std::array<vk::Pipeline, PipelineBuilder::LIBRARY_PART_COUNT>> libraries;
+            // main thread only, the result is destroyed instead of swapped in
+            bool discard = false;
+        };
+
+        // low priority, streaming in a material must not hold up the frame's jobs
+        void submitCompile(std::shared_ptr<PendingPipeline> pending) {
+            JobSystem::SubmitJob(JobSystem::Job{"CompilePipeline", [this, pending]() {
+                const uint32_t worker = JobSystem::WorkerIndex();
+                const size_t cacheIndex = worker == JobSystem::NOT_A_WORKER ? m_threadCaches.size() - 1
+                                                                            : std::min<size_t>(worker, m_threadCaches.size() - 1);
+                try {
+                    pending->builder.setPipelineCache(m_threadCaches[cacheIndex]);
+                    pending->pipeline = pending->libraries ? pending->builder.linkLibraries(*pending->libraries, true)
+                                                           : pending->builder.build();
+                    pending->state.store(PendingState::Ready, std::memory_order_release);
+                } catch (const std::exception& e) {
+                    std::cerr << "Failed to compile pipeline " << pending->debugName << ": " << e.what() << std::endl;
+                    pending->state.store(PendingState::Failed, std::memory_order_release);
+                }
+            }}, m_compileJobs, JobSystem::Priority::Low);
+        }
+
+        // library parts live until cleanup, linked pipelines and optimized links in flight reference them
+        vk::Pipeline getOrCreateLibrary(PipelineBuilder& builder, PipelineBuilder::LibraryPart part) {
+            const PipelineKey key = builder.libraryKey(part);
+            auto it = m_libraries.find(key);
+            if (it != m_libraries.end()) {
+                return it->second;
+            }
+            vk::Pipeline library = builder.buildLibrary(part);
+            m_libraries.emplace(key, library);
+            return library;
+        }
+
+        // one cache per job worker plus one for other threads, so background compiles don't contend on a cache
+        void prepareThreadCaches() {
+            const size_t count = JobSystem::WorkerCount() + 1;
+            while (m_threadCaches.size() < count) {
+                vk::PipelineCache cache = createWorkerCache();
+                std::lock_guard lock(m_workerCacheMutex);
+                m_threadCaches.push_back(cache);
+            }
+        }
+
+        struct ReloadRecipe {
+            std::vector<std::string> shaders;
+            std::function<vk::Pipeline()> rebuild;
+        };
+
+        struct RetiredPipeline {
+            vk::Pipeline pipeline;
+            uint32_t framesLeft;
+        };
+
         const Context& m_context;
-        std::unordered_map<std::string, vk::Pipeline> m_pipelines;
+        // keyed by state hash, names only alias into it
+        std::unordered_map<PipelineKey, PipelineEntry> m_pipelines;
+        std::unordered_map<std::string, PipelineKey> m_aliases;
         std::unordered_map<std::string, vk::PipelineLayout> m_pipelineLayouts;
+        std::unordered_map<PipelineKey, ReloadRecipe> m_reloadRecipes;
+        std::vector<RetiredPipeline> m_retiredPipelines;
+
+        // derived from reflection, keyed by content hash
+        std::unordered_map<uint64_t, vk::DescriptorSetLayout> m_setLayouts;
+        std::unordered_map<uint64_t, vk::PipelineLayout> m_sharedLayouts;
+        std::unordered_set<VkPipelineLayout> m_sharedLayoutHandles;
+        vk::DescriptorSetLayout m_bindlessLayout = nullptr;
+        uint32_t m_bindlessCapacity = 1;
+
+        // persisted across runs, see loadPipelineCache
+        vk::PipelineCache m_pipelineCache = nullptr;
+        std::string m_cachePath;
+        std::mutex m_workerCacheMutex;
+        std::vector<vk::PipelineCache> m_workerCaches;
+        // indexed by JobSystem::WorkerIndex(), the last one for threads that aren't workers. Part of m_workerCaches
+        std::vector<vk::PipelineCache> m_threadCaches;
+
+        // requestPipeline, only touched on the thread that owns the manager
+        std::unordered_map<PipelineKey, std::shared_ptr<PendingPipeline>> m_pendingPipelines;
+        std::optional<PipelineKey> m_defaultFallback;
+        Atomics::Counter m_compileJobs;
+
+        // builders point at it, lives as long as the manager
+        RayTracingSupport m_rayTracing;
+
+        // graphics pipeline library parts by libraryKey, and the optimized links in flight
+        bool m_libraryLinking = false;
+        std::unordered_map<PipelineKey, vk::Pipeline> m_libraries;
+        std::unordered_map<PipelineKey, std::shared_ptr<PendingPipeline>> m_optimizingPipelines;
     };
 }
\ No newline at end of file
@@ -0,0 +1,246 @@
+module;
+#include <vulkan/vulkan.hpp>
+#include "vk_mem_alloc.h"
+
+export module VulkanRayTracing;
+import VulkanContext;
+
+import std;
+
+namespace Rendering::Vulkan
+{
+    // What the device offers for ray tracing pipelines. Extension functions aren't exported by the loader, so they
+    // go through dispatch. supported is false when the device lacks the extensions-- RT work gets skipped then
+    export struct RayTracingSupport {
+        bool supported = false;
+        vk::PhysicalDeviceRayTracingPipelinePropertiesKHR properties;
+        vk::detail::DispatchLoaderDynamic dispatch;
+    };
+
+    // The device has to be created with VK_KHR_ray_tracing_pipeline, VK_KHR_deferred_host_operations and the
+    // rayTracingPipeline feature enabled for supported to be true in practice, VulkanRenderer requires them
+    export RayTracingSupport queryRayTracingSupport(const Context& context) {
+        RayTracingSupport support;
+        const auto extensions = context.physical_device.enumerateDeviceExtensionProperties();
+        auto hasExtension = [&](const char* name) {
+            return std::ranges::any_of(extensions, [&](const vk::ExtensionProperties& extension) {
+                return std::strcmp(extension.extensionName, name) == 0;
+            });
+        };
+        if (!hasExtension(VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME) ||
+            !hasExtension(VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME)) {
+            return support;
+        }
+
+        const auto features = context.physical_device.getFeatures2<vk::PhysicalDeviceFeatures2,
+            vk::PhysicalDeviceRayTracingPipelineFeaturesKHR>();
+        if (!features.get<vk::PhysicalDeviceRayTracingPipelineFeaturesKHR>().rayTracingPipeline) {
+            return support;
+        }
+
+        const auto properties = context.physical_device.getProperties2<vk::PhysicalDeviceProperties2,
+            vk::PhysicalDeviceRayTracingPipelinePropertiesKHR>();
+        support.properties = properties.get<vk::PhysicalDeviceRayTracingPipelinePropertiesKHR>();
+        support.dispatch = vk::detail::DispatchLoaderDynamic(context.instance, vkGetInstanceProcAddr,
+                                                             context.device, vkGetDeviceProcAddr);
+        support.supported = support.dispatch.vkCreateRayTracingPipelinesKHR != nullptr &&
+                            support.dispatch.vkCreateDeferredOperationKHR != nullptr;
+        return support;
+    }
+
+    // Shader binding table: one buffer holding the raygen, miss, hit and callable regions, each record a group
+    // handle followed by optional inline data (material indices, ...) the shaders read through shaderRecordEXT
+    export class ShaderBindingTable {
+    public:
+        enum class Region : uint8_t {
+            RayGen,
+            Miss,
+            Hit,
+            Callable
+        };
+        static constexpr size_t REGION_COUNT = 4;
+
+        // Which pipeline group each record uses, and the inline data size per record of each region
+        struct Desc {
+            uint32_t rayGenGroup = 0;
+            std::vector<uint32_t> missGroups;
+            std::vector<uint32_t> hitGroups;
+            std::vector<uint32_t> callableGroups;
+            std::array<uint32_t, REGION_COUNT> dataSizes = {0, 0, 0, 0};
+        };
+
+        struct RegionLayout {
+            vk::DeviceSize offset = 0;
+            vk::DeviceSize stride = 0;
+            vk::DeviceSize size = 0;
+            uint32_t count = 0;
+        };
+
+        struct Layout {
+            std::array<RegionLayout, REGION_COUNT> regions;
+            vk::DeviceSize totalSize = 0;
+        };
+
+        ShaderBindingTable() = delete;
+        ShaderBindingTable(const Context& context, const RayTracingSupport& support)
+            : m_context(context), m_support(support) {}
+
+        ~ShaderBindingTable() {
+            destroy();
+        }
+
+        ShaderBindingTable(const ShaderBindingTable&) = delete;
+        ShaderBindingTable& operator=(const ShaderBindingTable&) = delete;
+
+        // Packs the records: strides rounded to shaderGroupHandleAlignment, regions starting on
+        // shaderGroupBaseAlignment, raygen's size equal to its stride like vkCmdTraceRaysKHR wants.
+        // Pure math, so it can be checked against the device's numbers without a device
+        static Layout computeLayout(const Desc& desc, uint32_t handleSize, uint32_t handleAlignment, uint32_t baseAlignment) {
+            auto alignUp = [](vk::DeviceSize value, vk::DeviceSize alignment) {
+                return (value + alignment - 1) & ~(alignment - 1);
+            };
+            const std::array<uint32_t, REGION_COUNT> counts = {
+                1u,
+                static_cast<uint32_t>(desc.missGroups.size()),
+                static_cast<uint32_t>(desc.hitGroups.size()),
+                static_cast<uint32_t>(desc.callableGroups.size())
+            };
+
+            Layout layout;
+            vk::DeviceSize offset = 0;
+            for (size_t region = 0; region < REGION_COUNT; ++region) {
+                RegionLayout& out = layout.regions[region];
+                out.count = counts[region];
+                out.stride = alignUp(handleSize + desc.dataSizes[region], handleAlignment);
+                if (region == static_cast<size_t>(Region::RayGen)) {
+                    // raygen's stride must be a multiple of the base alignment as well, since size == stride
+                    out.stride = alignUp(out.stride, baseAlignment);
+                }
+                out.size = out.count ? alignUp(out.stride * out.count, baseAlignment) : 0;
+                out.offset = offset;
+                offset += out.size;
+            }
+            layout.totalSize = offset;
+            return layout;
+        }
+
+        // Creates the table for pipeline (a ray tracing pipeline with groupCount groups), replacing the old one.
+        // The buffer is host visible so records can be patched in place, the GPU reads it from wherever VMA put it
+        // returns false if ray tracing isn't supported or the table couldn't be created
+        bool build(vk::Pipeline pipeline, uint32_t groupCount, const Desc& desc) {
+            if (!m_support.supported || !pipeline) {
+                return false;
+            }
+            const auto& properties = m_support.properties;
+            const Layout layout = computeLayout(desc, properties.shaderGroupHandleSize,
+                                                properties.shaderGroupHandleAlignment, properties.shaderGroupBaseAlignment);
+            for (const RegionLayout& region : layout.regions) {
+                if (region.count && region.stride > properties.maxShaderGroupStride) {
+                    std::cerr << "Shader binding table record stride " << region.stride << " exceeds maxShaderGroupStride" << std::endl;
+                    return false;
+                }
+            }
+
+            const uint32_t handleSize = properties.shaderGroupHandleSize;
+            std::vector<uint8_t> handles(static_cast<size_t>(groupCount) * handleSize);
+            const vk::Result result = static_cast<vk::Result>(m_support.dispatch.vkGetRayTracingShaderGroupHandlesKHR(
+                m_context.device, pipeline, 0, groupCount, handles.size(), handles.data()));
+            if (result != vk::Result::eSuccess) {
+                std::cerr << "Failed to get ray tracing shader group handles" << std::endl;
+                return false;
+            }
+
+            destroy();
+            vk::BufferCreateInfo bufferInfo{};
+            bufferInfo.size = std::max<vk::DeviceSize>(layout.totalSize, 1);
+            bufferInfo.usage = vk::BufferUsageFlagBits::eShaderBindingTableKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress;
+
+            VmaAllocationCreateInfo allocationInfo{};
+            allocationInfo.usage = VMA_MEMORY_USAGE_AUTO;
+            allocationInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+            VmaAllocationInfo allocated{};
+            if (vmaCreateBufferWithAlignment(m_context.vram_allocator, reinterpret_cast<const VkBufferCreateInfo*>(&bufferInfo),
+                                             &allocationInfo, properties.shaderGroupBaseAlignment,
+                                             reinterpret_cast<VkBuffer*>(&m_buffer), &m_allocation, &allocated) != VK_SUCCESS) {
+                std::cerr << "Failed to create shader binding table buffer" << std::endl;
+                m_buffer = nullptr;
+                return false;
+            }
+            m_mapped = static_cast<uint8_t*>(allocated.pMappedData);
+            std::memset(m_mapped, 0, static_cast<size_t>(layout.totalSize));
+
+            const std::array<std::span<const uint32_t>, REGION_COUNT> groups = {
+                std::span<const uint32_t>(&desc.rayGenGroup, 1),
+                std::span<const uint32_t>(desc.missGroups),
+                std::span<const uint32_t>(desc.hitGroups),
+                std::span<const uint32_t>(desc.callableGroups)
+            };
+            for (size_t region = 0; region < REGION_COUNT; ++region) {
+                const RegionLayout& regionLayout = layout.regions[region];
+                for (uint32_t i = 0; i < regionLayout.count; ++i) {
+                    const uint32_t group = groups[region][i];
+                    if (group >= groupCount) {
+                        std::cerr << "Shader binding table references group " << group << " of " << groupCount << std::endl;
+                        destroy();
+                        return false;
+                    }
+                    std::memcpy(m_mapped + regionLayout.offset + regionLayout.stride * i,
+                                handles.data() + static_cast<size_t>(group) * handleSize, handleSize);
+                }
+            }
+            m_layout = layout;
+            m_dataSizes = desc.dataSizes;
+            vmaFlushAllocation(m_context.vram_allocator, m_allocation, 0, VK_WHOLE_SIZE);
+
+            m_address = m_context.device.getBufferAddress(vk::BufferDeviceAddressInfo(m_buffer));
+            return true;
+        }
+
+        // Writes the inline data of one record, visible to rays traced after this
+        bool setRecordData(Region region, uint32_t index, std::span<const uint8_t> data) {
+            const RegionLayout& regionLayout = m_layout.regions[static_cast<size_t>(region)];
+            if (!m_mapped || index >= regionLayout.count || data.size() > m_dataSizes[static_cast<size_t>(region)]) {
+                return false;
+            }
+            const vk::DeviceSize offset = regionLayout.offset + regionLayout.stride * index + m_support.properties.shaderGroupHandleSize;
+            std::memcpy(m_mapped + offset, data.data(), data.size());
+            vmaFlushAllocation(m_context.vram_allocator, m_allocation, offset, data.size());
+            return true;
+        }
+
+        // Region as vkCmdTraceRaysKHR takes it, empty if the table has no records there
+        vk::StridedDeviceAddressRegionKHR getRegion(Region region) const {
+            const RegionLayout& regionLayout = m_layout.regions[static_cast<size_t>(region)];
+            if (!m_buffer || regionLayout.count == 0) {
+                return {};
+            }
+            return vk::StridedDeviceAddressRegionKHR(m_address + regionLayout.offset, regionLayout.stride, regionLayout.size);
+        }
+
+        const Layout& getLayout() const {
+            return m_layout;
+        }
+
+        void destroy() {
+            if (m_buffer) {
+                vmaDestroyBuffer(m_context.vram_allocator, static_cast<VkBuffer>(m_buffer), m_allocation);
+            }
+            m_buffer = nullptr;
+            m_allocation = nullptr;
+            m_mapped = nullptr;
+            m_address = 0;
+            m_layout = {};
+        }
+
+    private:
+        const Context& m_context;
+        const RayTracingSupport& m_support;
+
+        vk::Buffer m_buffer = nullptr;
+        VmaAllocation m_allocation = nullptr;
+        uint8_t* m_mapped = nullptr;
+        vk::DeviceAddress m_address = 0;
+        Layout m_layout;
+        std::array<uint32_t, REGION_COUNT> m_dataSizes = {0, 0, 0, 0};
+    };
+}
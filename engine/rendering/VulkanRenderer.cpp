@@ -23,15 +23,21 @@ import WindowManager;
 import VulkanSwapchain;
 import RenderTargetManager;
 import VulkanCommand;
+import VulkanTransfer;
 import VulkanDescriptors;
 import ServiceLocator;
 import ShaderManager;
 import VulkanPipeline;
 import TextureManager;
+import FileLoaderSystem;
 VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
 
 namespace Rendering::Vulkan
 {
+	// shader and pipeline caches are compiler, device and driver specific-- kept next to the binary (the build tree,
+	// like ../assets), never in the source tree or the packed archive
+	constexpr const char* RUNTIME_CACHE_DIRECTORY = "cache";
+
 		// LIFO deletion stack for async GPU cleanup
 	struct DeleteStack
 	{
@@ -68,11 +74,20 @@ namespace Rendering::Vulkan
 		// a la the same
 		std::shared_ptr<CommandPoolManager> m_command_pool_manager;
 
+		std::shared_ptr<UploadScheduler> m_upload_scheduler;
+
+		std::shared_ptr<StagingRing> m_staging_ring;
+
 		std::shared_ptr<DescriptorManager> m_descriptor_manager;
 
 		std::shared_ptr<PipelineManager> m_pipeline_manager;
 
+		std::shared_ptr<ShaderManager> m_shader_manager;
+
 		uint32_t current_frame = 0;
+		// frames rendered so far, paces the command stats log
+		uint64_t frame_number = 0;
+		static constexpr uint64_t COMMAND_STATS_INTERVAL = 120;
 
 		struct FrameResources
 		{
@@ -172,12 +187,6 @@ namespace Rendering::Vulkan
 						const auto& family = queue_families[i];
 						const bool has_graphics = static_cast<bool>(family.queueFlags & vk::QueueFlagBits::eGraphics);
 						const bool has_present = device.getSurfaceSupportKHR(static_cast<uint32_t>(i), m_context.surface);
-						const bool has_transfer = static_cast<bool>(family.queueFlags & vk::QueueFlagBits::eTransfer);
-						if (has_transfer & !has_graphics)
-						{
-							m_context.transfer_queue_index = static_cast<int32_t>(i);
-							continue;
-						}
 						
 						if (has_graphics && has_present)
 						{
@@ -191,6 +200,26 @@ namespace Rendering::Vulkan
 				if (m_context.physical_device == VK_NULL_HANDLE)
 					throw std::runtime_error("Failed to find suitable GPU with Vulkan 1.4 support");
 
+				// Find the transfer queue family: a copy engine (transfer only) runs next to graphics and compute,
+				// any other non graphics family next to graphics. Falls back to the graphics family
+				{
+					const auto queue_families = m_context.physical_device.getQueueFamilyProperties();
+					int32_t best_score = 0;
+					m_context.transfer_queue_index = m_context.graphics_queue_index;
+					for (size_t i = 0; i < queue_families.size(); ++i)
+					{
+						const vk::QueueFlags flags = queue_families[i].queueFlags;
+						if (!(flags & vk::QueueFlagBits::eTransfer) || (flags & vk::QueueFlagBits::eGraphics))
+							continue;
+						const int32_t score = (flags & vk::QueueFlagBits::eCompute) ? 1 : 2;
+						if (score > best_score)
+						{
+							best_score = score;
+							m_context.transfer_queue_index = static_cast<int32_t>(i);
+						}
+					}
+				}
+
 				// Validate device extensions
 				const auto device_extensions = m_context.physical_device.enumerateDeviceExtensionProperties();
 				const std::vector<const char*> required_extensions
@@ -230,7 +259,8 @@ namespace Rendering::Vulkan
 					vk::PhysicalDeviceRayTracingPipelineFeaturesKHR,
 					vk::PhysicalDeviceAccelerationStructureFeaturesKHR,
 					vk::PhysicalDeviceMeshShaderFeaturesEXT,
-					vk::PhysicalDeviceFragmentShadingRateFeaturesKHR>();
+					vk::PhysicalDeviceFragmentShadingRateFeaturesKHR,
+					vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT>();
 
 				const auto& vulkan14 = available_features.get<vk::PhysicalDeviceVulkan14Features>();
 			    const auto& vulkan13 = available_features.get<vk::PhysicalDeviceVulkan13Features>();
@@ -241,6 +271,7 @@ namespace Rendering::Vulkan
 			    const auto& accel_struct = available_features.get<vk::PhysicalDeviceAccelerationStructureFeaturesKHR>();
 			    const auto& mesh_shader = available_features.get<vk::PhysicalDeviceMeshShaderFeaturesEXT>();
 			    const auto& vrs = available_features.get<vk::PhysicalDeviceFragmentShadingRateFeaturesKHR>();
+			    const auto& pipeline_library = available_features.get<vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT>();
 
 			    // Core features
 			    if (!vulkan13.dynamicRendering)
@@ -271,6 +302,8 @@ namespace Rendering::Vulkan
 			        throw std::runtime_error("Mesh shader features are missing");
 			    if (!vrs.pipelineFragmentShadingRate)
 			        throw std::runtime_error("Fragment shading rate feature is missing");
+			    if (!pipeline_library.graphicsPipelineLibrary)
+			        throw std::runtime_error("Graphics pipeline library feature is missing");
 
 			    // Enable required features
 			    vk::StructureChain<
@@ -283,7 +316,8 @@ namespace Rendering::Vulkan
 			        vk::PhysicalDeviceRayTracingPipelineFeaturesKHR,
 			        vk::PhysicalDeviceAccelerationStructureFeaturesKHR,
 			        vk::PhysicalDeviceMeshShaderFeaturesEXT,
-			        vk::PhysicalDeviceFragmentShadingRateFeaturesKHR> enabled_features;
+			        vk::PhysicalDeviceFragmentShadingRateFeaturesKHR,
+			        vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT> enabled_features;
 
 			    auto& enabled_vulkan14 = enabled_features.get<vk::PhysicalDeviceVulkan14Features>();
 			    enabled_vulkan14.setPushDescriptor(VK_TRUE);
@@ -331,21 +365,40 @@ namespace Rendering::Vulkan
 			    auto& enabled_vrs = enabled_features.get<vk::PhysicalDeviceFragmentShadingRateFeaturesKHR>();
 			    enabled_vrs.setPipelineFragmentShadingRate(VK_TRUE);
 
-				// Create queue
-				constexpr float queue_priority = 0.5f;
+			    // pipelines are linked from separately compiled parts, see PipelineManager::getOrCreateLinkedPipeline
+			    auto& enabled_pipeline_library = enabled_features.get<vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT>();
+			    enabled_pipeline_library.setGraphicsPipelineLibrary(VK_TRUE);
+
+				// Create queues: graphics, and transfer from its own family. Without one, a second queue of the
+				// graphics family still lets uploads be submitted apart from rendering
+				constexpr std::array<float, 2> queue_priorities = {0.5f, 0.5f};
+				const bool dedicated_transfer = m_context.transfer_queue_index != m_context.graphics_queue_index;
+				const uint32_t graphics_family_queues = m_context.physical_device.getQueueFamilyProperties()
+					[m_context.graphics_queue_index].queueCount;
+				const uint32_t graphics_queue_count = !dedicated_transfer && graphics_family_queues > 1 ? 2 : 1;
+
+				std::vector<vk::DeviceQueueCreateInfo> queue_infos;
 				vk::DeviceQueueCreateInfo queue_info;
 				queue_info.setQueueFamilyIndex(static_cast<uint32_t>(m_context.graphics_queue_index));
-				queue_info.setQueueCount(1);
-				queue_info.setPQueuePriorities(&queue_priority);
+				queue_info.setQueueCount(graphics_queue_count);
+				queue_info.setPQueuePriorities(queue_priorities.data());
+				queue_infos.push_back(queue_info);
+				if (dedicated_transfer)
+				{
+					queue_info.setQueueFamilyIndex(static_cast<uint32_t>(m_context.transfer_queue_index));
+					queue_info.setQueueCount(1);
+					queue_infos.push_back(queue_info);
+				}
 
 				// Create logical device
 				vk::DeviceCreateInfo device_info;
 				device_info.setPNext(&enabled_features.get<vk::PhysicalDeviceFeatures2>());
-				device_info.setQueueCreateInfos(queue_info);
+				device_info.setQueueCreateInfos(queue_infos);
 				device_info.setPEnabledExtensionNames(required_extensions);
 
 				m_context.device = m_context.physical_device.createDevice(device_info);
 				m_context.graphics_queue = m_context.device.getQueue(m_context.graphics_queue_index, 0);
+				m_context.transfer_queue = m_context.device.getQueue(m_context.transfer_queue_index, dedicated_transfer ? 0 : graphics_queue_count - 1);
 			}
 
 			//4. Initialize Allocator
@@ -408,7 +461,20 @@ namespace Rendering::Vulkan
 				ServiceLocator::Instance()->RegisterSystem<CommandPoolManager>(m_command_pool_manager.get());
 				auto manager = m_command_pool_manager.get();
 				manager->BuildRenderCommandStructures();
+				// secondaries recorded in parallel by the job workers
+				manager->BuildThreadCommandStructures();
 				manager->BuildTransferCommandStructures();
+
+				// texture and mesh uploads, copied on the transfer queue while frames render
+				m_upload_scheduler = std::make_shared<UploadScheduler>(m_context);
+				ServiceLocator::Instance()->RegisterSystem<UploadScheduler>(m_upload_scheduler.get());
+				m_upload_scheduler->BuildUploadStructures();
+
+				// persistently mapped, uploads are staged in it instead of a buffer each
+				m_staging_ring = std::make_shared<StagingRing>(m_context, *m_upload_scheduler);
+				ServiceLocator::Instance()->RegisterSystem<StagingRing>(m_staging_ring.get());
+				if (!m_staging_ring->BuildStagingStructures())
+					throw std::runtime_error("Failed to create the staging ring");
 			}
 
 			//9. Build Sync Structures
@@ -438,35 +504,50 @@ namespace Rendering::Vulkan
 
 			//11. handle shaders
 			{
-				Rendering::ShaderManager shaderManager;
-				shaderManager.initialize();
-				CompiledShader::ShaderError error = shaderManager.compileShader("shader.slang","../assets/shaders").error;
-				if (error != CompiledShader::ShaderError::eSuccess)
+				m_shader_manager = std::make_shared<ShaderManager>();
+				ServiceLocator::Instance()->RegisterSystem<ShaderManager>(m_shader_manager.get());
+				m_shader_manager->initialize();
+				// sources and cache entries stream in next to the texture and mesh reads
+				m_shader_manager->setFileLoader(ServiceLocator::Instance()->Get<AngelBase::Core::FileLoaderSystem>());
+				m_shader_manager->setCacheDirectory(std::string(RUNTIME_CACHE_DIRECTORY) + "/shaders");
+
+				// whole shader set at once, spread over the job workers
+				const std::string shader_directory = "../assets/shaders";
+				std::vector<std::string> shader_names;
+				for (const auto& entry : std::filesystem::directory_iterator(shader_directory))
+				{
+					if (entry.is_regular_file() && entry.path().extension() == ".slang")
+					{
+						shader_names.push_back(entry.path().filename().string());
+					}
+				}
+				for (CompiledShader::ShaderError error : m_shader_manager->compileShaders(shader_names, shader_directory))
 				{
-					assert(false && "Failed to compile shader");
+					if (error != CompiledShader::ShaderError::eSuccess)
+					{
+						assert(false && "Failed to compile shader");
+					}
 				}
+				// saved shaders are recompiled in the background and swapped in by Render
+				m_shader_manager->enableHotReload(shader_directory);
 			}
-			/*
 			//11. Build the pipelines
 			{
 				m_pipeline_manager = std::make_shared<PipelineManager>(m_context);
-
-				vk::PushConstantRange pushConstantRange = {};
-				pushConstantRange.stageFlags = vk::ShaderStageFlagBits::eVertex;
-				pushConstantRange.size = sizeof(vk::DeviceAddress);
-				
-				// Create pipeline layout
-				auto layout = m_pipeline_manager.get()->createPipelineLayout(
-					"main_layout",
-					{m_descriptor_manager.get()->getDescriptorSet()},
-					{pushConstantRange}
-				);
-				
-
-				
+				ServiceLocator::Instance()->RegisterSystem<PipelineManager>(m_pipeline_manager.get());
+				// unbounded texture arrays in shaders map onto the bindless set
+				m_pipeline_manager->setBindlessTextureLayout(m_descriptor_manager->getLayout(), m_descriptor_manager->getTextureCapacity());
+				// pipelines the driver compiled last run, saved again on shutdown
+				m_pipeline_manager->loadPipelineCache(std::string(RUNTIME_CACHE_DIRECTORY) + "/pipeline.cache");
+
+				// push constants (the ShaderData pointer) and the texture array come from reflection, identical
+				// interfaces share one layout
+				const CompiledShader* shader = m_shader_manager->getShader("shader.slang");
+				vk::PipelineLayout layout = shader ? m_pipeline_manager->getOrCreatePipelineLayout(shader->reflection_data) : nullptr;
+				/*
 				auto render_target_manager = m_render_target_manager.get();
 				// Build pipeline
-				auto pipeline = m_pipeline_manager.get()->getBuilder()
+				auto builder = m_pipeline_manager.get()->getBuilder()
 				                                  .setPipelineType(PipelineManager::PipelineBuilder::PipelineType::Graphics)
 				                                  .addShaderStage(vk::ShaderStageFlagBits::eVertex, vertShader)
 				                                  .addShaderStage(vk::ShaderStageFlagBits::eFragment, fragShader)
@@ -476,15 +557,12 @@ namespace Rendering::Vulkan
 				                                  .setColorFormats(render_target_manager->getColorRenderTarget().format)
 				                                  .setDepthFormat(render_target_manager->getDepthRenderTarget().format)
 				                                  .addDynamicState(vk::DynamicState::eViewport)
-				                                  .addDynamicState(vk::DynamicState::eScissor)
-				                                  .build();
+				                                  .addDynamicState(vk::DynamicState::eScissor);
 
-				// Cache it
-				m_pipeline_manager.get()->cachePipeline("main_pipeline", pipeline, layout);
-				
-				
+				// Link it from library parts, or get the existing pipeline with the same state. Draws use the key, the name is for debugging
+				PipelineManager::PipelineKey main_pipeline = m_pipeline_manager.get()->getOrCreateLinkedPipeline(builder, "main_pipeline");
+				*/
 			}
-			*/
 #ifdef _DEBUG
 			//12. initialize imgui
 			{
@@ -497,9 +575,66 @@ namespace Rendering::Vulkan
 
 		void Render()
 		{
+			// the frame's command buffers are recorded again once the GPU is done with them
+			m_command_pool_manager->BeginFrame(current_frame, frame_resources[current_frame].fence);
+			reportCommandStats();
+
+			// pick up hot reloaded shaders between frames
+			std::vector<std::string> reloaded_shaders = m_shader_manager->updateHotReload();
+			if (m_pipeline_manager)
+			{
+				if (!reloaded_shaders.empty())
+				{
+					m_pipeline_manager->reloadPipelinesUsing(reloaded_shaders);
+				}
+				m_pipeline_manager->advanceFrame();
+			}
+			// bindless slots freed FRAMES frames ago become free again, this frame's texture writes go out in one batch
+			m_descriptor_manager->advanceFrame();
+			// copies recorded since the last frame go out as one batch
+			m_upload_scheduler->Submit();
+
+			// the frame's graphics submit acquires what the transfer queue released and waits for those copies only--
+			// draws go into this command buffer too once there are any
+			{
+				vk::CommandBuffer command_buffer = m_command_pool_manager->AcquireCommandBuffer(current_frame);
+				command_buffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+				const uint64_t upload_value = m_upload_scheduler->RecordAcquireBarriers(command_buffer);
+				command_buffer.end();
+
+				vk::CommandBufferSubmitInfo command_buffer_info = {};
+				command_buffer_info.commandBuffer = command_buffer;
+				const vk::SemaphoreSubmitInfo wait_info = m_upload_scheduler->GetWaitInfo(upload_value);
+				vk::SubmitInfo2 submit_info = {};
+				submit_info.setCommandBufferInfos(command_buffer_info);
+				if (upload_value != 0)
+				{
+					submit_info.setWaitSemaphoreInfos(wait_info);
+				}
+				// BeginFrame waits on it before the frame's command buffers are reset
+				m_context.device.resetFences(frame_resources[current_frame].fence);
+				m_context.graphics_queue.submit2(submit_info, frame_resources[current_frame].fence);
+			}
+
 			std::this_thread::sleep_for(std::chrono::milliseconds(5000));
 			//increment frame count, and reset back to 0
 			current_frame = (current_frame + 1) % FRAMES;
+			++frame_number;
+		}
+
+		/**
+		 * Logs the command buffer stats of the frame that just retired-- every COMMAND_STATS_INTERVAL frames, and
+		 * on every frame that had to allocate, since a steady state frame should reuse everything
+		 */
+		void reportCommandStats() const
+		{
+			// the first FRAMES frames have no retired frame yet
+			if (frame_number < FRAMES) return;
+			const CommandFrameStats& stats = m_command_pool_manager->GetLastFrameStats();
+			if (stats.allocations == 0 && frame_number % COMMAND_STATS_INTERVAL != 0) return;
+			std::cout << std::format("Frame {}: {} primary, {} secondary command buffers ({} allocated), recorded in {:.3f} ms ({:.3f} ms across threads)\n",
+			                         frame_number - FRAMES, stats.primaries, stats.secondaries, stats.allocations,
+			                         stats.record_ms, stats.record_cpu_ms);
 		}
 
 		void shutdown()
@@ -513,12 +648,25 @@ namespace Rendering::Vulkan
 				m_context.device.destroyFence(frame_resources[i].fence);
 			}
 
-			//ServiceLocator::Instance()->Unregister<PipelineManager>();
-			//m_pipeline_manager.reset();
+			if (m_pipeline_manager)
+			{
+				m_pipeline_manager->savePipelineCache();
+			}
+			ServiceLocator::Instance()->Unregister<PipelineManager>();
+			m_pipeline_manager.reset();
+
+			ServiceLocator::Instance()->Unregister<ShaderManager>();
+			m_shader_manager.reset();
 			
 			ServiceLocator::Instance()->Unregister<DescriptorManager>();
 			m_descriptor_manager.reset();
 			
+			ServiceLocator::Instance()->Unregister<StagingRing>();
+			m_staging_ring.reset();
+
+			ServiceLocator::Instance()->Unregister<UploadScheduler>();
+			m_upload_scheduler.reset();
+
 			//destroy command pools
 			ServiceLocator::Instance()->Unregister<CommandPoolManager>();
 			m_command_pool_manager.reset();
@@ -0,0 +1,621 @@
+module;
+
+#include <vulkan/vulkan.hpp>
+#include "vk_mem_alloc.h"
+export module VulkanTransfer;
+import std;
+import VulkanContext;
+import ServiceLocator;
+
+namespace Rendering::Vulkan
+{
+    /**
+     * Batches staging copies onto the transfer queue, so uploads run next to rendering instead of stalling it. \n
+     * Every Submit signals the next value of a timeline semaphore-- the graphics submit that first uses the data
+     * waits on exactly that value (GetWaitInfo) and nothing else. When the transfer queue is its own family,
+     * ownership of the destinations is released here and acquired again by RecordAcquireBarriers on the graphics
+     * side. \n
+     * Copies can be recorded from any thread, Submit and RecordAcquireBarriers are the render thread's \n
+     * \b Usage: scheduler->CopyBuffer(staging, vertices, regions); const uint64_t ready = scheduler->Submit();
+     */
+    export class UploadScheduler : public ISystem
+    {
+    public:
+        UploadScheduler(const Vulkan::Context& context)
+            :m_context(context)
+        {
+        }
+        ~UploadScheduler()
+        {
+            if (!timeline_semaphore)
+            {
+                return;
+            }
+            // batches may still be executing
+            WaitForUpload(submitted_value);
+            for (Batch& batch : batches)
+            {
+                m_context.device.destroyCommandPool(batch.command_pool);
+            }
+            m_context.device.destroySemaphore(timeline_semaphore);
+        }
+        UploadScheduler() = delete;
+        UploadScheduler(const UploadScheduler&) = delete;
+        UploadScheduler& operator=(const UploadScheduler&) = delete;
+        UploadScheduler(UploadScheduler&&) = delete;
+        UploadScheduler& operator=(UploadScheduler&&) = delete;
+
+        /**
+         * Creates the timeline semaphore. Call after the device and its transfer queue exist
+         */
+        void BuildUploadStructures()
+        {
+            vk::SemaphoreTypeCreateInfo timeline_info = {};
+            timeline_info.semaphoreType = vk::SemaphoreType::eTimeline;
+            timeline_info.initialValue = 0;
+            vk::SemaphoreCreateInfo semaphore_info = {};
+            semaphore_info.pNext = &timeline_info;
+            timeline_semaphore = m_context.device.createSemaphore(semaphore_info);
+        }
+
+        /**
+         * Records a buffer to buffer copy into the batch being recorded
+         * @param source staging buffer
+         * @param destination buffer the data ends up in
+         * @param regions copies to make
+         * @param dst_stage stages the graphics queue first uses destination in
+         * @param dst_access how it's used there
+         * @return value the copy is done at, see Submit
+         */
+        uint64_t CopyBuffer(vk::Buffer source, vk::Buffer destination, std::span<const vk::BufferCopy> regions,
+                            vk::PipelineStageFlags2 dst_stage = vk::PipelineStageFlagBits2::eAllCommands,
+                            vk::AccessFlags2 dst_access = vk::AccessFlagBits2::eMemoryRead)
+        {
+            std::lock_guard lock(record_mutex);
+            vk::CommandBuffer command_buffer = recordingCommandBuffer();
+            command_buffer.copyBuffer(source, destination, static_cast<uint32_t>(regions.size()), regions.data());
+
+            vk::BufferMemoryBarrier2 barrier = {};
+            barrier.srcStageMask = vk::PipelineStageFlagBits2::eCopy;
+            barrier.srcAccessMask = vk::AccessFlagBits2::eTransferWrite;
+            barrier.buffer = destination;
+            barrier.offset = 0;
+            barrier.size = vk::WholeSize;
+            if (!isDedicated())
+            {
+                barrier.dstStageMask = dst_stage;
+                barrier.dstAccessMask = dst_access;
+                command_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, barrier, {}));
+                return next_value;
+            }
+            // release here, the graphics queue acquires with the same barrier
+            barrier.srcQueueFamilyIndex = static_cast<uint32_t>(m_context.transfer_queue_index);
+            barrier.dstQueueFamilyIndex = static_cast<uint32_t>(m_context.graphics_queue_index);
+            command_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, barrier, {}));
+
+            barrier.srcStageMask = vk::PipelineStageFlagBits2::eNone;
+            barrier.srcAccessMask = vk::AccessFlagBits2::eNone;
+            barrier.dstStageMask = dst_stage;
+            barrier.dstAccessMask = dst_access;
+            recording_acquires.buffers.push_back(barrier);
+            return next_value;
+        }
+
+        /**
+         * Records a buffer to image copy into the batch being recorded. The whole range is transitioned from
+         * undefined, its old contents are discarded
+         * @param source staging buffer
+         * @param destination image the data ends up in
+         * @param regions copies to make
+         * @param range subresources the regions cover
+         * @param final_layout layout the graphics queue finds the image in
+         * @param dst_stage stages the graphics queue first uses destination in
+         * @param dst_access how it's used there
+         * @return value the copy is done at, see Submit
+         */
+        uint64_t CopyBufferToImage(vk::Buffer source, vk::Image destination, std::span<const vk::BufferImageCopy> regions,
+                                   const vk::ImageSubresourceRange& range,
+                                   vk::ImageLayout final_layout = vk::ImageLayout::eShaderReadOnlyOptimal,
+                                   vk::PipelineStageFlags2 dst_stage = vk::PipelineStageFlagBits2::eAllCommands,
+                                   vk::AccessFlags2 dst_access = vk::AccessFlagBits2::eShaderSampledRead)
+        {
+            std::lock_guard lock(record_mutex);
+            vk::CommandBuffer command_buffer = recordingCommandBuffer();
+
+            vk::ImageMemoryBarrier2 to_transfer = {};
+            to_transfer.srcStageMask = vk::PipelineStageFlagBits2::eNone;
+            to_transfer.srcAccessMask = vk::AccessFlagBits2::eNone;
+            to_transfer.dstStageMask = vk::PipelineStageFlagBits2::eCopy;
+            to_transfer.dstAccessMask = vk::AccessFlagBits2::eTransferWrite;
+            to_transfer.oldLayout = vk::ImageLayout::eUndefined;
+            to_transfer.newLayout = vk::ImageLayout::eTransferDstOptimal;
+            to_transfer.image = destination;
+            to_transfer.subresourceRange = range;
+            command_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, {}, to_transfer));
+
+            command_buffer.copyBufferToImage(source, destination, vk::ImageLayout::eTransferDstOptimal,
+                                             static_cast<uint32_t>(regions.size()), regions.data());
+
+            vk::ImageMemoryBarrier2 barrier = {};
+            barrier.srcStageMask = vk::PipelineStageFlagBits2::eCopy;
+            barrier.srcAccessMask = vk::AccessFlagBits2::eTransferWrite;
+            barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+            barrier.newLayout = final_layout;
+            barrier.image = destination;
+            barrier.subresourceRange = range;
+            if (!isDedicated())
+            {
+                barrier.dstStageMask = dst_stage;
+                barrier.dstAccessMask = dst_access;
+                command_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, {}, barrier));
+                return next_value;
+            }
+            // the layout transition happens once, between the release and the acquire
+            barrier.srcQueueFamilyIndex = static_cast<uint32_t>(m_context.transfer_queue_index);
+            barrier.dstQueueFamilyIndex = static_cast<uint32_t>(m_context.graphics_queue_index);
+            command_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, {}, barrier));
+
+            barrier.srcStageMask = vk::PipelineStageFlagBits2::eNone;
+            barrier.srcAccessMask = vk::AccessFlagBits2::eNone;
+            barrier.dstStageMask = dst_stage;
+            barrier.dstAccessMask = dst_access;
+            recording_acquires.images.push_back(barrier);
+            return next_value;
+        }
+
+        /**
+         * Value the batch being recorded signals once it has executed, copies recorded now are done by then
+         */
+        uint64_t GetPendingValue()
+        {
+            std::lock_guard lock(record_mutex);
+            return next_value;
+        }
+
+        /**
+         * Submits the batch being recorded to the transfer queue. Render thread only, a transfer queue shared with
+         * graphics must not be submitted to from two threads
+         * @return value the timeline semaphore reaches once the batch has executed, the last submitted value if
+         * nothing was recorded
+         */
+        uint64_t Submit()
+        {
+            std::lock_guard lock(record_mutex);
+            if (recording_batch == NO_BATCH)
+            {
+                return submitted_value;
+            }
+            Batch& batch = batches[recording_batch];
+            batch.command_buffer.end();
+
+            vk::CommandBufferSubmitInfo command_buffer_info = {};
+            command_buffer_info.commandBuffer = batch.command_buffer;
+            vk::SemaphoreSubmitInfo signal_info = {};
+            signal_info.semaphore = timeline_semaphore;
+            signal_info.value = batch.value;
+            signal_info.stageMask = vk::PipelineStageFlagBits2::eAllCommands;
+            vk::SubmitInfo2 submit_info = {};
+            submit_info.setCommandBufferInfos(command_buffer_info);
+            submit_info.setSignalSemaphoreInfos(signal_info);
+            m_context.transfer_queue.submit2(submit_info);
+
+            if (!recording_acquires.buffers.empty() || !recording_acquires.images.empty())
+            {
+                recording_acquires.value = batch.value;
+                released.push_back(std::move(recording_acquires));
+                recording_acquires = {};
+            }
+            submitted_value = batch.value;
+            ++next_value;
+            recording_batch = NO_BATCH;
+            ++submit_count;
+            return submitted_value;
+        }
+
+        /**
+         * Records the acquire half of every ownership transfer submitted so far into a graphics command buffer.
+         * Nothing is recorded when the transfer queue shares the graphics family
+         * @return value the submit of command_buffer has to wait on (GetWaitInfo), 0 if none
+         */
+        uint64_t RecordAcquireBarriers(vk::CommandBuffer command_buffer)
+        {
+            std::lock_guard lock(record_mutex);
+            uint64_t wait_value = 0;
+            acquire_buffers.clear();
+            acquire_images.clear();
+            for (PendingAcquires& pending : released)
+            {
+                acquire_buffers.insert(acquire_buffers.end(), pending.buffers.begin(), pending.buffers.end());
+                acquire_images.insert(acquire_images.end(), pending.images.begin(), pending.images.end());
+                wait_value = std::max(wait_value, pending.value);
+            }
+            released.clear();
+            if (!acquire_buffers.empty() || !acquire_images.empty())
+            {
+                command_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, acquire_buffers, acquire_images));
+            }
+            return wait_value;
+        }
+
+        /**
+         * Wait for a graphics vkQueueSubmit2 that uses what the upload of value wrote
+         * @param value value returned by Submit
+         * @param stage first stage that reads the uploaded data
+         */
+        vk::SemaphoreSubmitInfo GetWaitInfo(uint64_t value,
+                                            vk::PipelineStageFlags2 stage = vk::PipelineStageFlagBits2::eAllCommands) const
+        {
+            vk::SemaphoreSubmitInfo wait_info = {};
+            wait_info.semaphore = timeline_semaphore;
+            wait_info.value = value;
+            wait_info.stageMask = stage;
+            return wait_info;
+        }
+
+        bool IsUploadComplete(uint64_t value) const
+        {
+            return m_context.device.getSemaphoreCounterValue(timeline_semaphore) >= value;
+        }
+
+        void WaitForUpload(uint64_t value) const
+        {
+            if (value == 0)
+            {
+                return;
+            }
+            vk::SemaphoreWaitInfo wait_info = {};
+            wait_info.setSemaphores(timeline_semaphore);
+            wait_info.setValues(value);
+            if (m_context.device.waitSemaphores(wait_info, UINT64_MAX) != vk::Result::eSuccess)
+            {
+                assert(false && "failed to wait for the upload timeline");
+            }
+        }
+
+        // value of the last Submit, the timeline reaches it without any more submits
+        uint64_t GetSubmittedValue() const
+        {
+            return submitted_value.load(std::memory_order_acquire);
+        }
+
+        vk::Semaphore GetTimelineSemaphore() const
+        {
+            return timeline_semaphore;
+        }
+
+        // batches submitted so far, and how many command pools they cycle through
+        uint64_t GetSubmitCount() const
+        {
+            return submit_count;
+        }
+
+        size_t GetBatchCount() const
+        {
+            return batches.size();
+        }
+
+    private:
+        static constexpr size_t NO_BATCH = std::numeric_limits<size_t>::max();
+
+        const Vulkan::Context& m_context;
+
+        struct Batch
+        {
+            vk::CommandPool command_pool;
+            vk::CommandBuffer command_buffer;
+            // timeline value it signals, 0 if never submitted
+            uint64_t value = 0;
+        };
+        // reused once their value has been reached, a new one is only made when all are in flight
+        std::vector<Batch> batches;
+        size_t recording_batch = NO_BATCH;
+
+        struct PendingAcquires
+        {
+            std::vector<vk::BufferMemoryBarrier2> buffers;
+            std::vector<vk::ImageMemoryBarrier2> images;
+            uint64_t value = 0;
+        };
+        // of the batch being recorded, and of submitted batches the graphics queue hasn't acquired yet
+        PendingAcquires recording_acquires;
+        std::vector<PendingAcquires> released;
+        // scratch for RecordAcquireBarriers
+        std::vector<vk::BufferMemoryBarrier2> acquire_buffers;
+        std::vector<vk::ImageMemoryBarrier2> acquire_images;
+
+        vk::Semaphore timeline_semaphore;
+        uint64_t next_value = 1;
+        std::atomic<uint64_t> submitted_value = 0;
+        uint64_t submit_count = 0;
+        std::mutex record_mutex;
+
+        bool isDedicated() const
+        {
+            return m_context.transfer_queue_index != m_context.graphics_queue_index;
+        }
+
+        /**
+         * Command buffer of the batch being recorded, starting a batch if there's none. record_mutex must be held
+         */
+        vk::CommandBuffer recordingCommandBuffer()
+        {
+            assert(timeline_semaphore && "BuildUploadStructures wasn't called");
+            if (recording_batch != NO_BATCH)
+            {
+                return batches[recording_batch].command_buffer;
+            }
+
+            const uint64_t completed = m_context.device.getSemaphoreCounterValue(timeline_semaphore);
+            for (size_t i = 0; i < batches.size(); ++i)
+            {
+                if (batches[i].value <= completed)
+                {
+                    recording_batch = i;
+                    break;
+                }
+            }
+            if (recording_batch == NO_BATCH)
+            {
+                vk::CommandPoolCreateInfo command_pool_info = {};
+                command_pool_info.queueFamilyIndex = static_cast<uint32_t>(m_context.transfer_queue_index);
+                command_pool_info.flags = vk::CommandPoolCreateFlagBits::eTransient;
+
+                Batch batch;
+                batch.command_pool = m_context.device.createCommandPool(command_pool_info);
+                vk::CommandBufferAllocateInfo command_buffer_info = {};
+                command_buffer_info.commandPool = batch.command_pool;
+                command_buffer_info.commandBufferCount = 1;
+                command_buffer_info.level = vk::CommandBufferLevel::ePrimary;
+                batch.command_buffer = m_context.device.allocateCommandBuffers(command_buffer_info)[0];
+                batches.push_back(batch);
+                recording_batch = batches.size() - 1;
+            }
+
+            Batch& batch = batches[recording_batch];
+            m_context.device.resetCommandPool(batch.command_pool);
+            batch.value = next_value;
+            vk::CommandBufferBeginInfo begin_info = {};
+            begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+            batch.command_buffer.begin(begin_info);
+            return batch.command_buffer;
+        }
+    };
+
+    /**
+     * One persistently mapped staging buffer, handed out front to back as a ring. An upload is a bump of the head
+     * and a memcpy, no allocation or map per asset. \n
+     * Every allocation is given back with the timeline value of the copy that reads it (Release), the space is
+     * reused once the transfer queue has reached that value-- in allocation order, so one slow upload holds back
+     * everything after it. Offsets are aligned for optimalBufferCopyOffsetAlignment \n
+     * \b Usage: auto staging = ring->Allocate(size); memcpy(staging.data, ...); ring->Flush(staging);
+     * ring->Release(staging, scheduler->CopyBuffer(staging.buffer, ...));
+     */
+    export class StagingRing : public ISystem
+    {
+    public:
+        struct Allocation
+        {
+            vk::Buffer buffer;
+            vk::DeviceSize offset = 0;
+            vk::DeviceSize size = 0;
+            void* data = nullptr;
+            uint64_t id = 0;
+
+            explicit operator bool() const
+            {
+                return data != nullptr;
+            }
+        };
+
+        StagingRing(const Vulkan::Context& context, const UploadScheduler& scheduler)
+            :m_context(context), m_scheduler(scheduler)
+        {
+        }
+        ~StagingRing()
+        {
+            if (buffer)
+            {
+                // copies out of the ring may still be executing
+                m_scheduler.WaitForUpload(m_scheduler.GetSubmittedValue());
+                vmaDestroyBuffer(m_context.vram_allocator, static_cast<VkBuffer>(buffer), allocation);
+            }
+        }
+        StagingRing() = delete;
+        StagingRing(const StagingRing&) = delete;
+        StagingRing& operator=(const StagingRing&) = delete;
+        StagingRing(StagingRing&&) = delete;
+        StagingRing& operator=(StagingRing&&) = delete;
+
+        /**
+         * Creates and maps the ring buffer
+         * @param ring_capacity bytes in flight at most, an upload larger than this can't be staged
+         * @return false if the buffer couldn't be created
+         */
+        bool BuildStagingStructures(vk::DeviceSize ring_capacity = DEFAULT_CAPACITY)
+        {
+            const vk::PhysicalDeviceLimits limits = m_context.physical_device.getProperties().limits;
+            // 16 also covers the texel block size of every format (BC blocks are 16 bytes), which image copies need
+            alignment = std::max<vk::DeviceSize>(limits.optimalBufferCopyOffsetAlignment, 16);
+
+            vk::BufferCreateInfo buffer_info = {};
+            buffer_info.size = ring_capacity;
+            buffer_info.usage = vk::BufferUsageFlagBits::eTransferSrc;
+
+            VmaAllocationCreateInfo allocation_info = {};
+            allocation_info.usage = VMA_MEMORY_USAGE_AUTO;
+            allocation_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+
+            VmaAllocationInfo allocated = {};
+            if (vmaCreateBuffer(m_context.vram_allocator, reinterpret_cast<VkBufferCreateInfo*>(&buffer_info),
+                                &allocation_info, reinterpret_cast<VkBuffer*>(&buffer), &allocation, &allocated) != VK_SUCCESS)
+            {
+                std::cerr << "Failed to create the staging ring buffer!" << std::endl;
+                buffer = nullptr;
+                return false;
+            }
+            mapped = static_cast<unsigned char*>(allocated.pMappedData);
+            capacity = ring_capacity;
+            return true;
+        }
+
+        /**
+         * Space for size bytes. Waits for submitted uploads if the ring is full
+         * @param size bytes to stage
+         * @param copy_alignment extra alignment of the offset, on top of optimalBufferCopyOffsetAlignment
+         * @return empty if the space is held by copies that haven't been submitted yet-- Submit and try again-- or
+         * if size is larger than the ring
+         */
+        Allocation Allocate(vk::DeviceSize size, vk::DeviceSize copy_alignment = 1)
+        {
+            std::lock_guard lock(ring_mutex);
+            assert(buffer && "BuildStagingStructures wasn't called");
+            const vk::DeviceSize align = std::max(alignment, copy_alignment);
+            if (size == 0 || size > capacity)
+            {
+                return {};
+            }
+            while (true)
+            {
+                reclaim();
+                const std::optional<vk::DeviceSize> offset = findSpace(size, align);
+                if (offset)
+                {
+                    Region region = {};
+                    region.begin = *offset;
+                    region.end = *offset + size;
+                    regions.push_back(region);
+                    head = region.end;
+
+                    Allocation out = {};
+                    out.buffer = buffer;
+                    out.offset = *offset;
+                    out.size = size;
+                    out.data = mapped + *offset;
+                    out.id = first_region_id + regions.size() - 1;
+                    return out;
+                }
+                // the oldest region frees space only if its copy is on the queue
+                const Region& oldest = regions.front();
+                if (!oldest.released || oldest.value > m_scheduler.GetSubmittedValue())
+                {
+                    return {};
+                }
+                m_scheduler.WaitForUpload(oldest.value);
+            }
+        }
+
+        /**
+         * Makes the written bytes visible to the transfer queue, for memory that isn't host coherent
+         */
+        void Flush(const Allocation& staging) const
+        {
+            vmaFlushAllocation(m_context.vram_allocator, allocation, staging.offset, staging.size);
+        }
+
+        /**
+         * Gives an allocation back
+         * @param staging allocation from Allocate
+         * @param value timeline value of the copy reading it (returned by UploadScheduler's copies), 0 if nothing
+         * reads it
+         */
+        void Release(const Allocation& staging, uint64_t value)
+        {
+            std::lock_guard lock(ring_mutex);
+            assert(staging.id >= first_region_id && staging.id - first_region_id < regions.size() && "staging allocation released twice");
+            Region& region = regions[static_cast<size_t>(staging.id - first_region_id)];
+            region.released = true;
+            region.value = value;
+        }
+
+        vk::DeviceSize GetCapacity() const
+        {
+            return capacity;
+        }
+
+        // bytes between the oldest live allocation and the head, alignment and wrap padding included
+        vk::DeviceSize GetUsedBytes()
+        {
+            std::lock_guard lock(ring_mutex);
+            if (regions.empty())
+            {
+                return 0;
+            }
+            const vk::DeviceSize tail = regions.front().begin;
+            return head > tail ? head - tail : capacity - tail + head;
+        }
+
+    private:
+        static constexpr vk::DeviceSize DEFAULT_CAPACITY = 64ull * 1024 * 1024;
+
+        const Vulkan::Context& m_context;
+        const UploadScheduler& m_scheduler;
+
+        vk::Buffer buffer;
+        VmaAllocation allocation = nullptr;
+        unsigned char* mapped = nullptr;
+        vk::DeviceSize capacity = 0;
+        vk::DeviceSize alignment = 16;
+
+        struct Region
+        {
+            vk::DeviceSize begin = 0;
+            vk::DeviceSize end = 0;
+            // set by Release, the region is reused once the timeline reaches value
+            uint64_t value = 0;
+            bool released = false;
+        };
+        // live allocations in allocation order, regions[i] has the id first_region_id + i
+        std::deque<Region> regions;
+        uint64_t first_region_id = 0;
+        // where the next allocation starts
+        vk::DeviceSize head = 0;
+        std::mutex ring_mutex;
+
+        void reclaim()
+        {
+            while (!regions.empty() && regions.front().released && m_scheduler.IsUploadComplete(regions.front().value))
+            {
+                regions.pop_front();
+                ++first_region_id;
+            }
+            if (regions.empty())
+            {
+                head = 0;
+            }
+        }
+
+        std::optional<vk::DeviceSize> findSpace(vk::DeviceSize size, vk::DeviceSize align) const
+        {
+            auto alignUp = [align](vk::DeviceSize value)
+            {
+                return (value + align - 1) / align * align;
+            };
+            if (regions.empty())
+            {
+                return vk::DeviceSize(0);
+            }
+            const vk::DeviceSize tail = regions.front().begin;
+            if (head > tail)
+            {
+                // free space is [head, capacity) and [0, tail), wrapping skips the end of the buffer
+                const vk::DeviceSize offset = alignUp(head);
+                if (offset + size <= capacity)
+                {
+                    return offset;
+                }
+                if (size <= tail)
+                {
+                    return vk::DeviceSize(0);
+                }
+                return std::nullopt;
+            }
+            // wrapped (head == tail is full): free space is [head, tail)
+            const vk::DeviceSize offset = alignUp(head);
+            if (head < tail && offset + size <= tail)
+            {
+                return offset;
+            }
+            return std::nullopt;
+        }
+    };
+}
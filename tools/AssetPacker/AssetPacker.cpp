@@ -0,0 +1,80 @@
+#include <cstdint>
+
+import std;
+import AssetArchive;
+
+/**
+ * Build step that packs the assets folder into a single archive \n
+ * \b Usage: AssetPacker <assets directory> <output .pak> [none|lz4|zstd]
+ */
+int main(int argc, char** argv)
+{
+    namespace fs = std::filesystem;
+
+    if (argc != 3 && argc != 4)
+    {
+        std::cerr << "Usage: AssetPacker <assets directory> <output .pak> [none|lz4|zstd]" << std::endl;
+        return 1;
+    }
+
+    AngelBase::Core::ArchiveCompression compression = AngelBase::Core::ArchiveCompression::None;
+    if (argc == 4)
+    {
+        std::string_view codec(argv[3]);
+        if (codec == "lz4") compression = AngelBase::Core::ArchiveCompression::LZ4;
+        else if (codec == "zstd") compression = AngelBase::Core::ArchiveCompression::Zstd;
+        else if (codec != "none")
+        {
+            std::cerr << "AssetPacker: unknown compression " << codec << std::endl;
+            return 1;
+        }
+    }
+
+    const fs::path root(argv[1]);
+    const fs::path output(argv[2]);
+    if (!fs::is_directory(root))
+    {
+        std::cerr << "AssetPacker: " << root << " is not a directory" << std::endl;
+        return 1;
+    }
+
+    // sort so the same tree always produces the same archive
+    std::vector<fs::path> files;
+    for (auto it = fs::recursive_directory_iterator(root); it != fs::recursive_directory_iterator(); ++it)
+    {
+        const fs::directory_entry& entry = *it;
+        // shader and pipeline caches are device and driver specific, they are never shipped
+        if (entry.is_directory() && fs::relative(entry.path(), root).generic_string() == "shaders/cache")
+        {
+            it.disable_recursion_pending();
+            continue;
+        }
+        if (!entry.is_regular_file()) continue;
+        if (entry.path().filename() == "CMakeLists.txt") continue;
+        files.push_back(entry.path());
+    }
+    std::ranges::sort(files);
+
+    AngelBase::Core::ArchiveWriter writer(compression);
+    for (const auto& file : files)
+    {
+        std::string relative = fs::relative(file, root).generic_string();
+        if (!writer.addFile(relative, file))
+        {
+            return 1;
+        }
+    }
+
+    if (!output.parent_path().empty())
+    {
+        fs::create_directories(output.parent_path());
+    }
+    if (!writer.write(output))
+    {
+        std::cerr << "AssetPacker: failed to write " << output << std::endl;
+        return 1;
+    }
+
+    std::cout << "AssetPacker: packed " << files.size() << " files into " << output << std::endl;
+    return 0;
+}
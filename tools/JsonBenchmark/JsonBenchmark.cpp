@@ -0,0 +1,159 @@
+#include <cstdint>
+
+import std;
+import JsonParser;
+import JsonParserPool;
+import AssetManifest;
+import FileLoaderSystem;
+import JobSystem;
+
+/**
+ * Generates a scene manifest of the requested size and loads it through JsonParser into a SceneManifest, reporting
+ * MB/s. The first load starts from an empty parser and manifest, the rest reuse both like a level reload does. \n
+ * The same entities are then loaded through a JsonParserPool reading via the FileLoaderSystem: as many scene files
+ * as there are workers, up to four (LoadJsonFiles), and as one NDJSON file (LoadJsonLines) \n
+ * \b Usage: JsonBenchmark [size in MB] [iterations] (defaults to 50 MB, 10 iterations)
+ */
+int main(int argc, char** argv)
+{
+    namespace fs = std::filesystem;
+    using Clock = std::chrono::steady_clock;
+    using namespace AngelBase::Core;
+
+    const size_t target_mb = argc > 1 ? static_cast<size_t>(std::stoul(argv[1])) : 50;
+    const uint32_t iterations = argc > 2 ? static_cast<uint32_t>(std::stoul(argv[2])) : 10;
+    const size_t target_bytes = target_mb * 1024 * 1024;
+
+    // deterministic content so runs are comparable
+    std::string json = "{\"name\": \"benchmark_scene\", \"entities\": [";
+    // same entities, one per line
+    std::string lines;
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> coordinate(-1000.0f, 1000.0f);
+    size_t entity_count = 0;
+    while (json.size() < target_bytes)
+    {
+        if (entity_count > 0) json += ",\n";
+        const std::string entity = std::format(
+            "{{\"name\": \"entity_{}\", \"mesh\": \"meshes/prop_{}.mesh\", \"texture\": \"textures/prop_{}.ktx2\", "
+            "\"position\": [{:.3f}, {:.3f}, {:.3f}], \"rotation\": [0.0, 0.0, 0.0, 1.0], \"scale\": [1.0, 1.0, 1.0]}}",
+            entity_count, entity_count % 512, entity_count % 2048, coordinate(random), coordinate(random), coordinate(random));
+        json += entity;
+        lines += entity;
+        lines += '\n';
+        ++entity_count;
+    }
+    json += "]}";
+
+    const fs::path path = fs::temp_directory_path() / "angelbase_bench_scene.json";
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(json.data(), static_cast<std::streamsize>(json.size()));
+        if (!file)
+        {
+            std::cerr << "JsonBenchmark: failed to write " << path << std::endl;
+            return 1;
+        }
+    }
+    const double megabytes = json.size() / (1024.0 * 1024.0);
+    std::cout << std::format("{:.2f} MB scene manifest, {} entities, {} iterations\n", megabytes, entity_count, iterations);
+
+    JsonParser parser;
+    SceneManifest scene;
+    double best_ms = std::numeric_limits<double>::max();
+    double total_ms = 0.0;
+    for (uint32_t i = 0; i <= iterations; ++i)
+    {
+        const auto start = Clock::now();
+        if (!parser.LoadJsonFile(path.string(), scene) || scene.entities.size() != entity_count)
+        {
+            std::cerr << "JsonBenchmark: load failed" << std::endl;
+            return 1;
+        }
+        const double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        if (i == 0)
+        {
+            std::cout << std::format("first load: {:10.1f} ms ({:.0f} MB/s)\n", ms, megabytes / (ms / 1000.0));
+            continue;
+        }
+        best_ms = std::min(best_ms, ms);
+        total_ms += ms;
+    }
+    if (iterations > 0)
+    {
+        const double average_ms = total_ms / iterations;
+        std::cout << std::format("reused:     {:10.1f} ms avg, {:.1f} ms best ({:.0f} MB/s avg)\n",
+                                 average_ms, best_ms, megabytes / (average_ms / 1000.0));
+    }
+
+    // pooled loads through the FileLoaderSystem
+    JobSystem::Initialize();
+    // capped, every file holds the whole scene
+    const size_t file_count = std::clamp<size_t>(JobSystem::WorkerCount(), 1, 4);
+    std::vector<std::string> files;
+    for (size_t f = 0; f < file_count; ++f)
+    {
+        files.push_back((fs::temp_directory_path() / std::format("angelbase_bench_scene_{}.json", f)).string());
+        std::ofstream file(files.back(), std::ios::binary | std::ios::trunc);
+        file.write(json.data(), static_cast<std::streamsize>(json.size()));
+    }
+    const fs::path lines_path = fs::temp_directory_path() / "angelbase_bench_scene.ndjson";
+    {
+        std::ofstream file(lines_path, std::ios::binary | std::ios::trunc);
+        file.write(lines.data(), static_cast<std::streamsize>(lines.size()));
+    }
+
+    int status = 0;
+    {
+        FileLoaderSystem loader;
+        JsonParserPool pool(&loader);
+        std::vector<SceneManifest> scenes;
+        std::vector<SceneEntity> entities;
+        double files_best_ms = std::numeric_limits<double>::max();
+        double lines_best_ms = std::numeric_limits<double>::max();
+        for (uint32_t i = 0; i <= iterations && status == 0; ++i)
+        {
+            auto start = Clock::now();
+            const std::vector<JsonLoadResult> results = pool.LoadJsonFiles(files, scenes);
+            const double files_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            for (size_t f = 0; f < files.size(); ++f)
+            {
+                if (results[f] != JsonLoadResult::eSuccess || scenes[f].entities.size() != entity_count)
+                {
+                    std::cerr << "JsonBenchmark: pooled load of " << files[f] << " failed" << std::endl;
+                    status = 1;
+                }
+            }
+
+            start = Clock::now();
+            const JsonLoadResult lines_result = pool.LoadJsonLines(lines_path.string(), entities);
+            const double lines_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            if (lines_result != JsonLoadResult::eSuccess || entities.size() != entity_count)
+            {
+                std::cerr << "JsonBenchmark: pooled NDJSON load failed" << std::endl;
+                status = 1;
+            }
+            // the first run allocates parsers and buffers
+            if (i == 0) continue;
+            files_best_ms = std::min(files_best_ms, files_ms);
+            lines_best_ms = std::min(lines_best_ms, lines_ms);
+        }
+        if (status == 0 && iterations > 0)
+        {
+            std::cout << std::format("pool files: {:10.1f} ms best, {} files ({:.0f} MB/s)\n",
+                                     files_best_ms, files.size(), megabytes * files.size() / (files_best_ms / 1000.0));
+            std::cout << std::format("pool lines: {:10.1f} ms best ({:.0f} MB/s)\n",
+                                     lines_best_ms, (lines.size() / (1024.0 * 1024.0)) / (lines_best_ms / 1000.0));
+        }
+    }
+    JobSystem::Shutdown();
+
+    std::error_code ec;
+    fs::remove(path, ec);
+    fs::remove(lines_path, ec);
+    for (const auto& file : files)
+    {
+        fs::remove(file, ec);
+    }
+    return status;
+}
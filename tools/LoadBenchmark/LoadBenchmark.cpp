@@ -0,0 +1,128 @@
+#include <cstdint>
+
+import std;
+import AssetArchive;
+import FileLoaderSystem;
+import JobSystem;
+import Atomics;
+
+/**
+ * Packs the same asset set raw, LZ4 and Zstd, then loads every entry through the FileLoaderSystem and reports
+ * end to end throughput in uncompressed MB/s \n
+ * \b Usage: LoadBenchmark <assets directory> [iterations] \n
+ * Numbers after the first iteration are page cache warm-- drop caches between runs to measure the disk
+ */
+int main(int argc, char** argv)
+{
+    namespace fs = std::filesystem;
+    using namespace AngelBase::Core;
+
+    if (argc < 2)
+    {
+        std::cerr << "Usage: LoadBenchmark <assets directory> [iterations]" << std::endl;
+        return 1;
+    }
+    const fs::path root(argv[1]);
+    const uint32_t iterations = argc > 2 ? static_cast<uint32_t>(std::stoul(argv[2])) : 5;
+
+    struct BenchFile
+    {
+        AssetId id;
+        size_t size;
+    };
+    std::vector<BenchFile> files;
+    std::vector<std::pair<std::string, fs::path>> sources;
+    uint64_t total_bytes = 0;
+    for (const auto& entry : fs::recursive_directory_iterator(root))
+    {
+        if (!entry.is_regular_file() || entry.file_size() == 0) continue;
+        std::string relative = fs::relative(entry.path(), root).generic_string();
+        sources.emplace_back(relative, entry.path());
+        files.push_back({makeAssetId(relative), static_cast<size_t>(entry.file_size())});
+        total_bytes += entry.file_size();
+    }
+    if (files.empty())
+    {
+        std::cerr << "LoadBenchmark: no files under " << root << std::endl;
+        return 1;
+    }
+
+    JobSystem::Initialize();
+
+    std::vector<std::vector<uint8_t>> buffers(files.size());
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        buffers[i].resize(files[i].size);
+    }
+
+    const std::array<std::pair<const char*, ArchiveCompression>, 3> modes = {{
+        {"raw", ArchiveCompression::None},
+        {"lz4", ArchiveCompression::LZ4},
+        {"zstd", ArchiveCompression::Zstd}
+    }};
+
+    std::cout << std::format("{} files, {:.2f} MB uncompressed, {} iterations\n",
+                             files.size(), total_bytes / (1024.0 * 1024.0), iterations);
+    for (const auto& [name, compression] : modes)
+    {
+        fs::path archive_path = fs::temp_directory_path() / std::format("angelbase_bench_{}.pak", name);
+        ArchiveWriter writer(compression);
+        for (const auto& [relative, path] : sources)
+        {
+            writer.addFile(relative, path);
+        }
+        if (!writer.write(archive_path))
+        {
+            std::cerr << "LoadBenchmark: failed to write " << archive_path << std::endl;
+            return 1;
+        }
+
+        FileLoaderSystem loader;
+        if (!loader.mountArchive(archive_path.string().c_str()))
+        {
+            return 1;
+        }
+
+        double best_seconds = std::numeric_limits<double>::max();
+        for (uint32_t iteration = 0; iteration < iterations; ++iteration)
+        {
+            Atomics::Counter counter;
+            std::vector<AsyncRequestHandle> requests;
+            requests.reserve(files.size());
+
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < files.size(); ++i)
+            {
+                requests.push_back(loader.asyncReadEntry(files[i].id, buffers[i].data(), buffers[i].size(),
+                                                         AsyncFilePriority::Normal, counter,
+                                                         [](AsyncRequestHandle) {}));
+            }
+            bool failed = false;
+            for (const auto& request : requests)
+            {
+                AsyncFileResult result;
+                while ((result = request.result->load(std::memory_order_acquire)) == AsyncFileResult::Pending)
+                {
+                    std::this_thread::yield();
+                }
+                failed |= result != AsyncFileResult::Success;
+            }
+            auto end = std::chrono::steady_clock::now();
+            if (failed)
+            {
+                std::cerr << "LoadBenchmark: " << name << " load failed" << std::endl;
+                return 1;
+            }
+            best_seconds = std::min(best_seconds, std::chrono::duration<double>(end - start).count());
+        }
+
+        uint64_t archive_bytes = fs::file_size(archive_path);
+        std::cout << std::format("{:>5}: {:10.2f} MB/s  archive {:.2f} MB  ratio {:.2f}\n",
+                                 name, total_bytes / (1024.0 * 1024.0) / best_seconds,
+                                 archive_bytes / (1024.0 * 1024.0),
+                                 static_cast<double>(total_bytes) / static_cast<double>(archive_bytes));
+    }
+
+    JobSystem::Shutdown();
+    return 0;
+}
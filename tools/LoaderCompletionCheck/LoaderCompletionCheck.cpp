@@ -0,0 +1,204 @@
+#include <cstdint>
+
+import std;
+import FileLoaderSystem;
+import JobSystem;
+import Atomics;
+
+namespace
+{
+    namespace fs = std::filesystem;
+    using namespace AngelBase::Core;
+
+    uint32_t failures = 0;
+
+    void check(bool condition, const char* what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED: " << what << "\n";
+            ++failures;
+        }
+    }
+
+    // a request that never decrements would hang WaitForCounter forever, so give up after a while instead
+    bool waitForZero(const Atomics::Counter& counter, std::chrono::seconds timeout = std::chrono::seconds(10))
+    {
+        const auto give_up = std::chrono::steady_clock::now() + timeout;
+        while (counter.get() > 0)
+        {
+            if (std::chrono::steady_clock::now() > give_up) return false;
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+    AsyncFileResult resultOf(const AsyncRequestHandle& handle)
+    {
+        return handle.result->load(std::memory_order_acquire);
+    }
+
+    std::vector<uint8_t> writePattern(const fs::path& path, size_t size, uint8_t seed)
+    {
+        std::vector<uint8_t> data(size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            data[i] = static_cast<uint8_t>((i * 31 + seed) & 0xFF);
+        }
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        return data;
+    }
+}
+
+/**
+ * Checks the completion guarantees of the FileLoaderSystem: every request ends in exactly one of Success, Failed or
+ * Cancelled and decrements its counter, whether it read, failed, was cancelled, was coalesced with another request
+ * or was still queued when the loader shut down \n
+ * \b Usage: LoaderCompletionCheck \n
+ * Returns non zero and prints what failed, hangs are reported as failures after a timeout
+ */
+int main()
+{
+    const fs::path root = fs::temp_directory_path() / "angelbase_loader_check";
+    fs::create_directories(root);
+    JobSystem::Initialize();
+
+    constexpr size_t FILE_SIZE = 256 * 1024;
+    const std::string data_path = (root / "data.bin").string();
+    const std::vector<uint8_t> expected = writePattern(data_path, FILE_SIZE, 7);
+
+    // success: the whole file lands in the buffer and actual_size is reported
+    {
+        FileLoaderSystem loader;
+        Atomics::Counter counter;
+        std::vector<uint8_t> buffer(FILE_SIZE);
+        size_t actual_size = 0;
+        AsyncRequestHandle handle = loader.asyncReadFileThen(data_path.c_str(), buffer.data(), buffer.size(),
+                                                             AsyncFilePriority::Normal, counter,
+                                                             [&actual_size](const AsyncRequestHandle& done)
+                                                             {
+                                                                 actual_size = done.actual_size;
+                                                             });
+        check(waitForZero(counter), "success: counter never reached zero");
+        check(resultOf(handle) == AsyncFileResult::Success, "success: result is not Success");
+        check(actual_size == FILE_SIZE, "success: actual_size is not the file size");
+        check(buffer == expected, "success: buffer does not match the file");
+    }
+
+    // failure: a missing file fails and still decrements
+    {
+        FileLoaderSystem loader;
+        Atomics::Counter counter;
+        const std::string missing = (root / "missing.bin").string();
+        std::vector<uint8_t> buffer(64);
+        AsyncRequestHandle handle = loader.asyncReadFile(missing.c_str(), buffer.data(), buffer.size(),
+                                                         AsyncFilePriority::Normal, counter, nullptr);
+        check(waitForZero(counter), "failure: counter never reached zero");
+        check(resultOf(handle) == AsyncFileResult::Failed, "failure: result is not Failed");
+    }
+
+    // cancel: asyncCancel either wins (Cancelled) or the read already started (Success), both decrement once.
+    // A late read that allows dropping is always Cancelled
+    {
+        FileLoaderSystem loader;
+        Atomics::Counter counter;
+        constexpr size_t REQUESTS = 64;
+        std::vector<std::vector<uint8_t>> buffers(REQUESTS, std::vector<uint8_t>(FILE_SIZE));
+        std::vector<AsyncRequestHandle> handles;
+        for (size_t i = 0; i < REQUESTS; ++i)
+        {
+            handles.push_back(loader.asyncReadFile(data_path.c_str(), buffers[i].data(), buffers[i].size(),
+                                                   AsyncFilePriority::Low, counter, nullptr));
+        }
+        std::vector<bool> cancelled(REQUESTS);
+        for (size_t i = 0; i < REQUESTS; ++i)
+        {
+            cancelled[i] = loader.asyncCancel(handles[i]);
+        }
+        check(waitForZero(counter), "cancel: counter never reached zero");
+        for (size_t i = 0; i < REQUESTS; ++i)
+        {
+            const AsyncFileResult expected_result = cancelled[i] ? AsyncFileResult::Cancelled : AsyncFileResult::Success;
+            check(resultOf(handles[i]) == expected_result, "cancel: result does not match asyncCancel");
+        }
+
+        Atomics::Counter late_counter;
+        std::vector<uint8_t> buffer(FILE_SIZE);
+        AsyncReadDeadline already_late;
+        already_late.time = std::chrono::steady_clock::now() - std::chrono::seconds(1);
+        already_late.drop_if_late = true;
+        AsyncRequestHandle late = loader.asyncReadFile(data_path.c_str(), buffer.data(), buffer.size(),
+                                                       AsyncFilePriority::Low, late_counter, nullptr, already_late);
+        check(waitForZero(late_counter), "cancel: late read never decremented");
+        check(resultOf(late) == AsyncFileResult::Cancelled, "cancel: late read was not dropped");
+    }
+
+    // coalesce: many requests for one file, including bigger buffers arriving mid read, all get the whole file
+    {
+        FileLoaderSystem loader;
+        Atomics::Counter counter;
+        constexpr size_t REQUESTS = 32;
+        std::vector<std::vector<uint8_t>> buffers;
+        std::vector<AsyncRequestHandle> handles;
+        for (size_t i = 0; i < REQUESTS; ++i)
+        {
+            // every other buffer is oversized, the file still only fills FILE_SIZE of it
+            buffers.emplace_back(i % 2 ? FILE_SIZE * 2 : FILE_SIZE);
+        }
+        for (size_t i = 0; i < REQUESTS; ++i)
+        {
+            handles.push_back(loader.asyncReadFile(data_path.c_str(), buffers[i].data(), buffers[i].size(),
+                                                   AsyncFilePriority::Normal, counter, nullptr));
+        }
+        check(waitForZero(counter), "coalesce: counter never reached zero");
+        for (size_t i = 0; i < REQUESTS; ++i)
+        {
+            check(resultOf(handles[i]) == AsyncFileResult::Success, "coalesce: result is not Success");
+            check(std::equal(expected.begin(), expected.end(), buffers[i].begin()), "coalesce: buffer does not match the file");
+        }
+    }
+
+    // shutdown: requests still queued when the loader is destroyed are cancelled, none is left pending
+    {
+        constexpr size_t FILES = 64;
+        constexpr size_t REQUESTS = 4096;
+        std::vector<std::string> paths;
+        for (size_t i = 0; i < FILES; ++i)
+        {
+            paths.push_back((root / std::format("shutdown_{}.bin", i)).string());
+            writePattern(paths.back(), 64 * 1024, static_cast<uint8_t>(i));
+        }
+        std::vector<std::vector<uint8_t>> buffers(REQUESTS, std::vector<uint8_t>(64 * 1024));
+        std::vector<AsyncRequestHandle> handles;
+        Atomics::Counter counter;
+        {
+            FileLoaderSystem loader;
+            for (size_t i = 0; i < REQUESTS; ++i)
+            {
+                handles.push_back(loader.asyncReadFile(paths[i % FILES].c_str(), buffers[i].data(), buffers[i].size(),
+                                                       AsyncFilePriority::Low, counter, nullptr));
+            }
+        }
+        check(waitForZero(counter), "shutdown: counter never reached zero");
+        size_t cancelled = 0;
+        for (const auto& handle : handles)
+        {
+            const AsyncFileResult result = resultOf(handle);
+            check(result != AsyncFileResult::Pending, "shutdown: request left pending");
+            cancelled += result == AsyncFileResult::Cancelled;
+        }
+        std::cout << std::format("shutdown: {} of {} requests cancelled\n", cancelled, REQUESTS);
+    }
+
+    JobSystem::Shutdown();
+    fs::remove_all(root);
+
+    if (failures)
+    {
+        std::cerr << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "all checks passed" << std::endl;
+    return 0;
+}
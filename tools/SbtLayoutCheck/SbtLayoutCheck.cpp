@@ -0,0 +1,147 @@
+#include <cstdint>
+
+import std;
+import VulkanRayTracing;
+
+namespace
+{
+    using Rendering::Vulkan::ShaderBindingTable;
+    using Region = ShaderBindingTable::Region;
+
+    uint32_t failures = 0;
+
+    void check(bool condition, const std::string& what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED: " << what << "\n";
+            ++failures;
+        }
+    }
+
+    struct ExpectedRegion
+    {
+        uint64_t offset;
+        uint64_t stride;
+        uint64_t size;
+        uint32_t count;
+    };
+
+    struct Case
+    {
+        const char* name;
+        ShaderBindingTable::Desc desc;
+        uint32_t handle_size;
+        uint32_t handle_alignment;
+        uint32_t base_alignment;
+        std::array<ExpectedRegion, ShaderBindingTable::REGION_COUNT> expected;
+        uint64_t total_size;
+    };
+
+    ShaderBindingTable::Desc makeDesc(size_t miss, size_t hit, size_t callable, std::array<uint32_t, 4> data_sizes)
+    {
+        ShaderBindingTable::Desc desc;
+        uint32_t group = 1;
+        for (size_t i = 0; i < miss; ++i) desc.missGroups.push_back(group++);
+        for (size_t i = 0; i < hit; ++i) desc.hitGroups.push_back(group++);
+        for (size_t i = 0; i < callable; ++i) desc.callableGroups.push_back(group++);
+        desc.dataSizes = data_sizes;
+        return desc;
+    }
+
+    /**
+     * Rules every layout has to follow whatever the numbers: vkCmdTraceRaysKHR rejects tables that break them
+     */
+    void checkInvariants(const ShaderBindingTable::Layout& layout, const ShaderBindingTable::Desc& desc, uint32_t handle_size,
+                         uint32_t handle_alignment, uint32_t base_alignment, const std::string& name)
+    {
+        uint64_t end = 0;
+        for (size_t region = 0; region < ShaderBindingTable::REGION_COUNT; ++region)
+        {
+            const auto& out = layout.regions[region];
+            const std::string where = std::format("{} region {}", name, region);
+            check(out.offset == end, where + ": regions are not packed back to back");
+            check(out.offset % base_alignment == 0, where + ": offset not a multiple of shaderGroupBaseAlignment");
+            check(out.stride % handle_alignment == 0, where + ": stride not a multiple of shaderGroupHandleAlignment");
+            check(out.stride >= handle_size + desc.dataSizes[region], where + ": stride smaller than handle plus data");
+            check(out.size >= out.stride * out.count, where + ": size smaller than its records");
+            check(out.count == 0 || out.size % base_alignment == 0, where + ": size not a multiple of shaderGroupBaseAlignment");
+            end = out.offset + out.size;
+        }
+        const auto& raygen = layout.regions[static_cast<size_t>(Region::RayGen)];
+        check(raygen.count == 1, name + ": raygen must hold exactly one record");
+        check(raygen.size == raygen.stride, name + ": raygen size must equal its stride");
+        check(layout.totalSize == end, name + ": total size is not the end of the last region");
+    }
+}
+
+/**
+ * Checks ShaderBindingTable::computeLayout against hand computed layouts and the alignment rules of
+ * vkCmdTraceRaysKHR-- no device needed \n
+ * \b Usage: SbtLayoutCheck \n
+ * Returns non zero and prints what failed
+ */
+int main()
+{
+    const std::vector<Case> cases = {
+        // typical desktop numbers: 32 byte handles, 32 byte handle alignment, 64 byte base alignment
+        {"no inline data", makeDesc(2, 1, 0, {0, 0, 0, 0}), 32, 32, 64,
+         {{{0, 64, 64, 1}, {64, 32, 64, 2}, {128, 32, 64, 1}, {192, 32, 0, 0}}}, 192},
+        {"inline data", makeDesc(2, 3, 1, {8, 0, 24, 4}), 32, 32, 64,
+         {{{0, 64, 64, 1}, {64, 32, 64, 2}, {128, 64, 192, 3}, {320, 64, 64, 1}}}, 384},
+        // handle alignment below the handle size and a large base alignment
+        {"large base alignment", makeDesc(3, 2, 0, {0, 4, 0, 0}), 32, 16, 128,
+         {{{0, 128, 128, 1}, {128, 48, 256, 3}, {384, 32, 128, 2}, {512, 32, 0, 0}}}, 512},
+        // raygen only
+        {"raygen only", makeDesc(0, 0, 0, {16, 0, 0, 0}), 32, 32, 64,
+         {{{0, 64, 64, 1}, {64, 32, 0, 0}, {64, 32, 0, 0}, {64, 32, 0, 0}}}, 64},
+    };
+
+    for (const Case& test : cases)
+    {
+        const ShaderBindingTable::Layout layout = ShaderBindingTable::computeLayout(test.desc, test.handle_size,
+                                                                                    test.handle_alignment, test.base_alignment);
+        for (size_t region = 0; region < ShaderBindingTable::REGION_COUNT; ++region)
+        {
+            const auto& out = layout.regions[region];
+            const ExpectedRegion& expected = test.expected[region];
+            const std::string where = std::format("{} region {}", test.name, region);
+            check(out.offset == expected.offset, std::format("{}: offset {} != {}", where, out.offset, expected.offset));
+            check(out.stride == expected.stride, std::format("{}: stride {} != {}", where, out.stride, expected.stride));
+            check(out.size == expected.size, std::format("{}: size {} != {}", where, out.size, expected.size));
+            check(out.count == expected.count, std::format("{}: count {} != {}", where, out.count, expected.count));
+        }
+        check(layout.totalSize == test.total_size,
+              std::format("{}: total size {} != {}", test.name, layout.totalSize, test.total_size));
+        checkInvariants(layout, test.desc, test.handle_size, test.handle_alignment, test.base_alignment, test.name);
+    }
+
+    // sweep of the power of two limits devices report, with odd inline data sizes
+    uint32_t swept = 0;
+    for (uint32_t handle_size : {16u, 32u, 64u})
+    {
+        for (uint32_t handle_alignment : {16u, 32u, 64u})
+        {
+            for (uint32_t base_alignment : {32u, 64u, 128u, 256u})
+            {
+                if (base_alignment < handle_alignment) continue;
+                for (uint32_t data : {0u, 4u, 12u, 40u})
+                {
+                    const ShaderBindingTable::Desc desc = makeDesc(2, 5, 1, {data, data / 2, data, data * 2});
+                    const auto layout = ShaderBindingTable::computeLayout(desc, handle_size, handle_alignment, base_alignment);
+                    checkInvariants(layout, desc, handle_size, handle_alignment, base_alignment,
+                                    std::format("sweep {}/{}/{} data {}", handle_size, handle_alignment, base_alignment, data));
+                    ++swept;
+                }
+            }
+        }
+    }
+
+    if (failures)
+    {
+        std::cerr << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << std::format("all checks passed ({} fixed layouts, {} swept)", cases.size(), swept) << std::endl;
+    return 0;
+}
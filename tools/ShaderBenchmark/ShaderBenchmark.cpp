@@ -0,0 +1,78 @@
+#include <cstdint>
+
+import std;
+import ShaderManager;
+import JobSystem;
+
+/**
+ * Cold startup shader compilation time for the whole shader set at different worker counts, plus one warm cache
+ * run at the end \n
+ * \b Usage: ShaderBenchmark <shader directory> [worker counts...] (defaults to 1 4 16) \n
+ * Every cold run uses a fresh ShaderManager, so per worker Slang session creation is included
+ */
+int main(int argc, char** argv)
+{
+    namespace fs = std::filesystem;
+    using Clock = std::chrono::steady_clock;
+
+    if (argc < 2)
+    {
+        std::cerr << "Usage: ShaderBenchmark <shader directory> [worker counts...]" << std::endl;
+        return 1;
+    }
+    const std::string directory = argv[1];
+
+    std::vector<uint32_t> worker_counts;
+    for (int i = 2; i < argc; ++i)
+    {
+        worker_counts.push_back(static_cast<uint32_t>(std::stoul(argv[i])));
+    }
+    if (worker_counts.empty())
+    {
+        worker_counts = {1, 4, 16};
+    }
+
+    std::vector<std::string> names;
+    for (const auto& entry : fs::directory_iterator(directory))
+    {
+        if (entry.is_regular_file() && entry.path().extension() == ".slang")
+        {
+            names.push_back(entry.path().filename().string());
+        }
+    }
+    std::ranges::sort(names);
+    if (names.empty())
+    {
+        std::cerr << "ShaderBenchmark: no .slang files in " << directory << std::endl;
+        return 1;
+    }
+    std::cout << names.size() << " shaders in " << directory << "\n";
+
+    auto run = [&](uint32_t workers, bool use_cache)
+    {
+        JobSystem::Initialize(workers);
+        const auto start = Clock::now();
+        size_t failed = 0;
+        {
+            Rendering::ShaderManager manager;
+            manager.initialize();
+            manager.setDiskCacheEnabled(use_cache);
+            for (auto error : manager.compileShaders(names, directory))
+            {
+                failed += error != Rendering::CompiledShader::eSuccess;
+            }
+        }
+        const double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        JobSystem::Shutdown();
+
+        std::cout << std::format("{:>4} workers {:>6}: {:10.1f} ms ({:.2f} ms/shader, {} failed)\n",
+                                 workers, use_cache ? "warm" : "cold", ms, ms / names.size(), failed);
+    };
+
+    for (uint32_t workers : worker_counts)
+    {
+        run(workers, false);
+    }
+    run(worker_counts.back(), true);
+    return 0;
+}
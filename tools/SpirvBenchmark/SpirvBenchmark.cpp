@@ -0,0 +1,287 @@
+#include <cstdint>
+#include <vulkan/vulkan.hpp>
+
+import std;
+import ShaderManager;
+import JobSystem;
+
+/**
+ * Compares the SPIR-V post pass recipes on the shader set: binary size, instruction count and, when a Vulkan device
+ * is available, shader module + pipeline creation time \n
+ * \b Usage: SpirvBenchmark <shader directory> \n
+ * Turn off the driver's own shader cache for honest pipeline numbers (MESA_SHADER_CACHE_DISABLE=true,
+ * __GL_SHADER_DISK_CACHE=0, ...)
+ */
+namespace
+{
+    using Rendering::ShaderReflection;
+
+    struct BenchDevice
+    {
+        vk::Instance instance;
+        vk::Device device;
+
+        ~BenchDevice()
+        {
+            if (device) device.destroy();
+            if (instance) instance.destroy();
+        }
+    };
+
+    // headless device with the features the engine's shaders use, false if there is no usable GPU
+    bool createDevice(BenchDevice& bench)
+    {
+        try
+        {
+            vk::ApplicationInfo app("SpirvBenchmark", 1, "AngelBase", 1, VK_API_VERSION_1_3);
+            bench.instance = vk::createInstance(vk::InstanceCreateInfo({}, &app));
+
+            auto physical_devices = bench.instance.enumeratePhysicalDevices();
+            if (physical_devices.empty()) return false;
+            vk::PhysicalDevice physical = physical_devices.front();
+
+            auto families = physical.getQueueFamilyProperties();
+            auto graphics = std::ranges::find_if(families, [](const vk::QueueFamilyProperties& family)
+            {
+                return static_cast<bool>(family.queueFlags & vk::QueueFlagBits::eGraphics);
+            });
+            if (graphics == families.end()) return false;
+
+            const float priority = 1.0f;
+            vk::DeviceQueueCreateInfo queue_info({}, static_cast<uint32_t>(graphics - families.begin()), 1, &priority);
+
+            vk::PhysicalDeviceVulkan13Features features13 = {};
+            features13.dynamicRendering = VK_TRUE;
+            vk::PhysicalDeviceVulkan12Features features12 = {};
+            features12.pNext = &features13;
+            features12.bufferDeviceAddress = VK_TRUE;
+            features12.descriptorIndexing = VK_TRUE;
+            features12.runtimeDescriptorArray = VK_TRUE;
+            features12.descriptorBindingPartiallyBound = VK_TRUE;
+            features12.descriptorBindingVariableDescriptorCount = VK_TRUE;
+            features12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+            vk::PhysicalDeviceFeatures2 features = {};
+            features.pNext = &features12;
+            features.features.shaderInt64 = VK_TRUE;
+
+            vk::DeviceCreateInfo device_info({}, 1, &queue_info);
+            device_info.pNext = &features;
+            bench.device = physical.createDevice(device_info);
+            return true;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "SpirvBenchmark: no Vulkan device (" << e.what() << "), skipping pipeline timings" << std::endl;
+            return false;
+        }
+    }
+
+    std::pair<vk::Format, uint32_t> vertexFormat(const std::string& type)
+    {
+        static const std::unordered_map<std::string, std::pair<vk::Format, uint32_t>> formats = {
+            {"float",  {vk::Format::eR32Sfloat, 4}},           {"float2", {vk::Format::eR32G32Sfloat, 8}},
+            {"float3", {vk::Format::eR32G32B32Sfloat, 12}},    {"float4", {vk::Format::eR32G32B32A32Sfloat, 16}},
+            {"uint",   {vk::Format::eR32Uint, 4}},             {"uint2",  {vk::Format::eR32G32Uint, 8}},
+            {"uint3",  {vk::Format::eR32G32B32Uint, 12}},      {"uint4",  {vk::Format::eR32G32B32A32Uint, 16}},
+            {"int",    {vk::Format::eR32Sint, 4}},             {"int2",   {vk::Format::eR32G32Sint, 8}},
+            {"int3",   {vk::Format::eR32G32B32Sint, 12}},      {"int4",   {vk::Format::eR32G32B32A32Sint, 16}},
+        };
+        auto it = formats.find(type);
+        return it != formats.end() ? it->second : std::pair{vk::Format::eR32G32B32A32Sfloat, 16u};
+    }
+
+    /**
+     * Builds the pipeline for one shader the way the engine would and times creation
+     * @param cache pipeline cache to build through, null for none
+     * @return module + pipeline creation time in ms, or nullopt if it couldn't be built
+     */
+    std::optional<double> timePipeline(vk::Device device, const Rendering::CompiledShader& shader, vk::PipelineCache cache = nullptr)
+    {
+        using Clock = std::chrono::steady_clock;
+        const ShaderReflection& reflection = shader.reflection_data;
+
+        // layout: same derivation rules as PipelineManager, bindless arrays get a fixed size here
+        std::map<uint32_t, std::vector<vk::DescriptorSetLayoutBinding>> set_bindings;
+        std::map<uint32_t, std::vector<vk::DescriptorBindingFlags>> set_flags;
+        for (const auto& buffer : reflection.uniformBuffers)
+        {
+            set_bindings[buffer.set].emplace_back(buffer.binding, vk::DescriptorType::eUniformBuffer, 1, buffer.stages);
+            set_flags[buffer.set].emplace_back();
+        }
+        for (const auto& texture : reflection.textures)
+        {
+            const bool unbounded = texture.count == ShaderReflection::UNBOUNDED;
+            vk::DescriptorType type = vk::DescriptorType::eSampledImage;
+            if (texture.type == ShaderReflection::TextureType::CombinedSampler) type = vk::DescriptorType::eCombinedImageSampler;
+            if (texture.type == ShaderReflection::TextureType::Storage) type = vk::DescriptorType::eStorageImage;
+            if (texture.type == ShaderReflection::TextureType::Sampler) type = vk::DescriptorType::eSampler;
+            set_bindings[texture.set].emplace_back(texture.binding, type, unbounded ? 1024u : texture.count, texture.stages);
+            set_flags[texture.set].push_back(unbounded ? vk::DescriptorBindingFlagBits::ePartiallyBound |
+                                                         vk::DescriptorBindingFlagBits::eVariableDescriptorCount
+                                                       : vk::DescriptorBindingFlags{});
+        }
+
+        std::vector<vk::DescriptorSetLayout> set_layouts;
+        const uint32_t set_count = set_bindings.empty() ? 0 : set_bindings.rbegin()->first + 1;
+        for (uint32_t set = 0; set < set_count; ++set)
+        {
+            vk::DescriptorSetLayoutBindingFlagsCreateInfo flags_info(static_cast<uint32_t>(set_flags[set].size()), set_flags[set].data());
+            vk::DescriptorSetLayoutCreateInfo set_info({}, static_cast<uint32_t>(set_bindings[set].size()), set_bindings[set].data());
+            set_info.pNext = &flags_info;
+            set_layouts.push_back(device.createDescriptorSetLayout(set_info));
+        }
+        auto push_constants = reflection.pushConstantRanges();
+        vk::PipelineLayout layout = device.createPipelineLayout(vk::PipelineLayoutCreateInfo(
+            {}, static_cast<uint32_t>(set_layouts.size()), set_layouts.data(),
+            static_cast<uint32_t>(push_constants.size()), push_constants.data()));
+
+        std::optional<double> elapsed;
+        const auto start = Clock::now();
+        vk::ShaderModule module = device.createShaderModule(vk::ShaderModuleCreateInfo(
+            {}, shader.spirv_code.size() * sizeof(uint32_t), shader.spirv_code.data()));
+
+        std::vector<vk::PipelineShaderStageCreateInfo> stages;
+        for (const auto& entry_point : reflection.entryPoints)
+        {
+            stages.emplace_back(vk::PipelineShaderStageCreateFlags{}, entry_point.stage, module, entry_point.name.c_str());
+        }
+
+        vk::Pipeline pipeline = nullptr;
+        if (stages.size() == 1 && stages[0].stage == vk::ShaderStageFlagBits::eCompute)
+        {
+            auto result = device.createComputePipeline(cache, vk::ComputePipelineCreateInfo({}, stages[0], layout));
+            if (result.result == vk::Result::eSuccess) pipeline = result.value;
+        }
+        else if (!stages.empty())
+        {
+            std::vector<vk::VertexInputAttributeDescription> attributes;
+            uint32_t stride = 0;
+            for (const auto& input : reflection.vertexInputs)
+            {
+                auto [format, size] = vertexFormat(input.type);
+                attributes.emplace_back(input.location, 0, format, stride);
+                stride += size;
+            }
+            vk::VertexInputBindingDescription binding(0, stride, vk::VertexInputRate::eVertex);
+            vk::PipelineVertexInputStateCreateInfo vertex_input({}, stride ? 1u : 0u, &binding,
+                                                                static_cast<uint32_t>(attributes.size()), attributes.data());
+            vk::PipelineInputAssemblyStateCreateInfo input_assembly({}, vk::PrimitiveTopology::eTriangleList);
+            vk::PipelineViewportStateCreateInfo viewport({}, 1, nullptr, 1, nullptr);
+            vk::PipelineRasterizationStateCreateInfo rasterization({}, VK_FALSE, VK_FALSE, vk::PolygonMode::eFill,
+                                                                   vk::CullModeFlagBits::eBack, vk::FrontFace::eClockwise,
+                                                                   VK_FALSE, 0.0f, 0.0f, 0.0f, 1.0f);
+            vk::PipelineMultisampleStateCreateInfo multisample({}, vk::SampleCountFlagBits::e1);
+            vk::PipelineDepthStencilStateCreateInfo depth({}, VK_TRUE, VK_TRUE, vk::CompareOp::eLess);
+            vk::PipelineColorBlendAttachmentState blend_attachment = {};
+            blend_attachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+                                              vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+            vk::PipelineColorBlendStateCreateInfo blend({}, VK_FALSE, vk::LogicOp::eCopy, 1, &blend_attachment);
+            std::array dynamic_states = {vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+            vk::PipelineDynamicStateCreateInfo dynamic({}, static_cast<uint32_t>(dynamic_states.size()), dynamic_states.data());
+            const vk::Format color_format = vk::Format::eB8G8R8A8Unorm;
+            vk::PipelineRenderingCreateInfo rendering(0, 1, &color_format, vk::Format::eD32Sfloat);
+
+            vk::GraphicsPipelineCreateInfo pipeline_info({}, static_cast<uint32_t>(stages.size()), stages.data(),
+                                                         &vertex_input, &input_assembly, nullptr, &viewport, &rasterization,
+                                                         &multisample, &depth, &blend, &dynamic, layout);
+            pipeline_info.pNext = &rendering;
+            auto result = device.createGraphicsPipeline(cache, pipeline_info);
+            if (result.result == vk::Result::eSuccess) pipeline = result.value;
+        }
+        if (pipeline)
+        {
+            elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            device.destroyPipeline(pipeline);
+        }
+
+        device.destroyShaderModule(module);
+        device.destroyPipelineLayout(layout);
+        for (auto set_layout : set_layouts)
+        {
+            device.destroyDescriptorSetLayout(set_layout);
+        }
+        return elapsed;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    namespace fs = std::filesystem;
+    using Rendering::SpirvOptimization;
+
+    if (argc < 2)
+    {
+        std::cerr << "Usage: SpirvBenchmark <shader directory>" << std::endl;
+        return 1;
+    }
+    const std::string directory = argv[1];
+
+    std::vector<std::string> names;
+    for (const auto& entry : fs::directory_iterator(directory))
+    {
+        if (entry.is_regular_file() && entry.path().extension() == ".slang")
+        {
+            names.push_back(entry.path().filename().string());
+        }
+    }
+    std::ranges::sort(names);
+    if (names.empty())
+    {
+        std::cerr << "SpirvBenchmark: no .slang files in " << directory << std::endl;
+        return 1;
+    }
+
+    BenchDevice bench;
+    const bool has_device = createDevice(bench);
+    JobSystem::Initialize();
+
+    struct Recipe
+    {
+        const char* name;
+        SpirvOptimization optimization;
+        bool strip_debug;
+    };
+    const std::array<Recipe, 5> recipes = {{
+        {"none",       SpirvOptimization::None,        false},
+        {"strip",      SpirvOptimization::None,        true},
+        {"perf",       SpirvOptimization::Performance, false},
+        {"perf+strip", SpirvOptimization::Performance, true},
+        {"size+strip", SpirvOptimization::Size,        true},
+    }};
+
+    std::cout << std::format("{:<12} {:>12} {:>14} {:>14} {:>14}\n", "recipe", "bytes", "instructions", "pipeline ms", "warm cache ms");
+    for (const Recipe& recipe : recipes)
+    {
+        Rendering::ShaderManager manager;
+        manager.initialize();
+        manager.setDiskCacheEnabled(false);
+        manager.setSpirvOptimization(recipe.optimization, recipe.strip_debug);
+        manager.compileShaders(names, directory);
+
+        size_t bytes = 0;
+        uint64_t instructions = 0;
+        double pipeline_ms = 0.0;
+        double warm_ms = 0.0;
+        // the first build fills the cache, the second is what a run with PipelineManager's saved cache pays
+        vk::PipelineCache cache = has_device ? bench.device.createPipelineCache(vk::PipelineCacheCreateInfo{}) : nullptr;
+        for (const auto& name : names)
+        {
+            const Rendering::CompiledShader* shader = manager.getShader(name);
+            if (!shader) continue;
+            bytes += shader->stats.size_bytes;
+            instructions += shader->stats.instruction_count;
+            if (has_device)
+            {
+                pipeline_ms += timePipeline(bench.device, *shader, cache).value_or(0.0);
+                warm_ms += timePipeline(bench.device, *shader, cache).value_or(0.0);
+            }
+        }
+        if (cache) bench.device.destroyPipelineCache(cache);
+        std::cout << std::format("{:<12} {:>12} {:>14} {:>14} {:>14}\n", recipe.name, bytes, instructions,
+                                 has_device ? std::format("{:.2f}", pipeline_ms) : std::string("-"),
+                                 has_device ? std::format("{:.2f}", warm_ms) : std::string("-"));
+    }
+
+    JobSystem::Shutdown();
+    return 0;
+}